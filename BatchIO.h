@@ -0,0 +1,398 @@
+#ifndef __BATCH_IO_H__
+#define __BATCH_IO_H__
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+// Segmentation offload options (Linux 4.18 / 5.0); older headers lack them
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Largest protocol header BatchIO will stage per datagram; room for an ACK
+// with a full SACK bitmap, which is copied in rather than referenced
+#define BATCH_MAX_HEADER 160
+// Kernel limits for one UDP_SEGMENT send: segments and total payload
+#define BATCH_GSO_MAX_SEGMENTS 64
+#define BATCH_GSO_MAX_BYTES 65000
+// A GRO receive can return up to a full UDP datagram of coalesced segments
+#define BATCH_GRO_BUFFER 65536
+
+// Batched datagram I/O for the DATA and ACK paths.
+//   Outgoing packets are queued and handed to the kernel with one sendmmsg()
+//   per batch; incoming packets are drained with one recvmmsg() per batch.
+//   With use_mmsg == false (or on kernels without the calls) every packet
+//   falls back to its own sendmsg()/recvmsg(), so both modes can be compared.
+// Datagrams are gathered with two iovecs: the header (copied into a small
+// per-slot buffer) and the payload referenced in place, so no payload bytes
+// are copied on the way to the kernel.
+// With enable_gso(), runs of equal-sized datagrams to the same peer leave as
+// one UDP_SEGMENT message that the kernel (or NIC) cuts into packets; with
+// enable_gro(), the kernel may hand back many same-sized datagrams in one
+// buffer, which receive() splits again. Callers see single datagrams either
+// way.
+// On a non-blocking socket a full send buffer leaves the rest of the batch
+// queued (blocked() == true) until the caller sees the socket writable.
+// syscalls() / packets() count kernel crossings for benchmarking.
+class BatchIO
+{
+public:
+    BatchIO(int sockfd, size_t batch_size, size_t max_packet, bool use_mmsg)
+        : sockfd(sockfd), batch(batch_size ? batch_size : 1), max_packet(max_packet),
+          mmsg(use_mmsg), gso(false), gro(false), queued(0), stalled(false),
+          received(0), n_syscalls(0), n_packets(0), send_hdrs(batch * BATCH_MAX_HEADER),
+          send_iov(2 * batch), send_to(batch), send_bytes(batch), send_msgs(batch),
+          msg_slots(batch), send_ctrl(batch * CMSG_SPACE(sizeof(uint16_t))),
+          recv_buf(batch * max_packet), recv_msgs(batch), recv_iov(batch),
+          recv_addrs(batch), recv_ctrl(batch * CMSG_SPACE(sizeof(int)))
+    {
+        for (size_t i = 0; i < batch; ++i)
+        {
+            send_iov[2 * i].iov_base = &send_hdrs[i * BATCH_MAX_HEADER];
+            recv_iov[i].iov_base = &recv_buf[i * max_packet];
+            recv_iov[i].iov_len = max_packet;
+        }
+    }
+
+    size_t batch_size() const { return batch; }
+
+    // MODIFIES: *this
+    // EFFECTS: Send runs of equal-sized datagrams with UDP_SEGMENT from now
+    //          on; false (and no change) if the kernel does not support it
+    bool enable_gso()
+    {
+        int zero = 0;
+        gso = setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+        return gso;
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Let the kernel coalesce arriving datagrams (UDP_GRO); receive
+    //          buffers grow to hold a coalesced batch. False if unsupported
+    bool enable_gro()
+    {
+        int one = 1;
+        if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &one, sizeof(one)) != 0)
+            return false;
+        gro = true;
+        recv_buf.assign(batch * BATCH_GRO_BUFFER, 0);
+        for (size_t i = 0; i < batch; ++i)
+        {
+            recv_iov[i].iov_base = &recv_buf[i * BATCH_GRO_BUFFER];
+            recv_iov[i].iov_len = BATCH_GRO_BUFFER;
+        }
+        return true;
+    }
+
+    // REQUIRES: hdr_len <= BATCH_MAX_HEADER; hdr_len + len <= max_packet;
+    //           payload stays valid until the datagram has been sent
+    // MODIFIES: queue
+    // EFFECTS: Append one datagram (header followed by payload) to the send
+    //          batch; the batch is flushed automatically once it is full. A
+    //          datagram is never dropped here: if a non-blocking socket
+    //          cannot take a full batch, the queue grows and everything waits
+    //          for the socket to become writable (blocked() == true)
+    void queue(const void *hdr, size_t hdr_len, const void *payload, size_t len,
+               const sockaddr_in &to)
+    {
+        if (queued == send_to.size() && !flush() && queued == send_to.size())
+            grow();
+
+        memcpy(send_iov[2 * queued].iov_base, hdr, hdr_len);
+        send_iov[2 * queued].iov_len = hdr_len;
+        send_iov[2 * queued + 1].iov_base = const_cast<void *>(payload);
+        send_iov[2 * queued + 1].iov_len = len;
+        send_to[queued] = to;
+        send_bytes[queued] = hdr_len + len;
+        ++queued;
+    }
+
+    // EFFECTS: Hand every queued datagram to the kernel. When a non-blocking
+    //          socket's buffer fills up, the unsent datagrams stay queued for
+    //          the next flush() (wait for the socket to become writable) and
+    //          false is returned
+    bool flush()
+    {
+        size_t done = 0; // Datagrams handed over (or given up on)
+        while (done < queued)
+        {
+            size_t msgs = build_messages(done);
+            int n;
+            if (mmsg)
+                n = sendmmsg(sockfd, &send_msgs[0], msgs, 0);
+            else
+                n = sendmsg(sockfd, &send_msgs[0].msg_hdr, 0) < 0 ? -1 : 1;
+            ++n_syscalls;
+
+            if (n < 0 && mmsg && errno == ENOSYS)
+            {
+                mmsg = false;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return keep_unsent(done);
+            if (n < 0 && gso && msg_slots[0] > 1 && (errno == EIO || errno == EINVAL))
+            {
+                gso = false; // The device cannot segment; send them singly
+                continue;
+            }
+            if (n <= 0)
+                n = 1; // Send error (e.g. EMSGSIZE): drop that one like a loss
+            else
+            {
+                for (int k = 0; k < n; ++k)
+                    n_packets += msg_slots[k];
+            }
+            for (int k = 0; k < n; ++k)
+                done += msg_slots[k];
+        }
+        queued = 0;
+        stalled = false;
+        return true;
+    }
+
+    // True while datagrams are waiting for the socket to become writable
+    bool blocked() const { return stalled; }
+
+    // MODIFIES: received packets
+    // EFFECTS: Read up to batch_size() buffers without blocking; returns how
+    //          many datagrams arrived (more than batch_size() when GRO
+    //          coalesced some). They stay valid until the next receive()
+    size_t receive()
+    {
+        size_t buffers = 0;
+        if (mmsg)
+        {
+            prepare_receive(batch);
+            int n = recvmmsg(sockfd, &recv_msgs[0], batch, MSG_DONTWAIT, NULL);
+            ++n_syscalls;
+            if (n >= 0)
+                buffers = n;
+            else if (errno == ENOSYS)
+                mmsg = false;
+            else
+                return check_again();
+        }
+
+        if (!mmsg)
+        {
+            prepare_receive(batch);
+            while (buffers < batch)
+            {
+                ssize_t n = recvmsg(sockfd, &recv_msgs[buffers].msg_hdr, MSG_DONTWAIT);
+                ++n_syscalls;
+                if (n < 0)
+                    break;
+                recv_msgs[buffers].msg_len = n;
+                ++buffers;
+            }
+            if (buffers == 0)
+                return check_again();
+        }
+
+        split_received(buffers);
+        n_packets += received;
+        return received;
+    }
+
+    const char *packet(size_t i) const { return segments[i].data; }
+    size_t length(size_t i) const { return segments[i].len; }
+    const sockaddr_in &source(size_t i) const { return recv_addrs[segments[i].buffer]; }
+
+    uint64_t syscalls() const { return n_syscalls; }
+    uint64_t packets() const { return n_packets; }
+
+private:
+    // One datagram as handed to the caller; GRO buffers hold several
+    struct Segment
+    {
+        const char *data;
+        size_t len;
+        size_t buffer;
+    };
+
+    static bool same_peer(const sockaddr_in &a, const sockaddr_in &b)
+    {
+        return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+    }
+
+    // EFFECTS: Build up to batch messages from datagrams [first, queued).
+    //          With GSO a message takes a run of datagrams to one peer that
+    //          are all the size of the first (the last may be shorter).
+    //          Returns the message count; msg_slots says how many datagrams
+    //          each carries
+    size_t build_messages(size_t first)
+    {
+        size_t msgs = 0;
+        size_t slot = first;
+        while (slot < queued && msgs < batch)
+        {
+            size_t seg = send_bytes[slot];
+            size_t total = seg;
+            size_t count = 1;
+            while (gso && slot + count < queued && count < BATCH_GSO_MAX_SEGMENTS &&
+                   send_bytes[slot + count - 1] == seg && send_bytes[slot + count] <= seg &&
+                   total + send_bytes[slot + count] <= BATCH_GSO_MAX_BYTES &&
+                   same_peer(send_to[slot + count], send_to[slot]))
+                total += send_bytes[slot + count++];
+
+            msghdr &msg = send_msgs[msgs].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &send_to[slot];
+            msg.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_iov = &send_iov[2 * slot];
+            msg.msg_iovlen = 2 * count;
+            if (count > 1)
+            {
+                char *ctrl = &send_ctrl[msgs * CMSG_SPACE(sizeof(uint16_t))];
+                memset(ctrl, 0, CMSG_SPACE(sizeof(uint16_t)));
+                msg.msg_control = ctrl;
+                msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t seg16 = seg;
+                memcpy(CMSG_DATA(cm), &seg16, sizeof(seg16));
+            }
+            msg_slots[msgs++] = count;
+            slot += count;
+        }
+        return msgs;
+    }
+
+    // MODIFIES: send slots
+    // EFFECTS: Double the datagrams that can wait in the send slots, keeping
+    //          the queued ones
+    void grow()
+    {
+        size_t slots = 2 * send_to.size();
+        send_hdrs.resize(slots * BATCH_MAX_HEADER);
+        send_iov.resize(2 * slots);
+        send_to.resize(slots);
+        send_bytes.resize(slots);
+        for (size_t i = 0; i < slots; ++i)
+            send_iov[2 * i].iov_base = &send_hdrs[i * BATCH_MAX_HEADER];
+    }
+
+    // EFFECTS: Move datagrams [done, queued) to the front of the batch
+    bool keep_unsent(size_t done)
+    {
+        for (size_t i = done; i < queued; ++i)
+        {
+            size_t j = i - done;
+            memcpy(send_iov[2 * j].iov_base, send_iov[2 * i].iov_base,
+                   send_iov[2 * i].iov_len);
+            send_iov[2 * j].iov_len = send_iov[2 * i].iov_len;
+            send_iov[2 * j + 1] = send_iov[2 * i + 1];
+            send_to[j] = send_to[i];
+            send_bytes[j] = send_bytes[i];
+        }
+        queued -= done;
+        stalled = true;
+        return false;
+    }
+
+    void prepare_receive(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            msghdr &msg = recv_msgs[i].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &recv_addrs[i];
+            msg.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_iov = &recv_iov[i];
+            msg.msg_iovlen = 1;
+            if (gro)
+            {
+                msg.msg_control = &recv_ctrl[i * CMSG_SPACE(sizeof(int))];
+                msg.msg_controllen = CMSG_SPACE(sizeof(int));
+            }
+        }
+    }
+
+    // EFFECTS: Cut every received buffer into datagrams at its GRO segment
+    //          size (a buffer without one is a single datagram)
+    void split_received(size_t buffers)
+    {
+        segments.clear();
+        for (size_t i = 0; i < buffers; ++i)
+        {
+            const char *data = (const char *)recv_iov[i].iov_base;
+            size_t len = recv_msgs[i].msg_len;
+            size_t seg = len;
+            msghdr &msg = recv_msgs[i].msg_hdr;
+            for (cmsghdr *cm = gro ? CMSG_FIRSTHDR(&msg) : NULL; cm;
+                 cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                {
+                    int gso_size;
+                    memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    if (gso_size > 0)
+                        seg = gso_size;
+                }
+            }
+            for (size_t off = 0; off < len || off == 0; off += seg)
+            {
+                segments.push_back(Segment{data + off, std::min(seg, len - off), i});
+                if (seg == 0)
+                    break;
+            }
+        }
+        received = segments.size();
+    }
+
+    size_t check_again()
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        throw std::runtime_error("Error receiving data");
+    }
+
+    int sockfd;
+    size_t batch;
+    size_t max_packet;
+    bool mmsg;
+    bool gso;
+    bool gro;
+    size_t queued; // Datagrams waiting in the send slots (batch of them or more)
+    bool stalled;
+    size_t received;
+    uint64_t n_syscalls;
+    uint64_t n_packets;
+
+    // Per datagram slot
+    std::vector<char> send_hdrs;
+    std::vector<iovec> send_iov; // Header / payload pair per datagram
+    std::vector<sockaddr_in> send_to;
+    std::vector<size_t> send_bytes;
+    // Per message of the current flush()
+    std::vector<mmsghdr> send_msgs;
+    std::vector<size_t> msg_slots; // Datagrams carried by each message
+    std::vector<char> send_ctrl;   // UDP_SEGMENT cmsg per message
+
+    std::vector<char> recv_buf;
+    std::vector<mmsghdr> recv_msgs;
+    std::vector<iovec> recv_iov;
+    std::vector<sockaddr_in> recv_addrs;
+    std::vector<char> recv_ctrl; // UDP_GRO cmsg per buffer
+    std::vector<Segment> segments;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "PacketHeader.h"
+#include "ReassemblyRing.h"
+#include "crc32.h"
+
+#define CHECKPOINT_MAGIC 0x31544b4350505457ULL // "WTPPCKT1"
+
+// Receive-side progress of one START_RESUME transfer, persisted next to the
+// output file so a later run (or a restarted receiver) picks it up.
+//   The file is cut into RESUME_UNIT_BYTES ranges. The checkpoint file is a
+//   header followed by one fixed-size record per range, {CRC, done}, so
+//   finishing a range costs a single 8-byte pwrite() and nothing is ever
+//   rewritten wholesale.
+//   Records are written without fsync, and just before the range's last
+//   bytes reach the output file: a record can be ahead of the data after a
+//   crash. verify() therefore re-reads every range marked done and keeps
+//   only those whose bytes still match their CRC.
+//   Streams of one transfer may land on different receiver workers, so
+//   every method takes the checkpoint's own lock.
+class Checkpoint
+{
+public:
+    // EFFECTS: Open the checkpoint at path, starting it over if it is
+    //          missing or was written for a different transfer or size
+    Checkpoint(const std::string &path, uint32_t transfer_id, uint64_t file_size)
+        : path(path), file_size(file_size), done_count(0)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("ERROR opening checkpoint " + path);
+
+        uint64_t units = (file_size + RESUME_UNIT_BYTES - 1) / RESUME_UNIT_BYTES;
+        records.resize(units, Record{0, 0});
+        Header want = {CHECKPOINT_MAGIC, file_size, transfer_id, RESUME_UNIT_BYTES};
+        Header have;
+        size_t bytes = records.size() * sizeof(Record);
+        if (pread(fd, &have, sizeof(have), 0) == (ssize_t)sizeof(have) &&
+            memcmp(&have, &want, sizeof(have)) == 0 &&
+            pread(fd, records.data(), bytes, sizeof(have)) == (ssize_t)bytes)
+        {
+            for (size_t u = 0; u < records.size(); ++u)
+                done_count += records[u].done != 0;
+            return;
+        }
+
+        std::fill(records.begin(), records.end(), Record{0, 0});
+        if (ftruncate(fd, 0) != 0 || !write_at(&want, sizeof(want), 0) ||
+            !write_at(records.data(), bytes, sizeof(want)))
+            throw std::runtime_error("ERROR writing checkpoint " + path);
+    }
+
+    ~Checkpoint() { close(fd); }
+
+    uint64_t size() const { return file_size; }
+
+    // EFFECTS: Bytes in range unit (the last one may be short)
+    uint64_t unit_length(uint64_t unit) const
+    {
+        return std::min<uint64_t>(RESUME_UNIT_BYTES, file_size - unit * RESUME_UNIT_BYTES);
+    }
+
+    bool done(uint64_t unit) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return records[unit].done != 0;
+    }
+
+    bool complete() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return done_count == records.size();
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: unit is being rewritten; it no longer counts as done
+    void begin(uint64_t unit)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (unit < records.size() && records[unit].done)
+            store(unit, Record{0, 0});
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Every byte of unit has been written and has CRC checksum
+    void finish(uint64_t unit, uint32_t checksum)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (unit < records.size())
+            store(unit, Record{checksum, 1});
+    }
+
+    // REQUIRES: data_fd is the output file, open for reading (or -1 if it
+    //           does not exist yet)
+    // MODIFIES: *this, runs
+    // EFFECTS: From byte `from` on, re-read every range marked done and
+    //          unmark those whose CRC no longer matches; return the runs of
+    //          consecutive verified ranges (the first max_runs of them) with
+    //          the CRC of each run's bytes. Ranges past the last run are not
+    //          read, so the caller can ask again from where the runs end
+    size_t verify(int data_fd, ResumeRun *runs, size_t max_runs, uint64_t from = 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<char> buf(RESUME_UNIT_BYTES);
+        size_t count = 0;
+        bool open_run = false;
+        for (uint64_t u = from / RESUME_UNIT_BYTES; u < records.size(); ++u)
+        {
+            if (records[u].done && !open_run && count == max_runs)
+                break; // No room to report it
+            bool good = false;
+            if (records[u].done)
+            {
+                size_t len = unit_length(u);
+                good = data_fd >= 0 && read_at(data_fd, &buf[0], len, u * RESUME_UNIT_BYTES) &&
+                       crc32(&buf[0], len) == records[u].checksum;
+                if (!good)
+                    store(u, Record{0, 0});
+                else if (open_run)
+                {
+                    runs[count - 1].length += len;
+                    runs[count - 1].checksum =
+                        crc32_update(runs[count - 1].checksum, &buf[0], len);
+                }
+                else
+                    runs[count++] = ResumeRun{u * RESUME_UNIT_BYTES, len,
+                                              records[u].checksum, 0};
+            }
+            open_run = good;
+        }
+        return count;
+    }
+
+private:
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t file_size;
+        uint32_t transfer_id;
+        uint32_t unit_bytes;
+    };
+
+    struct Record
+    {
+        uint32_t checksum;
+        uint32_t done;
+    };
+
+    // REQUIRES: mutex held
+    void store(uint64_t unit, const Record &record)
+    {
+        done_count += (record.done != 0) - (records[unit].done != 0);
+        records[unit] = record;
+        if (!write_at(&record, sizeof(record), sizeof(Header) + unit * sizeof(Record)))
+            throw std::runtime_error("ERROR writing checkpoint " + path);
+    }
+
+    bool write_at(const void *data, size_t len, uint64_t offset)
+    {
+        const char *p = static_cast<const char *>(data);
+        while (len > 0)
+        {
+            ssize_t n = pwrite(fd, p, len, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            len -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    static bool read_at(int from, char *p, size_t len, uint64_t offset)
+    {
+        while (len > 0)
+        {
+            ssize_t n = pread(from, p, len, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            len -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    mutable std::mutex mutex;
+    int fd;
+    std::string path;
+    uint64_t file_size;
+    std::vector<Record> records; // One per RESUME_UNIT_BYTES of the file
+    uint64_t done_count;
+};
+
+// Checksums one stream's output as its ReassemblyRing writes it and marks
+// each range done in the Checkpoint once its last byte goes out. A stream
+// writes its bytes in order from a range boundary, so one running CRC per
+// stream suffices; the extra cost is a CRC pass over the data and one
+// record write per range
+class RangeTracker : public WriteObserver
+{
+public:
+    // REQUIRES: offset is a multiple of RESUME_UNIT_BYTES
+    RangeTracker(Checkpoint &checkpoint, uint64_t offset)
+        : checkpoint(checkpoint), position(offset), crc(0)
+    {
+    }
+
+    void wrote(uint64_t offset, const iovec *iov, size_t count)
+    {
+        if (offset != position)
+            return; // Not where this stream left off; leave the ranges alone
+        for (size_t i = 0; i < count; ++i)
+        {
+            const char *p = static_cast<const char *>(iov[i].iov_base);
+            size_t len = iov[i].iov_len;
+            while (len > 0 && position < checkpoint.size())
+            {
+                uint64_t unit = position / RESUME_UNIT_BYTES;
+                uint64_t used = position % RESUME_UNIT_BYTES;
+                if (used == 0)
+                {
+                    checkpoint.begin(unit);
+                    crc = 0;
+                }
+                size_t n = std::min<uint64_t>(len, checkpoint.unit_length(unit) - used);
+                crc = crc32_update(crc, p, n);
+                p += n;
+                len -= n;
+                position += n;
+                if (used + n == checkpoint.unit_length(unit))
+                    checkpoint.finish(unit, crc);
+            }
+            position += len; // Past the end of the file: nothing to track
+        }
+    }
+
+private:
+    Checkpoint &checkpoint;
+    uint64_t position; // Next file offset this stream writes
+    uint32_t crc;      // CRC of the current range so far
+};
+
+#endif
@@ -0,0 +1,563 @@
+#ifndef __CHUNK_SOURCE_H__
+#define __CHUNK_SOURCE_H__
+
+#include <string>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "crc32.h"
+#include "LzCodec.h"
+
+// CompressedChunks reads its input this many bytes at a time; no packet
+// spans two reads
+#define COMPRESS_INPUT_BYTES (4 << 20)
+// Packets the compressor may have ready beyond the send window
+#define COMPRESS_LOOKAHEAD 256
+// After a packet that did not compress, the next 1, 2, 4, ... (at most
+// this many) are stored without trying
+#define COMPRESS_BACKOFF_MAX 64
+
+// A single file chunk handed to the sender; data points into the mapping or
+// into a ring slot and stays valid until the chunk is released. checksum is
+// the chunk's CRC32, computed once and cached for every retransmission.
+struct Chunk
+{
+    const char *data;
+    size_t size;
+    uint32_t checksum;
+};
+
+// Serves the input file as fixed-size chunks by index, without reading the
+// whole file up front.
+//   Regular files are mmap'd and chunk i is simply data + i * chunk_size;
+//   the file descriptor is closed as soon as the mapping exists.
+//   A byte range [offset, offset + length) of a regular file can be served
+//   on its own, for one stream of a multi-stream transfer.
+//   Anything mmap refuses (pipes, /dev/stdin, ...) is read sequentially into
+//   a ring of window-many slots, so memory stays bounded by the window.
+//   A buffer already in memory can be served like a mapping.
+// Chunks below the last release() point are dropped (MADV_DONTNEED or slot
+// reuse), which keeps RSS proportional to the window rather than the file.
+// Checksums live in a window-sized cache so a resend never re-runs the CRC;
+// ring slots are checksummed incrementally while read() fills them.
+class ChunkSource
+{
+public:
+    ChunkSource(const std::string &file_in, size_t chunk_size, size_t window,
+                uint64_t offset = 0, uint64_t length = UINT64_MAX)
+        : fd(-1), chunk_sz(chunk_size), released(0), map(NULL), map_len(0),
+          map_base(NULL), map_skew(0), dropped_bytes(0), ring_slots(window ? window : 1),
+          ring_next(0), ring_eof(false), crc_cache(ring_slots), crc_tag(ring_slots, 0)
+    {
+        fd = open(file_in.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("ERROR opening " + file_in);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            uint64_t size = st.st_size;
+            offset = std::min(offset, size);
+            map_len = std::min(length, size - offset);
+            if (map_len == 0)
+            {
+                close_fd(); // Nothing to send; zero chunks
+                return;
+            }
+
+            // mmap offsets must be page aligned
+            map_skew = offset % sysconf(_SC_PAGESIZE);
+            void *addr = mmap(NULL, map_len + map_skew, PROT_READ, MAP_PRIVATE,
+                              fd, offset - map_skew);
+            if (addr != MAP_FAILED)
+            {
+                map_base = static_cast<char *>(addr);
+                map = map_base + map_skew;
+                madvise(addr, map_len + map_skew, MADV_SEQUENTIAL);
+                close_fd(); // The mapping keeps the file
+                return;
+            }
+            map_len = 0;
+            if (offset != 0)
+                throw std::runtime_error("ERROR mapping range of " + file_in);
+        }
+        else if (offset != 0 || length != UINT64_MAX)
+            throw std::runtime_error("ERROR byte ranges need a regular file");
+
+        // Fall back to the bounded slot ring
+        ring.resize(ring_slots * chunk_sz);
+        ring_sizes.resize(ring_slots, 0);
+    }
+
+    // EFFECTS: Serve length bytes at data the same way; data must outlive
+    //          the source
+    ChunkSource(const char *data, uint64_t length, size_t chunk_size, size_t window)
+        : fd(-1), chunk_sz(chunk_size), released(0), map(data), map_len(length),
+          map_base(NULL), map_skew(0), dropped_bytes(0), ring_slots(window ? window : 1),
+          ring_next(0), ring_eof(false), crc_cache(ring_slots), crc_tag(ring_slots, 0)
+    {
+    }
+
+    ~ChunkSource()
+    {
+        if (map_base)
+            munmap(map_base, map_len + map_skew);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    size_t chunk_size() const { return chunk_sz; }
+
+    // EFFECTS: Point chunk at chunk #index; false if index is past EOF.
+    //          In ring mode index must lie within window slots of release().
+    bool get(uint32_t index, Chunk &chunk)
+    {
+        if (!ring_mode())
+        {
+            uint64_t offset = (uint64_t)index * chunk_sz;
+            if (offset >= map_len)
+                return false;
+            chunk.data = map + offset;
+            chunk.size = std::min<uint64_t>(chunk_sz, map_len - offset);
+
+            size_t slot = index % ring_slots;
+            if (crc_tag[slot] != index + 1)
+            {
+                crc_cache[slot] = crc32(chunk.data, chunk.size);
+                crc_tag[slot] = index + 1;
+            }
+            chunk.checksum = crc_cache[slot];
+            return true;
+        }
+
+        if (index < released || index >= released + ring_slots)
+            throw std::runtime_error("ERROR chunk outside of window");
+        while (ring_next <= index && !ring_eof)
+            fill_slot();
+        if (index >= ring_next)
+            return false;
+
+        size_t slot = index % ring_slots;
+        chunk.data = &ring[slot * chunk_sz];
+        chunk.size = ring_sizes[slot];
+        chunk.checksum = crc_cache[slot];
+        return true;
+    }
+
+    // EFFECTS: Declare every chunk below index acknowledged; their memory
+    //          may be reclaimed and they must not be requested again.
+    void release(uint32_t index)
+    {
+        if (index <= released)
+            return;
+        released = index;
+        if (!map_base)
+            return; // Ring slots, or memory that is not ours
+
+        // Give acked pages back in large steps to keep madvise off the hot path
+        static const uint64_t RELEASE_STEP = 4 << 20;
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t done = std::min<uint64_t>((uint64_t)index * chunk_sz, map_len) + map_skew;
+        done -= done % page;
+        if (done >= dropped_bytes + RELEASE_STEP)
+        {
+            madvise(map_base + dropped_bytes, done - dropped_bytes, MADV_DONTNEED);
+            dropped_bytes = done;
+        }
+    }
+
+private:
+    bool ring_mode() const { return !ring.empty(); }
+
+    // EFFECTS: Give up the descriptor once the mapping no longer needs it,
+    //          so that the sources a batch window holds do not count
+    //          against the open-file limit
+    void close_fd()
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    void fill_slot()
+    {
+        size_t slot = ring_next % ring_slots;
+        char *dst = &ring[slot * chunk_sz];
+        size_t got = 0;
+        uint32_t crc = 0;
+        while (got < chunk_sz)
+        {
+            ssize_t n = read(fd, dst + got, chunk_sz - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw std::runtime_error("ERROR reading input file");
+            if (n == 0)
+            {
+                ring_eof = true;
+                break;
+            }
+            crc = crc32_update(crc, dst + got, n);
+            got += n;
+        }
+        if (got > 0)
+        {
+            ring_sizes[slot] = got;
+            crc_cache[slot] = crc;
+            crc_tag[slot] = ring_next + 1;
+            ++ring_next;
+        }
+    }
+
+    int fd;
+    size_t chunk_sz;
+    uint32_t released; // Every chunk below this has been acked
+
+    // mmap mode
+    const char *map;        // Start of the served range
+    uint64_t map_len;       // Length of the served range
+    char *map_base;         // Page-aligned start of the mapping
+    uint64_t map_skew;      // map - map_base
+    uint64_t dropped_bytes; // Mapping prefix already handed back
+
+    // Ring mode
+    size_t ring_slots;
+    std::vector<char> ring;
+    std::vector<size_t> ring_sizes;
+    uint32_t ring_next; // Next chunk index to be read into the ring
+    bool ring_eof;
+
+    // Checksum cache, one entry per window slot; tag is chunk index + 1
+    std::vector<uint32_t> crc_cache;
+    std::vector<uint32_t> crc_tag;
+};
+
+// One input of a batch transfer (START_BATCH): where to read it from and
+// the name the receiver records for it
+struct BatchFile
+{
+    std::string path;
+    std::string name;
+};
+
+// Serves the DATA payloads of a batch transfer by index, like ChunkSource:
+// each file's header (a BatchFileInfo and its name) and then its contents,
+// in chunks that never span two files.
+//   Files are opened as the window reaches them, each through a ChunkSource
+//   of its own, and closed once all their chunks are released, so no more
+//   files are open than the window has chunks.
+class BatchChunks
+{
+public:
+    // REQUIRES: files outlives the source
+    BatchChunks(const std::vector<BatchFile> &files, size_t chunk_size, size_t window)
+        : files(files), chunk_sz(chunk_size), window(window ? window : 1), next_file(0),
+          next_index(0)
+    {
+    }
+
+    // EFFECTS: Point chunk at payload #index, opening files up to it; false
+    //          past the last file. index must not be below release()
+    bool get(uint32_t index, Chunk &chunk)
+    {
+        while (open.empty() || index - open.back().first >= open.back().count)
+            if (!open_next())
+                return false;
+
+        // The open files, in index order: find the one holding index
+        size_t low = 0, high = open.size();
+        while (high - low > 1)
+        {
+            size_t mid = (low + high) / 2;
+            (open[mid].first <= index ? low : high) = mid;
+        }
+        Entry &entry = open[low];
+        if (index < entry.first)
+            throw std::runtime_error("ERROR chunk outside of window");
+        if (index == entry.first)
+        {
+            chunk.data = entry.header.data();
+            chunk.size = entry.header.size();
+            chunk.checksum = entry.header_crc;
+            return true;
+        }
+        if (!entry.source->get(index - entry.first - 1, chunk))
+            throw std::runtime_error("ERROR " + files[entry.file].path +
+                                     " shrank while being sent");
+        return true;
+    }
+
+    // EFFECTS: Every payload below index is acknowledged; files with none
+    //          left are closed
+    void release(uint32_t index)
+    {
+        while (!open.empty() && index - open.front().first >= open.front().count)
+            open.pop_front();
+        if (!open.empty() && index > open.front().first + 1)
+            open.front().source->release(index - open.front().first - 1);
+    }
+
+private:
+    struct Entry
+    {
+        size_t file;        // Position in files
+        uint32_t first;     // Index of its header
+        uint32_t count;     // Header plus content chunks
+        std::vector<char> header;
+        uint32_t header_crc;
+        std::unique_ptr<ChunkSource> source;
+    };
+
+    // MODIFIES: open, next_file, next_index
+    // EFFECTS: Open the next file and build its header; false if none left
+    bool open_next()
+    {
+        if (next_file == files.size())
+            return false;
+        const BatchFile &file = files[next_file];
+        struct stat st;
+        if (stat(file.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            throw std::runtime_error("ERROR batch inputs must be regular files: " + file.path);
+
+        uint64_t size = st.st_size;
+        uint64_t chunks = (size + chunk_sz - 1) / chunk_sz;
+        if (chunks >= UINT32_MAX - next_index)
+            throw std::runtime_error("ERROR batch too large for one session");
+        BatchFileInfo info;
+        memset(&info, 0, sizeof(info));
+        info.index = next_file;
+        info.chunks = chunks;
+        info.size = size;
+        info.name_length = std::min(file.name.size(),
+                                    std::min<size_t>(BATCH_MAX_NAME,
+                                                     chunk_sz - sizeof(info)));
+
+        Entry entry;
+        entry.file = next_file;
+        entry.first = next_index;
+        entry.count = chunks + 1;
+        entry.header.resize(sizeof(info) + info.name_length);
+        encode_wire(info, &entry.header[0]);
+        memcpy(&entry.header[sizeof(info)], file.name.data(), info.name_length);
+        entry.header_crc = crc32(entry.header.data(), entry.header.size());
+        size_t crc_slots = std::max<uint64_t>(1, std::min<uint64_t>(window, chunks));
+        entry.source.reset(new ChunkSource(file.path, chunk_sz, crc_slots, 0, size));
+        open.push_back(std::move(entry));
+        ++next_file;
+        next_index += chunks + 1;
+        return true;
+    }
+
+    const std::vector<BatchFile> &files;
+    size_t chunk_sz;
+    size_t window;
+    size_t next_file;    // Next file to open
+    uint32_t next_index; // Header index of that file
+    std::deque<Entry> open;
+};
+
+// Serves compressed DATA payloads (START_COMPRESS) by index, like
+// ChunkSource serves raw chunks.
+//   A compressor thread runs ahead of the sender loop: it reads the input
+//   from a ChunkSource of COMPRESS_INPUT_BYTES chunks and packs each payload
+//   with as many bytes as compress into it (LzCodec.h), up to raw_limit.
+//   Finished payloads wait, checksummed, in a ring of window +
+//   COMPRESS_LOOKAHEAD slots, so a resend reuses the bytes first sent.
+//   The thread waits when the ring is full. The sender loop never waits for
+//   the thread: pending() says the next payload is not ready yet, and the
+//   thread then signals wake_fd(), an eventfd the loop watches, as soon as
+//   it is.
+//   Stretches that do not compress are stored as they are, and the thread
+//   backs off trying for a few packets, so incompressible input costs
+//   little more than copying it.
+class CompressedChunks
+{
+public:
+    // REQUIRES: raw serves chunks of COMPRESS_INPUT_BYTES;
+    //           payload_size > sizeof(CompressInfo)
+    CompressedChunks(ChunkSource *raw, size_t payload_size, size_t raw_limit,
+                     size_t window)
+        : raw(raw), payload_sz(payload_size), raw_limit(raw_limit),
+          slots(window + COMPRESS_LOOKAHEAD), buf(slots * payload_sz), sizes(slots),
+          sums(slots), released(0), produced(0), eof(false), stop(false), waiting(false)
+    {
+        wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake < 0)
+            throw std::runtime_error("ERROR creating eventfd");
+        worker = std::thread(&CompressedChunks::run, this);
+    }
+
+    ~CompressedChunks()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        room.notify_all();
+        worker.join();
+        close(wake);
+    }
+
+    // EFFECTS: Readable once payloads that pending() was waiting for are
+    //          ready; the loop then calls clear_wake()
+    int wake_fd() const { return wake; }
+
+    // EFFECTS: Reset wake_fd() after it fired
+    void clear_wake()
+    {
+        uint64_t count;
+        ssize_t ignored = read(wake, &count, sizeof(count));
+        (void)ignored;
+    }
+
+    // EFFECTS: true if payload #index is not ready yet (and the input has
+    //          not ended before it); wake_fd() fires once it is
+    bool pending(uint32_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index < produced || eof)
+            return false;
+        waiting = true;
+        return true;
+    }
+
+    // REQUIRES: !pending(index)
+    // EFFECTS: Point chunk at payload #index; false once the input is
+    //          exhausted. Rethrows any error the compressor hit
+    bool get(uint32_t index, Chunk &chunk)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index >= produced)
+        {
+            if (!eof)
+                throw std::runtime_error("ERROR compressed payload not ready");
+            if (error)
+                std::rethrow_exception(error);
+            return false;
+        }
+        size_t slot = index % slots;
+        chunk.data = &buf[slot * payload_sz];
+        chunk.size = sizes[slot];
+        chunk.checksum = sums[slot];
+        return true;
+    }
+
+    // EFFECTS: Every payload below index is acknowledged; its slot may be
+    //          refilled
+    void release(uint32_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index > released)
+        {
+            released = index;
+            room.notify_one();
+        }
+    }
+
+private:
+    // The compressor thread
+    void run()
+    {
+        try
+        {
+            LzEncoder encoder;
+            size_t backoff = 0, skip = 0;
+            Chunk input;
+            for (uint32_t i = 0; raw->get(i, input); ++i)
+            {
+                for (size_t used = 0; used < input.size;)
+                {
+                    size_t slot;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        room.wait(lock, [&]() { return stop || produced < released + slots; });
+                        if (stop)
+                            return;
+                        slot = produced % slots;
+                    }
+
+                    // Only this thread touches a slot until produced passes it
+                    char *payload = &buf[slot * payload_sz];
+                    size_t consumed;
+                    size_t len = compress_payload(
+                        encoder, input.data + used, std::min(input.size - used, raw_limit),
+                        payload, payload_sz, consumed, skip == 0);
+                    CompressInfo info = decode_wire<CompressInfo>(payload);
+                    if (skip > 0)
+                        --skip;
+                    else if (info.method == COMPRESS_STORED)
+                        skip = backoff = std::min<size_t>(COMPRESS_BACKOFF_MAX,
+                                                          std::max<size_t>(1, backoff * 2));
+                    else
+                        backoff = 0;
+                    uint32_t checksum = crc32(payload, len);
+                    used += consumed;
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    sizes[slot] = len;
+                    sums[slot] = checksum;
+                    ++produced;
+                    signal_ready();
+                }
+                raw->release(i + 1);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        eof = true;
+        signal_ready();
+    }
+
+    // REQUIRES: mutex held
+    // EFFECTS: Wake the loop if pending() left it waiting; one write per
+    //          wait, not per payload
+    void signal_ready()
+    {
+        if (!waiting)
+            return;
+        waiting = false;
+        uint64_t one = 1;
+        ssize_t ignored = write(wake, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    std::unique_ptr<ChunkSource> raw;
+    size_t payload_sz;
+    size_t raw_limit; // Input bytes one payload may carry
+    size_t slots;
+    std::vector<char> buf;
+    std::vector<size_t> sizes;
+    std::vector<uint32_t> sums;
+
+    std::mutex mutex;
+    std::condition_variable room; // released moved (or stop)
+    uint32_t released; // Every payload below this has been acked
+    uint32_t produced; // Payloads ready
+    bool eof;          // The thread is done; error says if it failed
+    bool stop;
+    bool waiting;      // pending() said no; signal wake when that changes
+    int wake;          // eventfd
+    std::exception_ptr error;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __CLI_OPTIONS_H__
+#define __CLI_OPTIONS_H__
+
+#include <map>
+#include <string>
+#include <stdexcept>
+
+// Optional "--key=value" (or bare "--flag") arguments that follow the fixed
+// positional arguments of wSender / wReceiver
+class CliOptions
+{
+public:
+    // REQUIRES: argv[first..argc) are the optional arguments
+    CliOptions(int argc, char *argv[], int first)
+    {
+        for (int i = first; i < argc; ++i)
+        {
+            std::string arg(argv[i]);
+            if (arg.compare(0, 2, "--") != 0)
+                throw std::runtime_error("ERROR unexpected argument " + arg);
+            size_t eq = arg.find('=');
+            if (eq == std::string::npos)
+                values[arg.substr(2)] = "1";
+            else
+                values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+        }
+    }
+
+    bool has(const std::string &key) const { return values.count(key) != 0; }
+
+    std::string get(const std::string &key, const std::string &fallback) const
+    {
+        std::map<std::string, std::string>::const_iterator it = values.find(key);
+        return it == values.end() ? fallback : it->second;
+    }
+
+    long get_long(const std::string &key, long fallback) const
+    {
+        return has(key) ? std::stol(get(key, "")) : fallback;
+    }
+
+    double get_double(const std::string &key, double fallback) const
+    {
+        return has(key) ? std::stod(get(key, "")) : fallback;
+    }
+
+private:
+    std::map<std::string, std::string> values;
+};
+
+#endif
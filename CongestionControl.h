@@ -0,0 +1,174 @@
+#ifndef __CONGESTION_CONTROL_H__
+#define __CONGESTION_CONTROL_H__
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+// Congestion window before anything is known (RFC 6928 initial window)
+#define CC_INITIAL_WINDOW 10
+// Smallest window a loss may shrink ssthresh to
+#define CC_MIN_SSTHRESH 2
+// Delay-based target: keep between ALPHA and BETA packets queued in the path
+#define CC_DELAY_ALPHA 2
+#define CC_DELAY_BETA 4
+
+// Pluggable congestion controller for the senders.
+//   The window-size argument is the ceiling (max_window); window() is how
+//   many packets may be outstanding right now. Senders report ACK progress
+//   and loss; which signals move the window is up to the algorithm:
+//     fixed  - always max_window (the original behaviour)
+//     reno   - slow start, then AIMD: +1 packet per RTT, halve on loss,
+//              back to one packet on a retransmission timeout
+//     delay  - Vegas-style: once per RTT compare the measured RTT against the
+//              minimum seen and grow or shrink by one packet to keep a small,
+//              fixed number of packets queued; losses are treated like reno
+// Select with --cc=fixed|reno|delay (default reno).
+class CongestionControl
+{
+public:
+    typedef std::chrono::microseconds usec;
+
+    explicit CongestionControl(uint32_t max_window)
+        : max_window(std::max<uint32_t>(1, max_window)),
+          cwnd(std::min<double>(CC_INITIAL_WINDOW, this->max_window)),
+          ssthresh(this->max_window)
+    {
+    }
+    virtual ~CongestionControl() {}
+
+    // EFFECTS: Build the controller named by --cc
+    static std::unique_ptr<CongestionControl> create(const std::string &name,
+                                                     uint32_t max_window);
+
+    // EFFECTS: Packets that may be in flight now, in [1, max_window]
+    uint32_t window() const
+    {
+        return std::max<uint32_t>(1, std::min<uint32_t>(max_window, (uint32_t)cwnd));
+    }
+
+    bool in_slow_start() const { return cwnd < ssthresh; }
+
+    // EFFECTS: acked packets were newly (cumulatively) acknowledged; rtt is
+    //          a Karn-valid sample or zero if the ACK gave none
+    virtual void on_ack(uint32_t acked, usec rtt) = 0;
+
+    // EFFECTS: A loss was inferred from duplicate ACKs or a partial round;
+    //          called at most once per window of data
+    virtual void on_loss()
+    {
+        ssthresh = std::max<double>(CC_MIN_SSTHRESH, cwnd / 2);
+        cwnd = ssthresh;
+    }
+
+    // EFFECTS: The retransmission timer of the oldest packet expired
+    virtual void on_timeout()
+    {
+        ssthresh = std::max<double>(CC_MIN_SSTHRESH, cwnd / 2);
+        cwnd = 1;
+    }
+
+protected:
+    void clamp() { cwnd = std::min<double>(cwnd, max_window); }
+
+    uint32_t max_window;
+    double cwnd; // Fractional so congestion avoidance can grow by 1/cwnd
+    double ssthresh;
+};
+
+// --cc=fixed: the window-size argument is the operating point
+class FixedWindow : public CongestionControl
+{
+public:
+    explicit FixedWindow(uint32_t max_window) : CongestionControl(max_window)
+    {
+        cwnd = this->max_window;
+    }
+
+    void on_ack(uint32_t, usec) {}
+    void on_loss() {}
+    void on_timeout() {}
+};
+
+// --cc=reno: slow start / AIMD
+class RenoControl : public CongestionControl
+{
+public:
+    explicit RenoControl(uint32_t max_window) : CongestionControl(max_window) {}
+
+    void on_ack(uint32_t acked, usec)
+    {
+        for (uint32_t i = 0; i < acked && cwnd < max_window; ++i)
+            cwnd += cwnd < ssthresh ? 1 : 1 / cwnd;
+        clamp();
+    }
+};
+
+// --cc=delay: Vegas-style delay-based avoidance
+class DelayControl : public CongestionControl
+{
+public:
+    explicit DelayControl(uint32_t max_window)
+        : CongestionControl(max_window), base_rtt(usec::max()),
+          round_min(usec::max()), acked_in_round(0)
+    {
+    }
+
+    void on_ack(uint32_t acked, usec rtt)
+    {
+        if (rtt > usec(0))
+        {
+            base_rtt = std::min(base_rtt, rtt);
+            round_min = std::min(round_min, rtt);
+        }
+
+        // Decide once per window's worth of ACKs, i.e. about once per RTT
+        acked_in_round += acked;
+        if (acked_in_round < window())
+            return;
+        acked_in_round = 0;
+        if (round_min == usec::max())
+        {
+            // No clean sample this round: fall back to reno's growth
+            cwnd += cwnd < ssthresh ? cwnd : 1;
+            clamp();
+            return;
+        }
+
+        // Packets sitting in queues = cwnd * (1 - base_rtt / rtt)
+        double queued = cwnd * (1 - (double)base_rtt.count() / round_min.count());
+        round_min = usec::max();
+        if (cwnd < ssthresh && queued < 1)
+            cwnd *= 2; // Slow start while the path shows no queueing
+        else if (queued < CC_DELAY_ALPHA)
+            cwnd += 1;
+        else if (queued > CC_DELAY_BETA)
+        {
+            cwnd = std::max(1.0, cwnd - 1);
+            ssthresh = std::min(ssthresh, cwnd);
+        }
+        clamp();
+    }
+
+private:
+    usec base_rtt;  // Propagation delay estimate: smallest RTT ever seen
+    usec round_min; // Smallest RTT in the current round
+    uint32_t acked_in_round;
+};
+
+inline std::unique_ptr<CongestionControl> CongestionControl::create(
+    const std::string &name, uint32_t max_window)
+{
+    if (name == "fixed")
+        return std::unique_ptr<CongestionControl>(new FixedWindow(max_window));
+    if (name == "reno")
+        return std::unique_ptr<CongestionControl>(new RenoControl(max_window));
+    if (name == "delay")
+        return std::unique_ptr<CongestionControl>(new DelayControl(max_window));
+    throw std::runtime_error("ERROR unknown --cc=" + name);
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef __DELTA_SYNC_H__
+#define __DELTA_SYNC_H__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "PacketHeader.h"
+#include "crc32.h"
+
+#define DELTA_HASH_SEED 0x57545021 // "!PTW"
+// Bits in the weak-hash prefilter checked at every byte of the basis
+#define DELTA_FILTER_BITS 20
+
+// Delta transfers (START_DELTA): find blocks of the new file anywhere in an
+// old copy the receiver already has, so only the rest crosses the network.
+//   Blocks are the RESUME_UNIT_BYTES ranges of the new file, so a block the
+//   receiver finds is simply a range its checkpoint marks done. Each block
+//   has a DeltaSignature: its CRC32 (weak, and also the checkpoint CRC)
+//   and a 128-bit MurmurHash3 (strong, to confirm a weak match).
+//   The receiver slides a block-sized window over the old copy one byte at
+//   a time, rolling the CRC in O(1) per byte, and only hashes the window
+//   when its CRC is one of the wanted ones. Both sides split the work over
+//   threads. The strong hash guards against accidental CRC collisions; it
+//   is not a cryptographic hash.
+
+// EFFECTS: MurmurHash3 x64-128 of data
+inline void delta_strong_hash(const void *data, size_t len, uint64_t out[2])
+{
+    struct Mix
+    {
+        static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+        static uint64_t fmix(uint64_t k)
+        {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            return k ^ (k >> 33);
+        }
+    };
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t h1 = DELTA_HASH_SEED, h2 = DELTA_HASH_SEED;
+
+    size_t blocks = len / 16;
+    for (size_t i = 0; i <= blocks; ++i)
+    {
+        uint64_t k[2] = {0, 0};
+        if (i < blocks)
+            memcpy(k, p + i * 16, 16);
+        else if (len % 16)
+            memcpy(k, p + i * 16, len % 16); // Zero-padded tail
+        else
+            break;
+
+        k[0] *= c1;
+        k[0] = Mix::rotl(k[0], 31);
+        k[0] *= c2;
+        h1 ^= k[0];
+        k[1] *= c2;
+        k[1] = Mix::rotl(k[1], 33);
+        k[1] *= c1;
+        h2 ^= k[1];
+        if (i == blocks)
+            break; // The tail is folded in without the block rounds
+        h1 = Mix::rotl(h1, 27) + h2;
+        h1 = h1 * 5 + 0x52dce729;
+        h2 = Mix::rotl(h2, 31) + h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = Mix::fmix(h1);
+    h2 = Mix::fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+// CRC32 of a fixed-size window that slides one byte at a time.
+//   CRC is affine over GF(2), so dropping the window's first byte b is an
+//   XOR with out[b] = crc32(b, 0 x window) ^ crc32(0 x window) once the new
+//   byte has been appended.
+//   Works on the inverted register like the kernels in crc32.h
+class RollingCrc32
+{
+public:
+    explicit RollingCrc32(size_t window) : window(window), reg(0)
+    {
+        std::vector<uint8_t> zeros(window + 1, 0);
+        uint32_t z0 = crc32(&zeros[0], window);
+        uint32_t z1 = crc32(&zeros[0], window + 1);
+        uint32_t bit[8];
+        for (int b = 0; b < 8; ++b)
+        {
+            zeros[0] = 1 << b;
+            bit[b] = crc32(&zeros[0], window + 1) ^ z1; // Linear part only
+        }
+        for (unsigned v = 0; v < 256; ++v)
+        {
+            out[v] = z1 ^ z0;
+            for (int b = 0; b < 8; ++b)
+                if (v & (1 << b))
+                    out[v] ^= bit[b];
+        }
+    }
+
+    // EFFECTS: Start over with the window at p
+    void reset(const uint8_t *p) { reg = ~crc32(p, window); }
+
+    // REQUIRES: p[-window] is the byte leaving, p[0] the byte entering
+    void roll(const uint8_t *p)
+    {
+        reg = crc32_tab[(reg ^ p[0]) & 0xFF] ^ (reg >> 8) ^ out[p[-(long)window]];
+    }
+
+    uint32_t value() const { return ~reg; }
+
+private:
+    size_t window;
+    uint32_t reg;
+    uint32_t out[256];
+};
+
+// EFFECTS: Signature of every RESUME_UNIT_BYTES block of data, hashed by up
+//          to `threads` threads
+inline std::vector<DeltaSignature> delta_signatures(const char *data, uint64_t size,
+                                                    unsigned threads)
+{
+    uint64_t count = (size + RESUME_UNIT_BYTES - 1) / RESUME_UNIT_BYTES;
+    std::vector<DeltaSignature> sigs(count);
+    std::atomic<uint64_t> next(0);
+    auto work = [&]() {
+        for (uint64_t u; (u = next++) < count;)
+        {
+            const char *block = data + u * RESUME_UNIT_BYTES;
+            size_t len = std::min<uint64_t>(RESUME_UNIT_BYTES, size - u * RESUME_UNIT_BYTES);
+            sigs[u].weak = crc32(block, len);
+            sigs[u].reserved = 0;
+            delta_strong_hash(block, len, sigs[u].strong);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < std::min<uint64_t>(std::max(threads, 1u), count); ++t)
+        pool.emplace_back(work);
+    work();
+    for (size_t t = 0; t < pool.size(); ++t)
+        pool[t].join();
+    return sigs;
+}
+
+// REQUIRES: sigs[u] describes block u of the new file; wanted[u] is false
+//           for blocks already in hand and for a short last block
+// EFFECTS: For every wanted block found in basis, the offset of one copy of
+//          it (else -1). The basis is cut into `threads` segments scanned
+//          in parallel; after a match a scan skips the block it matched,
+//          like rsync
+inline std::vector<int64_t> delta_match(const char *basis, uint64_t basis_size,
+                                        const std::vector<DeltaSignature> &sigs,
+                                        const std::vector<bool> &wanted, unsigned threads)
+{
+    const size_t block = RESUME_UNIT_BYTES;
+    std::vector<int64_t> found(sigs.size(), -1);
+    std::unordered_multimap<uint32_t, uint32_t> by_weak;
+    std::vector<uint64_t> filter((1 << DELTA_FILTER_BITS) / 64, 0);
+    for (uint32_t u = 0; u < sigs.size(); ++u)
+    {
+        if (!wanted[u])
+            continue;
+        by_weak.insert(std::make_pair(sigs[u].weak, u));
+        uint32_t bit = sigs[u].weak & ((1 << DELTA_FILTER_BITS) - 1);
+        filter[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    if (by_weak.empty() || basis_size < block)
+        return found;
+
+    // Window start positions [0, last] are shared out in equal segments
+    uint64_t last = basis_size - block;
+    threads = std::max<uint64_t>(1, std::min<uint64_t>(threads, last / block + 1));
+    std::vector<std::vector<std::pair<uint32_t, uint64_t> > > hits(threads);
+    RollingCrc32 proto(block);
+    auto scan = [&](unsigned t) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(basis);
+        uint64_t begin = (last + 1) * t / threads;
+        uint64_t end = (last + 1) * (t + 1) / threads;
+        RollingCrc32 crc(proto);
+        bool fresh = true;
+        for (uint64_t pos = begin; pos < end;)
+        {
+            if (fresh)
+                crc.reset(p + pos);
+            else
+                crc.roll(p + pos + block - 1);
+            fresh = false;
+
+            uint32_t weak = crc.value();
+            uint32_t bit = weak & ((1 << DELTA_FILTER_BITS) - 1);
+            if ((filter[bit / 64] >> (bit % 64)) & 1)
+            {
+                auto range = by_weak.equal_range(weak);
+                if (range.first != range.second)
+                {
+                    uint64_t strong[2];
+                    delta_strong_hash(p + pos, block, strong);
+                    bool matched = false;
+                    for (auto it = range.first; it != range.second; ++it)
+                        if (memcmp(strong, sigs[it->second].strong, sizeof(strong)) == 0)
+                        {
+                            hits[t].push_back(std::make_pair(it->second, pos));
+                            matched = true;
+                        }
+                    if (matched)
+                    {
+                        pos += block;
+                        fresh = true;
+                        continue;
+                    }
+                }
+            }
+            ++pos;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t)
+        pool.emplace_back(scan, t);
+    scan(0);
+    for (size_t t = 0; t < pool.size(); ++t)
+        pool[t].join();
+
+    for (unsigned t = 0; t < threads; ++t)
+        for (size_t i = 0; i < hits[t].size(); ++i)
+            if (found[hits[t][i].first] < 0)
+                found[hits[t][i].first] = hits[t][i].second;
+    return found;
+}
+
+#endif
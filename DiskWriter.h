@@ -0,0 +1,385 @@
+#ifndef __DISK_WRITER_H__
+#define __DISK_WRITER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Submission queue of one io_uring; its completion queue is twice as long
+#define DISK_URING_ENTRIES 256
+// Threads of a ThreadPoolWriter
+#define DISK_WRITER_THREADS 2
+
+// REQUIRES: v[0..count) holds bytes bytes in total
+// MODIFIES: v
+// EFFECTS: Write the iovecs at offset, skipping the first `done` bytes and
+//          retrying short writes; false (with errno set) on an error
+inline bool write_fully(int fd, iovec *v, size_t count, uint64_t offset, size_t bytes,
+                        size_t done = 0)
+{
+    size_t n = done;
+    while (true)
+    {
+        // Step past whatever has been written so far
+        bytes -= n;
+        offset += n;
+        while (count > 0 && n >= v->iov_len)
+        {
+            n -= v->iov_len;
+            ++v;
+            --count;
+        }
+        if (count > 0)
+        {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+        if (bytes == 0)
+            return true;
+
+        ssize_t wrote = pwritev(fd, v, std::min<size_t>(count, IOV_MAX), offset);
+        if (wrote < 0 && errno == EINTR)
+            wrote = 0;
+        else if (wrote <= 0)
+        {
+            if (wrote == 0)
+                errno = EIO;
+            return false;
+        }
+        n = wrote;
+    }
+}
+
+// One positioned gather write handed to a DiskWriter. The writer owns it
+// from submit() until reap() sets done
+struct DiskWrite
+{
+    int fd;
+    iovec *iov; // Must stay valid, as must the bytes, until done
+    size_t count;
+    uint64_t offset;
+    size_t bytes;
+    bool done;
+    int error; // errno of a failed write; 0 once every byte is written
+};
+
+// Asynchronous backend for the receiver's output files.
+//   Writes are queued with submit() and finish in any order; reap() is
+//   where the owner learns which finished, so `done` only ever changes on
+//   the owner's thread. A writer belongs to one thread (one receiver
+//   worker) and is shared by its flows.
+//     uring   - io_uring WRITEV requests. Queued requests reach the kernel
+//               together at the next reap(), so one system call carries the
+//               writes of a whole receive batch
+//     threads - DISK_WRITER_THREADS threads doing pwritev(); for kernels
+//               (or sandboxes) without io_uring
+//     sync    - no writer at all: the caller writes inline (create() gives
+//               NULL)
+// Select with --disk=auto|uring|threads|sync; auto is uring if the kernel
+// allows it, else threads.
+class DiskWriter
+{
+public:
+    virtual ~DiskWriter() {}
+
+    // EFFECTS: The backend named by --disk; NULL for sync. Throws if the
+    //          named backend is unavailable
+    static std::unique_ptr<DiskWriter> create(const std::string &name);
+
+    virtual const char *name() const = 0;
+
+    // REQUIRES: write is filled in, done == false
+    // MODIFIES: write (later, through reap())
+    virtual void submit(DiskWrite *write) = 0;
+
+    // EFFECTS: Mark every finished write done; with wait and writes still
+    //          outstanding, block until at least one finishes
+    virtual void reap(bool wait) = 0;
+};
+
+class UringWriter : public DiskWriter
+{
+public:
+    explicit UringWriter(unsigned entries)
+        : ring_fd(-1), sq_map(MAP_FAILED), cq_map(MAP_FAILED), sqe_map(MAP_FAILED),
+          queued(0), in_flight(0)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+#ifdef __NR_io_uring_setup
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+#endif
+        if (ring_fd < 0)
+            throw std::runtime_error("ERROR io_uring is unavailable");
+
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+        sq_map = mmap(NULL, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQ_RING);
+        cq_map = single ? sq_map
+                        : mmap(NULL, cq_bytes, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqe_map = mmap(NULL, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQES);
+        if (sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqe_map == MAP_FAILED)
+        {
+            release();
+            throw std::runtime_error("ERROR mapping io_uring");
+        }
+
+        char *sq = static_cast<char *>(sq_map);
+        char *cq = static_cast<char *>(cq_map);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        cq_entries = params.cq_entries;
+        sqes = static_cast<io_uring_sqe *>(sqe_map);
+    }
+
+    ~UringWriter()
+    {
+        while (in_flight > 0)
+            reap(true);
+        release();
+    }
+
+    const char *name() const { return "uring"; }
+
+    void submit(DiskWrite *write)
+    {
+        // The completion queue must have room for everything outstanding
+        while (in_flight >= cq_entries)
+            reap(true);
+        // So must the submission queue. The kernel may take only part of
+        // it, or none until completions are reaped
+        while (queued == sq_entries)
+            if (enter(false) == 0)
+                reap(true);
+
+        unsigned tail = *sq_tail; // Only this thread moves the tail
+        unsigned index = tail & sq_mask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITEV;
+        sqe.fd = write->fd;
+        sqe.addr = reinterpret_cast<uint64_t>(write->iov);
+        sqe.len = write->count;
+        sqe.off = write->offset;
+        sqe.user_data = reinterpret_cast<uint64_t>(write);
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+        ++in_flight;
+    }
+
+    void reap(bool wait)
+    {
+        while (true)
+        {
+            bool block = wait && in_flight > 0 &&
+                         *cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            if (queued > 0 || block)
+                enter(block);
+            if (complete() > 0 || !block)
+                return;
+        }
+    }
+
+private:
+    // EFFECTS: Hand queued requests to the kernel, waiting for a completion
+    //          if block; returns how many it took. That may be fewer than
+    //          queued, or none (EAGAIN / EBUSY) while the kernel is short of
+    //          resources or its completions are backed up: reap and retry
+    unsigned enter(bool block)
+    {
+        long n = -1;
+#ifdef __NR_io_uring_enter
+        n = syscall(__NR_io_uring_enter, ring_fd, queued, block ? 1 : 0,
+                    block ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+#endif
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            throw std::runtime_error("ERROR submitting disk writes");
+        unsigned taken = n > 0 ? std::min<unsigned>(queued, n) : 0;
+        queued -= taken;
+        return taken;
+    }
+
+    // EFFECTS: Mark the writes in the completion queue done, finishing any
+    //          short one inline; returns how many there were
+    size_t complete()
+    {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        for (; head != tail; ++head, ++count)
+        {
+            const io_uring_cqe &cqe = cqes[head & cq_mask];
+            DiskWrite *write = reinterpret_cast<DiskWrite *>(cqe.user_data);
+            write->error = 0;
+            if (cqe.res < 0)
+                write->error = -cqe.res;
+            else if ((size_t)cqe.res < write->bytes &&
+                     !write_fully(write->fd, write->iov, write->count, write->offset,
+                                  write->bytes, cqe.res))
+                write->error = errno;
+            write->done = true;
+            --in_flight;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void release()
+    {
+        if (sqe_map != MAP_FAILED)
+            munmap(sqe_map, sqe_bytes);
+        if (cq_map != MAP_FAILED && cq_map != sq_map)
+            munmap(cq_map, cq_bytes);
+        if (sq_map != MAP_FAILED)
+            munmap(sq_map, sq_bytes);
+        close(ring_fd);
+    }
+
+    int ring_fd;
+    void *sq_map;
+    void *cq_map;
+    void *sqe_map;
+    size_t sq_bytes;
+    size_t cq_bytes;
+    size_t sqe_bytes;
+
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+    unsigned cq_entries;
+
+    unsigned queued;    // In the submission queue, not yet entered
+    unsigned in_flight; // Submitted and not yet reaped
+};
+
+class ThreadPoolWriter : public DiskWriter
+{
+public:
+    explicit ThreadPoolWriter(unsigned threads) : stopping(false), outstanding(0)
+    {
+        for (unsigned t = 0; t < std::max(threads, 1u); ++t)
+            pool.emplace_back(&ThreadPoolWriter::work, this);
+    }
+
+    ~ThreadPoolWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true; // Queued writes are still carried out
+        }
+        work_ready.notify_all();
+        for (size_t t = 0; t < pool.size(); ++t)
+            pool[t].join();
+    }
+
+    const char *name() const { return "threads"; }
+
+    void submit(DiskWrite *write)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(write);
+            ++outstanding;
+        }
+        work_ready.notify_one();
+    }
+
+    void reap(bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait)
+            done_ready.wait(lock, [this]() { return !finished.empty() || outstanding == 0; });
+        for (size_t i = 0; i < finished.size(); ++i)
+            finished[i]->done = true;
+        outstanding -= finished.size();
+        finished.clear();
+    }
+
+private:
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work_ready.wait(lock, [this]() { return !queue.empty() || stopping; });
+            if (queue.empty())
+                return;
+            DiskWrite *write = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            int error = write_fully(write->fd, write->iov, write->count, write->offset,
+                                    write->bytes) ? 0 : errno;
+            lock.lock();
+            write->error = error;
+            finished.push_back(write);
+            done_ready.notify_one();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable done_ready;
+    std::deque<DiskWrite *> queue;
+    std::vector<DiskWrite *> finished; // Written, not yet reaped
+    bool stopping;
+    size_t outstanding; // Submitted, not yet reaped
+    std::vector<std::thread> pool;
+};
+
+inline std::unique_ptr<DiskWriter> DiskWriter::create(const std::string &name)
+{
+    if (name == "sync")
+        return std::unique_ptr<DiskWriter>();
+    if (name == "threads")
+        return std::unique_ptr<DiskWriter>(new ThreadPoolWriter(DISK_WRITER_THREADS));
+    if (name == "uring")
+        return std::unique_ptr<DiskWriter>(new UringWriter(DISK_URING_ENTRIES));
+    if (name == "auto")
+    {
+        try
+        {
+            return std::unique_ptr<DiskWriter>(new UringWriter(DISK_URING_ENTRIES));
+        }
+        catch (const std::runtime_error &)
+        {
+            return std::unique_ptr<DiskWriter>(new ThreadPoolWriter(DISK_WRITER_THREADS));
+        }
+    }
+    throw std::runtime_error("ERROR unknown --disk=" + name);
+}
+
+#endif
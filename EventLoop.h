@@ -0,0 +1,203 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+// Anything driven by an EventLoop: the sockets it watches, plus at most one
+// pending deadline
+class EventHandler
+{
+public:
+    virtual ~EventHandler() {}
+
+    // EFFECTS: fd is ready; events holds the EPOLL* bits that fired
+    virtual void on_io(int fd, uint32_t events) = 0;
+
+    // EFFECTS: The deadline passed to EventLoop::set_timer() has arrived
+    virtual void on_timer() = 0;
+};
+
+// Single-threaded event loop on epoll with a timerfd.
+//   Every handler's deadline sits in one min-heap; the timerfd is armed with
+//   the earliest of them as an absolute CLOCK_MONOTONIC time, so timers fire
+//   with the kernel's hrtimer precision rather than poll()'s milliseconds,
+//   and ACKs are handled the moment they arrive. One loop can drive any
+//   number of handlers (e.g. sender sessions) from one thread.
+//   steady_clock is CLOCK_MONOTONIC on Linux, so its time points are used
+//   directly as timerfd expirations.
+class EventLoop
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    EventLoop() : events(64), armed(Clock::time_point::max())
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0)
+            throw std::runtime_error("ERROR creating epoll instance");
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerfd < 0)
+            throw std::runtime_error("ERROR creating timerfd");
+        control(EPOLL_CTL_ADD, timerfd, EPOLLIN);
+    }
+
+    ~EventLoop()
+    {
+        close(timerfd);
+        close(epfd);
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Deliver `interest` events on fd to handler
+    void watch(int fd, uint32_t interest, EventHandler *handler)
+    {
+        control(EPOLL_CTL_ADD, fd, interest);
+        handlers[fd] = handler;
+    }
+
+    // EFFECTS: Change which events fd is watched for
+    void modify(int fd, uint32_t interest) { control(EPOLL_CTL_MOD, fd, interest); }
+
+    // EFFECTS: Stop watching fd; pending events for it are discarded
+    void unwatch(int fd)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        handlers.erase(fd);
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Call handler->on_timer() once deadline has passed, replacing
+    //          any deadline it had before
+    void set_timer(EventHandler *handler, Clock::time_point deadline)
+    {
+        deadlines[handler] = deadline;
+        timers.push(TimerSlot{deadline, handler});
+    }
+
+    // EFFECTS: Drop handler's pending deadline, if any
+    void cancel_timer(EventHandler *handler) { deadlines.erase(handler); }
+
+    // REQUIRES: Something is watched or has a deadline until done() is true
+    // EFFECTS: Dispatch I/O and timers until done() returns true
+    void run(const std::function<bool()> &done)
+    {
+        while (!done())
+        {
+            arm();
+            int n = epoll_wait(epfd, &events[0], events.size(), -1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw std::runtime_error("ERROR waiting for events");
+
+            for (int i = 0; i < n; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == timerfd)
+                {
+                    uint64_t expirations;
+                    ssize_t ignored = read(timerfd, &expirations, sizeof(expirations));
+                    (void)ignored;
+                    armed = Clock::time_point::max();
+                    continue;
+                }
+
+                // An earlier callback in this batch may have unwatched fd
+                std::unordered_map<int, EventHandler *>::iterator it = handlers.find(fd);
+                if (it != handlers.end())
+                    it->second->on_io(fd, events[i].events);
+            }
+            fire_timers();
+        }
+    }
+
+private:
+    struct TimerSlot
+    {
+        Clock::time_point deadline;
+        EventHandler *handler;
+
+        bool operator>(const TimerSlot &other) const
+        {
+            return deadline > other.deadline;
+        }
+    };
+
+    void control(int op, int fd, uint32_t interest)
+    {
+        epoll_event ev;
+        ev.events = interest;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, op, fd, &ev) < 0)
+            throw std::runtime_error("ERROR updating epoll interest");
+    }
+
+    // A heap entry is live only while it matches its handler's deadline;
+    // replaced and cancelled deadlines are skipped lazily
+    bool live(const TimerSlot &slot) const
+    {
+        std::unordered_map<EventHandler *, Clock::time_point>::const_iterator it =
+            deadlines.find(slot.handler);
+        return it != deadlines.end() && it->second == slot.deadline;
+    }
+
+    // EFFECTS: Point the timerfd at the earliest live deadline
+    void arm()
+    {
+        while (!timers.empty() && !live(timers.top()))
+            timers.pop();
+
+        Clock::time_point next = timers.empty() ? Clock::time_point::max()
+                                                : timers.top().deadline;
+        if (next == armed)
+            return;
+
+        itimerspec spec = {};
+        if (next != Clock::time_point::max())
+        {
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               next.time_since_epoch()).count();
+            // An all-zero it_value would disarm the timer instead
+            if (ns <= 0)
+                ns = 1;
+            spec.it_value.tv_sec = ns / 1000000000;
+            spec.it_value.tv_nsec = ns % 1000000000;
+        }
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+        armed = next;
+    }
+
+    void fire_timers()
+    {
+        Clock::time_point now = Clock::now();
+        while (!timers.empty() && timers.top().deadline <= now)
+        {
+            TimerSlot slot = timers.top();
+            timers.pop();
+            if (!live(slot))
+                continue;
+            deadlines.erase(slot.handler);
+            slot.handler->on_timer();
+        }
+    }
+
+    int epfd;
+    int timerfd;
+    std::vector<epoll_event> events;
+    std::unordered_map<int, EventHandler *> handlers;
+    std::unordered_map<EventHandler *, Clock::time_point> deadlines;
+    std::priority_queue<TimerSlot, std::vector<TimerSlot>, std::greater<TimerSlot> > timers;
+    Clock::time_point armed; // What the timerfd is set to; max() = disarmed
+};
+
+#endif
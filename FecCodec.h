@@ -0,0 +1,305 @@
+#ifndef __FEC_CODEC_H__
+#define __FEC_CODEC_H__
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_HAVE_X86 1
+#endif
+
+// Largest block (DATA packets) and parity count one code can describe
+#define FEC_MAX_DATA 128
+#define FEC_MAX_PARITY 32
+
+// Systematic erasure code over GF(2^8) for PARITY packets.
+//   Parity row j of a block is sum_i C[j][i] * symbol_i, where C is a Cauchy
+//   matrix (x_j = j, y_i = FEC_MAX_PARITY + i) with every column scaled so
+//   row 0 is all ones: the first parity packet is the plain XOR of the
+//   block, and any further rows make it Reed-Solomon-strength, so any e lost
+//   symbols are rebuilt from any e parity rows.
+//   The field is GF(2)[x] / (x^8 + x^4 + x^3 + x + 1), the polynomial the
+//   GFNI instructions use. Products of a buffer by a constant are done with
+//   the fastest kernel the CPU has: GFNI, AVX2 or SSSE3 (split-nibble
+//   tables with a byte shuffle), else a 256-entry row lookup.
+struct GF256
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GF256()
+    {
+        unsigned x = 1;
+        for (unsigned i = 0; i < 255; ++i)
+        {
+            exp[i] = exp[i + 255] = x;
+            log[x] = i;
+            x ^= x << 1; // Multiply by the generator 3
+            if (x & 0x100)
+                x ^= 0x11B;
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0; // Unused; callers test for zero
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const
+    {
+        return a && b ? exp[log[a] + log[b]] : 0;
+    }
+
+    // REQUIRES: a != 0
+    uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+inline const GF256 &gf256()
+{
+    static const GF256 field;
+    return field;
+}
+
+// EFFECTS: C[row][col] of the code described above
+inline uint8_t fec_coefficient(unsigned row, unsigned col)
+{
+    struct Table
+    {
+        uint8_t c[FEC_MAX_PARITY][FEC_MAX_DATA];
+
+        Table()
+        {
+            const GF256 &gf = gf256();
+            for (unsigned j = 0; j < FEC_MAX_PARITY; ++j)
+                for (unsigned i = 0; i < FEC_MAX_DATA; ++i)
+                {
+                    uint8_t y = FEC_MAX_PARITY + i;
+                    c[j][i] = gf.mul(gf.inv(j ^ y), y);
+                }
+        }
+    };
+    static const Table table;
+    return table.c[row][col];
+}
+
+typedef void (*fec_mul_add_kernel)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n);
+typedef void (*fec_xor_kernel)(uint8_t *dst, const uint8_t *src, size_t n);
+
+// dst[i] ^= src[i], eight bytes at a time
+inline void fec_xor_scalar(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; ++i)
+        dst[i] ^= src[i];
+}
+
+// dst[i] ^= c * src[i] through a 256-entry product row
+inline void fec_mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    const GF256 &gf = gf256();
+    uint8_t row[256];
+    for (unsigned x = 0; x < 256; ++x)
+        row[x] = gf.mul(c, x);
+    for (size_t i = 0; i < n; ++i)
+        dst[i] ^= row[src[i]];
+}
+
+#ifdef FEC_HAVE_X86
+// Products of c with every low nibble and every high nibble; c * x is
+// lo[x & 15] ^ hi[x >> 4]
+inline void fec_nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16])
+{
+    const GF256 &gf = gf256();
+    for (unsigned x = 0; x < 16; ++x)
+    {
+        lo[x] = gf.mul(c, x);
+        hi[x] = gf.mul(c, x << 4);
+    }
+}
+
+__attribute__((target("avx2"))) inline void
+fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, b));
+    }
+    fec_xor_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("ssse3"))) inline void
+fec_mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    uint8_t lo[16], hi[16];
+    fec_nibble_tables(c, lo, hi);
+    const __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+    const __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i p = _mm_xor_si128(
+            _mm_shuffle_epi8(tlo, _mm_and_si128(x, mask)),
+            _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+    }
+    for (; i < n; ++i)
+        dst[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+}
+
+__attribute__((target("avx2"))) inline void
+fec_mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    uint8_t lo[16], hi[16];
+    fec_nibble_tables(c, lo, hi);
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i p = _mm256_xor_si256(
+            _mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+            _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+    }
+    for (; i < n; ++i)
+        dst[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+}
+
+// GF2P8MULB multiplies bytes in exactly this field, 32 at a time
+__attribute__((target("gfni,avx2"))) inline void
+fec_mul_add_gfni(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    const __m256i k = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_xor_si256(d, _mm256_gf2p8mul_epi8(x, k)));
+    }
+    if (i == n)
+        return;
+
+    // The tail goes through one zero-padded vector rather than a table
+    uint8_t in[32] = {0}, out[32];
+    memcpy(in, src + i, n - i);
+    _mm256_storeu_si256((__m256i *)out,
+                        _mm256_gf2p8mul_epi8(_mm256_loadu_si256((const __m256i *)in), k));
+    for (size_t t = 0; i < n; ++i, ++t)
+        dst[i] ^= out[t];
+}
+#endif
+
+/* Pick the fastest kernels this CPU supports, once */
+inline fec_mul_add_kernel fec_best_mul_add()
+{
+#ifdef FEC_HAVE_X86
+    if (__builtin_cpu_supports("gfni") && __builtin_cpu_supports("avx2"))
+        return fec_mul_add_gfni;
+    if (__builtin_cpu_supports("avx2"))
+        return fec_mul_add_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return fec_mul_add_ssse3;
+#endif
+    return fec_mul_add_scalar;
+}
+
+inline fec_xor_kernel fec_best_xor()
+{
+#ifdef FEC_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        return fec_xor_avx2;
+#endif
+    return fec_xor_scalar;
+}
+
+// MODIFIES: dst
+// EFFECTS: dst ^= c * src over n bytes; a coefficient of one (every row-0
+//          term) is a plain XOR
+inline void fec_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    static const fec_mul_add_kernel mul_add = fec_best_mul_add();
+    static const fec_xor_kernel xor_into = fec_best_xor();
+
+    if (c == 1)
+        xor_into(dst, src, n);
+    else if (c != 0)
+        mul_add(dst, src, c, n);
+}
+
+// REQUIRES: every rows[r] < FEC_MAX_PARITY and cols[t] < FEC_MAX_DATA are
+//           distinct; e <= FEC_MAX_PARITY
+// MODIFIES: inverse (e * e bytes, row-major)
+// EFFECTS: Invert the e x e submatrix A[r][t] = C[rows[r]][cols[t]], so the
+//          lost symbol cols[t] is sum_r inverse[t * e + r] * syndrome_r.
+//          Cauchy submatrices are always invertible; false only if the
+//          arguments were not distinct
+inline bool fec_invert(unsigned e, const unsigned *rows, const unsigned *cols,
+                       uint8_t *inverse)
+{
+    const GF256 &gf = gf256();
+    std::vector<uint8_t> a(e * e);
+    for (unsigned r = 0; r < e; ++r)
+        for (unsigned t = 0; t < e; ++t)
+        {
+            a[r * e + t] = fec_coefficient(rows[r], cols[t]);
+            inverse[r * e + t] = r == t;
+        }
+
+    // Gauss-Jordan; A x = s, so the inverse maps syndromes to symbols
+    for (unsigned col = 0; col < e; ++col)
+    {
+        unsigned pivot = col;
+        while (pivot < e && a[pivot * e + col] == 0)
+            ++pivot;
+        if (pivot == e)
+            return false;
+        for (unsigned k = 0; k < e; ++k)
+        {
+            std::swap(a[pivot * e + k], a[col * e + k]);
+            std::swap(inverse[pivot * e + k], inverse[col * e + k]);
+        }
+
+        uint8_t scale = gf.inv(a[col * e + col]);
+        for (unsigned k = 0; k < e; ++k)
+        {
+            a[col * e + k] = gf.mul(a[col * e + k], scale);
+            inverse[col * e + k] = gf.mul(inverse[col * e + k], scale);
+        }
+        for (unsigned r = 0; r < e; ++r)
+        {
+            uint8_t f = a[r * e + col];
+            if (r == col || f == 0)
+                continue;
+            for (unsigned k = 0; k < e; ++k)
+            {
+                a[r * e + k] ^= gf.mul(f, a[col * e + k]);
+                inverse[r * e + k] ^= gf.mul(f, inverse[col * e + k]);
+            }
+        }
+    }
+    return true;
+}
+
+#endif
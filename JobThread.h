@@ -0,0 +1,132 @@
+#ifndef __JOB_THREAD_H__
+#define __JOB_THREAD_H__
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Runs slow work (whole-file reads and hashing) for a thread that must keep
+// serving its sockets meanwhile.
+//   A job is two functions: work() runs on the job thread, one job at a
+//   time in the order posted; done() then runs on the owner's thread, the
+//   next time it calls finish(). ready_fd() is an eventfd that turns
+//   readable when a job is waiting for finish(), so the owner can poll it
+//   alongside its sockets.
+//   work() must not touch the owner's state: it gets copies and shared
+//   pointers, and done() carries the result back. An exception work()
+//   throws is rethrown by finish() on the owner's thread.
+//   Jobs still queued when the JobThread is destroyed are dropped; one that
+//   is running is waited for, and its done() never runs.
+class JobThread
+{
+public:
+    typedef std::function<void()> Job;
+
+    JobThread() : stop(false)
+    {
+        ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ready < 0)
+            throw std::runtime_error("ERROR creating eventfd");
+        worker = std::thread(&JobThread::run, this);
+    }
+
+    ~JobThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        queued.notify_one();
+        worker.join();
+        close(ready);
+    }
+
+    int ready_fd() const { return ready; }
+
+    // MODIFIES: *this
+    // EFFECTS: Run work on the job thread, then done on this one
+    void post(const Job &work, const Job &done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            todo.push_back(Entry{work, done, nullptr});
+        }
+        queued.notify_one();
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Call done() for every job whose work has finished, in order,
+    //          and reset ready_fd(); rethrows the first error work() threw
+    void finish()
+    {
+        uint64_t count;
+        ssize_t ignored = read(ready, &count, sizeof(count));
+        (void)ignored;
+
+        std::deque<Entry> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.swap(finished);
+        }
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            if (batch[i].error)
+                std::rethrow_exception(batch[i].error);
+            batch[i].done();
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Job work;
+        Job done;
+        std::exception_ptr error;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            queued.wait(lock, [this]() { return stop || !todo.empty(); });
+            if (stop)
+                return;
+            Entry entry = todo.front();
+            todo.pop_front();
+
+            lock.unlock();
+            try
+            {
+                entry.work();
+            }
+            catch (...)
+            {
+                entry.error = std::current_exception();
+            }
+            lock.lock();
+
+            finished.push_back(entry);
+            uint64_t one = 1;
+            ssize_t ignored = write(ready, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable queued; // todo grew (or stop)
+    std::deque<Entry> todo;
+    std::deque<Entry> finished; // Waiting for finish()
+    bool stop;
+    int ready;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef __LZ_CODEC_H__
+#define __LZ_CODEC_H__
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "PacketCodec.h"
+
+// Hash table of recent 4-byte sequences the encoder looks matches up in
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+// Searching speeds up through data that stops matching: the stride grows
+// by one every 2^LZ_SKIP_SHIFT misses, so random data costs little
+#define LZ_SKIP_SHIFT 5
+
+// Byte-oriented LZ77 codec for compressed DATA payloads (START_COMPRESS).
+//   A block is a series of sequences in the manner of LZ4: a token byte
+//   whose high nibble is the literal count and low nibble the match length
+//   minus LZ_MIN_MATCH (15 in either means more bytes follow, each adding up
+//   to 255), the literals, then a 2-byte little-endian offset back into the
+//   output. The last sequence has literals only. Blocks never refer outside
+//   themselves, so every packet decodes on its own.
+//   The encoder is written for packets: it fills a fixed number of output
+//   bytes with as much input as they can hold, in one greedy pass.
+
+// Bytes a sequence's count takes beyond its token nibble
+inline size_t lz_count_bytes(size_t count)
+{
+    return count < 15 ? 0 : (count - 15) / 255 + 1;
+}
+
+class LzEncoder
+{
+public:
+    LzEncoder() : table(1 << LZ_HASH_BITS, 0), epoch(1) {}
+
+    // REQUIRES: dst_cap >= 1
+    // MODIFIES: *this, dst, consumed
+    // EFFECTS: Encode the longest prefix of src[0, src_len) whose block fits
+    //          in dst_cap bytes; consumed is that prefix's length. Returns
+    //          the block's length
+    size_t encode(const char *src, size_t src_len, char *dst, size_t dst_cap,
+                  size_t &consumed)
+    {
+        // Positions are stored as epoch + i so the table never needs
+        // clearing: anything below epoch belongs to an earlier block
+        if (epoch > UINT32_MAX - src_len - 1)
+        {
+            std::fill(table.begin(), table.end(), 0);
+            epoch = 1;
+        }
+        const uint8_t *in = reinterpret_cast<const uint8_t *>(src);
+        uint8_t *out = reinterpret_cast<uint8_t *>(dst);
+        size_t op = 0;
+        size_t anchor = 0; // First byte not yet encoded
+        size_t pos = 0;
+        size_t misses = 0;
+
+        while (src_len >= LZ_MIN_MATCH && pos <= src_len - LZ_MIN_MATCH)
+        {
+            uint32_t word = read32(in + pos);
+            uint32_t &slot = table[hash(word)];
+            size_t cand = slot >= epoch ? slot - epoch : SIZE_MAX;
+            slot = epoch + pos;
+            if (cand == SIZE_MAX || pos - cand > LZ_MAX_OFFSET || read32(in + cand) != word)
+            {
+                pos += 1 + (misses++ >> LZ_SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+
+            // Extend both ways: forwards to the end of the input, backwards
+            // over literals that also match
+            size_t len = LZ_MIN_MATCH;
+            while (pos + len + 8 <= src_len)
+            {
+                uint64_t a, b;
+                memcpy(&a, in + cand + len, 8);
+                memcpy(&b, in + pos + len, 8);
+                if (a != b)
+                {
+                    len += __builtin_ctzll(a ^ b) / 8; // Little-endian
+                    break;
+                }
+                len += 8;
+            }
+            if (pos + len + 8 > src_len)
+                while (pos + len < src_len && in[cand + len] == in[pos + len])
+                    ++len;
+            while (pos > anchor && cand > 0 && in[pos - 1] == in[cand - 1])
+            {
+                --pos;
+                --cand;
+                ++len;
+            }
+
+            size_t literals = pos - anchor;
+            size_t need = 1 + lz_count_bytes(literals) + literals + 2 +
+                          lz_count_bytes(len - LZ_MIN_MATCH);
+            if (op + need + 1 > dst_cap)
+                break; // Keep a byte for the final token
+            op = put_sequence(out + op, in + anchor, literals, pos - cand, len) - out;
+            pos += len;
+            anchor = pos;
+        }
+
+        // The rest of the room goes to trailing literals
+        size_t room = dst_cap - op;
+        size_t literals = std::min(src_len - anchor, room - 1);
+        while (literals > 0 && 1 + lz_count_bytes(literals) + literals > room)
+            --literals;
+        op = put_sequence(out + op, in + anchor, literals, 0, 0) - out;
+        consumed = anchor + literals;
+        epoch += src_len + 1;
+        return op;
+    }
+
+private:
+    static uint32_t read32(const uint8_t *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash(uint32_t word)
+    {
+        return (word * 2654435761U) >> (32 - LZ_HASH_BITS);
+    }
+
+    static uint8_t *put_count(uint8_t *out, size_t count)
+    {
+        if (count < 15)
+            return out;
+        for (count -= 15; count >= 255; count -= 255)
+            *out++ = 255;
+        *out++ = count;
+        return out;
+    }
+
+    // EFFECTS: Write one sequence (a final one when len == 0); returns the
+    //          end of what was written
+    static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, size_t count,
+                                 size_t offset, size_t len)
+    {
+        size_t extra = len ? len - LZ_MIN_MATCH : 0;
+        *out++ = (std::min<size_t>(count, 15) << 4) | std::min<size_t>(extra, 15);
+        out = put_count(out, count);
+        memcpy(out, literals, count);
+        out += count;
+        if (len == 0)
+            return out;
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+        return put_count(out, extra);
+    }
+
+    std::vector<uint32_t> table;
+    uint32_t epoch;
+};
+
+// MODIFIES: dst
+// EFFECTS: Decode the block src[0, src_len) into exactly dst_len bytes;
+//          false if it is malformed or decodes to any other length
+inline bool lz_decode(const char *src, size_t src_len, char *dst, size_t dst_len)
+{
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(src);
+    const uint8_t *end = in + src_len;
+    uint8_t *out = reinterpret_cast<uint8_t *>(dst);
+    size_t op = 0;
+
+    struct Count
+    {
+        static bool read(const uint8_t *&in, const uint8_t *end, size_t &count)
+        {
+            if (count < 15)
+                return true;
+            for (;;)
+            {
+                if (in == end)
+                    return false;
+                uint8_t b = *in++;
+                count += b;
+                if (b != 255)
+                    return true;
+            }
+        }
+    };
+
+    while (in < end)
+    {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (!Count::read(in, end, literals) || literals > (size_t)(end - in) ||
+            literals > dst_len - op)
+            return false;
+        memcpy(out + op, in, literals);
+        in += literals;
+        op += literals;
+        if (in == end)
+            break; // The final sequence
+
+        size_t len = token & 15;
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (!Count::read(in, end, len))
+            return false;
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || len > dst_len - op)
+            return false;
+
+        // Overlapping copies repeat the last offset bytes, so go bytewise
+        // unless the source lies wholly behind
+        const uint8_t *from = out + op - offset;
+        if (offset >= len)
+            memcpy(out + op, from, len);
+        else
+            for (size_t i = 0; i < len; ++i)
+                out[op + i] = from[i];
+        op += len;
+    }
+    return op == dst_len;
+}
+
+// REQUIRES: payload_cap > sizeof(CompressInfo); src_len <= the raw limit
+//           both sides agreed on
+// MODIFIES: encoder, payload, consumed
+// EFFECTS: Fill one DATA payload of at most payload_cap bytes with a
+//          CompressInfo and as much of src as it holds, LZ-coded unless
+//          storing the bytes as they are would carry as many in fewer
+//          bytes (or try_lz is false). Returns the payload's length
+inline size_t compress_payload(LzEncoder &encoder, const char *src, size_t src_len,
+                               char *payload, size_t payload_cap, size_t &consumed,
+                               bool try_lz = true)
+{
+    size_t room = payload_cap - sizeof(CompressInfo);
+    size_t stored = std::min(room, src_len);
+    CompressInfo info = {COMPRESS_STORED, 0, 0};
+    size_t body = 0;
+    if (try_lz)
+        body = encoder.encode(src, src_len, payload + sizeof(info), room, consumed);
+    if (try_lz && (consumed > stored || (consumed == stored && body < stored)))
+        info.method = COMPRESS_LZ;
+    else
+    {
+        consumed = stored;
+        memcpy(payload + sizeof(info), src, consumed);
+        body = consumed;
+    }
+    info.raw_length = consumed;
+    encode_wire(info, payload);
+    return sizeof(info) + body;
+}
+
+// MODIFIES: out, raw_len
+// EFFECTS: Decode a compressed DATA payload into out (room for raw_cap
+//          bytes); false if it is malformed
+inline bool decompress_payload(const char *payload, size_t len, char *out, size_t raw_cap,
+                               size_t &raw_len)
+{
+    if (len < sizeof(CompressInfo))
+        return false;
+    CompressInfo info = decode_wire<CompressInfo>(payload);
+    const char *body = payload + sizeof(info);
+    size_t body_len = len - sizeof(info);
+    if (info.raw_length > raw_cap)
+        return false;
+    raw_len = info.raw_length;
+    if (info.method == COMPRESS_STORED)
+    {
+        if (body_len != raw_len)
+            return false;
+        memcpy(out, body, raw_len);
+        return true;
+    }
+    return info.method == COMPRESS_LZ && lz_decode(body, body_len, out, raw_len);
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <chrono>
+#include <thread>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <sys/socket.h>
+
+// How much sending may bunch up: a quarter millisecond at the pacing rate,
+// but never less than PACE_MIN_BURST_PACKETS full packets
+#define PACE_BURST_US 250
+#define PACE_MIN_BURST_PACKETS 2
+// --pace=auto sends at gain * cwnd / SRTT; faster while still in slow start
+#define PACE_GAIN_SLOW_START 2.0
+#define PACE_GAIN 1.25
+
+// Token-bucket pacer for DATA packets.
+//   Tokens are bytes and refill continuously at the pacing rate up to a small
+//   burst, so a window is spread over the RTT instead of leaving back-to-back.
+//   A rate of zero disables pacing. Event-driven senders ask ready_at() when
+//   to come back; blocking senders just wait().
+//   Retransmissions may be charged with force() so they delay new data rather
+//   than wait themselves.
+class Pacer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit Pacer(size_t packet_size)
+        : packet_size(packet_size), rate(0), burst(0), tokens(0), last(Clock::now())
+    {
+    }
+
+    bool enabled() const { return rate > 0; }
+
+    // MODIFIES: *this
+    // EFFECTS: Packets are now up to bytes long (e.g. after an MTU change);
+    //          the burst always admits at least PACE_MIN_BURST_PACKETS
+    void set_packet_size(size_t bytes)
+    {
+        packet_size = bytes;
+        if (enabled())
+            set_rate(rate);
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Pace at bytes_per_sec from now on (0 turns pacing off)
+    void set_rate(double bytes_per_sec)
+    {
+        bool was_enabled = enabled();
+        refill(Clock::now());
+        rate = bytes_per_sec;
+        burst = std::max<double>(PACE_MIN_BURST_PACKETS * packet_size,
+                                 rate * PACE_BURST_US / 1e6);
+        // A freshly enabled pacer may send its first burst at once
+        tokens = was_enabled ? std::min(tokens, burst) : burst;
+    }
+
+    // EFFECTS: --pace=auto: spread cwnd packets over one smoothed RTT (with
+    //          headroom so the window can still grow). Unpaced until the
+    //          first RTT sample
+    void set_window_rate(uint32_t cwnd, bool slow_start, std::chrono::microseconds srtt)
+    {
+        if (srtt.count() <= 0)
+            return;
+        double gain = slow_start ? PACE_GAIN_SLOW_START : PACE_GAIN;
+        set_rate(gain * cwnd * packet_size * 1e6 / srtt.count());
+    }
+
+    // EFFECTS: Spend bytes if the bucket holds them; false means wait
+    bool consume(size_t bytes)
+    {
+        if (!enabled())
+            return true;
+        refill(Clock::now());
+        if (tokens < bytes)
+            return false;
+        tokens -= bytes;
+        return true;
+    }
+
+    // EFFECTS: Spend bytes even if that leaves the bucket in debt
+    void force(size_t bytes)
+    {
+        if (!enabled())
+            return;
+        refill(Clock::now());
+        tokens -= bytes;
+    }
+
+    // EFFECTS: When consume(bytes) will next succeed
+    Clock::time_point ready_at(size_t bytes) const
+    {
+        if (!enabled() || tokens >= bytes)
+            return last;
+        return last + std::chrono::duration_cast<Clock::duration>(
+                          std::chrono::duration<double>((bytes - tokens) / rate));
+    }
+
+    // EFFECTS: Block until bytes may be sent, then spend them
+    void wait(size_t bytes)
+    {
+        while (!consume(bytes))
+            std::this_thread::sleep_until(ready_at(bytes));
+    }
+
+private:
+    void refill(Clock::time_point now)
+    {
+        if (enabled())
+            tokens = std::min(burst, tokens + rate *
+                                     std::chrono::duration<double>(now - last).count());
+        last = now;
+    }
+
+    size_t packet_size;
+    double rate;   // Bytes per second
+    double burst;  // Bucket depth in bytes
+    double tokens; // May go negative after force()
+    Clock::time_point last;
+};
+
+// REQUIRES: pace is the --pace value ("" when absent)
+// MODIFIES: pacer, sockfd
+// EFFECTS: "auto" returns true: the caller re-rates the pacer from cwnd/SRTT.
+//          A number is a fixed rate in Mbit/s, also handed to the kernel as
+//          SO_MAX_PACING_RATE, which the fq qdisc enforces where it is in use
+inline bool configure_pacing(Pacer &pacer, const std::string &pace, int sockfd)
+{
+    if (pace.empty())
+        return false;
+    if (pace == "auto")
+        return true;
+
+    double bytes_per_sec = std::stod(pace) * 1e6 / 8;
+    pacer.set_rate(bytes_per_sec);
+#ifdef SO_MAX_PACING_RATE
+    unsigned int kernel_rate = std::min<double>(bytes_per_sec, UINT32_MAX - 1);
+    setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &kernel_rate, sizeof(kernel_rate));
+#else
+    (void)sockfd;
+#endif
+    return false;
+}
+
+#endif
@@ -0,0 +1,497 @@
+#ifndef __PACKET_CODEC_H__
+#define __PACKET_CODEC_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "PacketHeader.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_HAVE_X86 1
+#endif
+
+// PacketHeader.type
+#define PACKET_START 0
+#define PACKET_END 1
+#define PACKET_DATA 2
+#define PACKET_ACK 3
+#define PACKET_PARITY 4
+
+// Largest ACK payload: a START ACK with every resume run (a SACK bitmap is
+// smaller)
+#define ACK_MAX_PAYLOAD (sizeof(StartInfo) + RESUME_MAX_RUNS * sizeof(ResumeRun))
+
+// Wire format of the packet header and of the payloads after it.
+//   A PacketHeader in memory is in host order and never goes on the wire
+//   as it is: its fields are sent as big-endian words in declaration order
+//   (type, seqNum, length, checksum), so peers of either byte order read the
+//   same values. The layout is a list of WireFields; WireCodec packs them
+//   back to back at offsets worked out at compile time, and the encoder and
+//   decoder are both generated from that one list.
+//   Payload structs (StartInfo, FecInfo, ResumeRun, DeltaSignature,
+//   CompressInfo, BatchFileInfo) have a Wire<> list of their own and go
+//   through encode_wire() / decode_wire() the same way; each is as long on
+//   the wire as in memory, so sizeof() gives payload offsets. SACK words and
+//   the FEC symbol length prefix are big-endian too. Only a DeltaInfo (a
+//   name) and the LZ frames inside compressed DATA (LzCodec.h, which fixes
+//   its own byte order) are sent as they are.
+//   PacketRule<type> says what length a header of each type may claim for
+//   the datagram it arrived in; decode_headers() applies the rules to a
+//   whole recvmmsg batch, eight headers at a time with AVX2.
+
+template <typename T>
+inline T byte_swap(T value);
+
+template <>
+inline uint8_t byte_swap(uint8_t value) { return value; }
+template <>
+inline uint16_t byte_swap(uint16_t value) { return __builtin_bswap16(value); }
+template <>
+inline uint32_t byte_swap(uint32_t value) { return __builtin_bswap32(value); }
+template <>
+inline uint64_t byte_swap(uint64_t value) { return __builtin_bswap64(value); }
+
+// EFFECTS: value converted between host and big-endian order (either way)
+template <typename T>
+inline T big_endian(T value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#else
+    return byte_swap(value);
+#endif
+}
+
+// REQUIRES: wire has room for sizeof(T) bytes
+// MODIFIES: wire
+// EFFECTS: Store value big-endian at wire, which need not be aligned
+template <typename T>
+inline void store_big_endian(T value, void *wire)
+{
+    value = big_endian(value);
+    memcpy(wire, &value, sizeof(value));
+}
+
+// REQUIRES: wire holds sizeof(T) bytes
+template <typename T>
+inline T load_big_endian(const void *wire)
+{
+    T value;
+    memcpy(&value, wire, sizeof(value));
+    return big_endian(value);
+}
+
+// One field of a wire struct: Member of Struct, sizeof(T) bytes big-endian
+template <class Struct, typename T, T Struct::*Member>
+struct WireField
+{
+    static constexpr size_t bytes = sizeof(T);
+
+    static void encode(const Struct &s, char *wire) { store_big_endian(s.*Member, wire); }
+    static void decode(const char *wire, Struct &s) { s.*Member = load_big_endian<T>(wire); }
+};
+
+// Element Index of the array Member of Struct, as a WireField
+template <class Struct, typename T, size_t N, T (Struct::*Member)[N], size_t Index>
+struct WireElement
+{
+    static_assert(Index < N, "element out of range");
+    static constexpr size_t bytes = sizeof(T);
+
+    static void encode(const Struct &s, char *wire) { store_big_endian((s.*Member)[Index], wire); }
+    static void decode(const char *wire, Struct &s)
+    {
+        (s.*Member)[Index] = load_big_endian<T>(wire);
+    }
+};
+
+// Fields laid out in order from byte Offset on; bytes is where they end
+template <size_t Offset, class Struct, class... Fields>
+struct WireCodec;
+
+template <size_t Offset, class Struct>
+struct WireCodec<Offset, Struct>
+{
+    static constexpr size_t bytes = Offset;
+
+    static void encode(const Struct &, char *) {}
+    static void decode(const char *, Struct &) {}
+};
+
+template <size_t Offset, class Struct, class Field, class... Rest>
+struct WireCodec<Offset, Struct, Field, Rest...>
+{
+    typedef WireCodec<Offset + Field::bytes, Struct, Rest...> Next;
+    static constexpr size_t bytes = Next::bytes;
+
+    static void encode(const Struct &s, char *wire)
+    {
+        Field::encode(s, wire + Offset);
+        Next::encode(s, wire);
+    }
+
+    static void decode(const char *wire, Struct &s)
+    {
+        Field::decode(wire + Offset, s);
+        Next::decode(wire, s);
+    }
+};
+
+// The wire layout of each struct that goes on the wire: Wire<S>::Codec
+template <class Struct>
+struct Wire;
+
+#define WIRE_FIELD(S, T, member) WireField<S, T, &S::member>
+#define WIRE_ELEMENT(S, T, N, member, i) WireElement<S, T, N, &S::member, i>
+
+template <>
+struct Wire<PacketHeader>
+{
+    typedef WireCodec<0, PacketHeader, WIRE_FIELD(PacketHeader, unsigned int, type),
+                      WIRE_FIELD(PacketHeader, unsigned int, seqNum),
+                      WIRE_FIELD(PacketHeader, unsigned int, length),
+                      WIRE_FIELD(PacketHeader, unsigned int, checksum)>
+        Codec;
+};
+
+template <>
+struct Wire<FecInfo>
+{
+    typedef WireCodec<0, FecInfo, WIRE_FIELD(FecInfo, uint16_t, data_count),
+                      WIRE_FIELD(FecInfo, uint8_t, parity_index),
+                      WIRE_FIELD(FecInfo, uint8_t, parity_count)>
+        Codec;
+};
+
+template <>
+struct Wire<StartInfo>
+{
+    typedef WireCodec<0, StartInfo, WIRE_FIELD(StartInfo, uint32_t, flags),
+                      WIRE_FIELD(StartInfo, uint32_t, transfer_id),
+                      WIRE_FIELD(StartInfo, uint32_t, stream_index),
+                      WIRE_FIELD(StartInfo, uint32_t, stream_count),
+                      WIRE_FIELD(StartInfo, uint64_t, offset),
+                      WIRE_FIELD(StartInfo, uint64_t, file_size),
+                      WIRE_FIELD(StartInfo, uint32_t, max_chunk),
+                      WIRE_FIELD(StartInfo, uint32_t, reserved)>
+        Codec;
+};
+
+template <>
+struct Wire<ResumeRun>
+{
+    typedef WireCodec<0, ResumeRun, WIRE_FIELD(ResumeRun, uint64_t, offset),
+                      WIRE_FIELD(ResumeRun, uint64_t, length),
+                      WIRE_FIELD(ResumeRun, uint32_t, checksum),
+                      WIRE_FIELD(ResumeRun, uint32_t, reserved)>
+        Codec;
+};
+
+template <>
+struct Wire<DeltaSignature>
+{
+    typedef WireCodec<0, DeltaSignature, WIRE_FIELD(DeltaSignature, uint32_t, weak),
+                      WIRE_FIELD(DeltaSignature, uint32_t, reserved),
+                      WIRE_ELEMENT(DeltaSignature, uint64_t, 2, strong, 0),
+                      WIRE_ELEMENT(DeltaSignature, uint64_t, 2, strong, 1)>
+        Codec;
+};
+
+template <>
+struct Wire<CompressInfo>
+{
+    typedef WireCodec<0, CompressInfo, WIRE_FIELD(CompressInfo, uint16_t, method),
+                      WIRE_FIELD(CompressInfo, uint16_t, reserved),
+                      WIRE_FIELD(CompressInfo, uint32_t, raw_length)>
+        Codec;
+};
+
+template <>
+struct Wire<BatchFileInfo>
+{
+    typedef WireCodec<0, BatchFileInfo, WIRE_FIELD(BatchFileInfo, uint32_t, index),
+                      WIRE_FIELD(BatchFileInfo, uint32_t, chunks),
+                      WIRE_FIELD(BatchFileInfo, uint64_t, size),
+                      WIRE_FIELD(BatchFileInfo, uint16_t, name_length),
+                      WIRE_ELEMENT(BatchFileInfo, uint16_t, 3, reserved, 0),
+                      WIRE_ELEMENT(BatchFileInfo, uint16_t, 3, reserved, 1),
+                      WIRE_ELEMENT(BatchFileInfo, uint16_t, 3, reserved, 2)>
+        Codec;
+};
+
+// sizeof() is used throughout as each struct's size on the wire
+static_assert(Wire<PacketHeader>::Codec::bytes == sizeof(PacketHeader), "layout changed");
+static_assert(Wire<FecInfo>::Codec::bytes == sizeof(FecInfo), "layout changed");
+static_assert(Wire<StartInfo>::Codec::bytes == sizeof(StartInfo), "layout changed");
+static_assert(Wire<ResumeRun>::Codec::bytes == sizeof(ResumeRun), "layout changed");
+static_assert(Wire<DeltaSignature>::Codec::bytes == sizeof(DeltaSignature), "layout changed");
+static_assert(Wire<CompressInfo>::Codec::bytes == sizeof(CompressInfo), "layout changed");
+static_assert(Wire<BatchFileInfo>::Codec::bytes == sizeof(BatchFileInfo), "layout changed");
+static_assert(sizeof(unsigned int) == sizeof(uint32_t), "32-bit header fields");
+
+// REQUIRES: wire has room for count * sizeof(Struct) bytes
+// MODIFIES: wire
+// EFFECTS: Encode s[0..count) back to back at wire
+template <class Struct>
+inline void encode_wire(const Struct *s, size_t count, void *wire)
+{
+    for (size_t i = 0; i < count; ++i)
+        Wire<Struct>::Codec::encode(s[i], static_cast<char *>(wire) + i * sizeof(Struct));
+}
+
+// REQUIRES: wire holds count * sizeof(Struct) bytes
+// MODIFIES: s
+template <class Struct>
+inline void decode_wire(const void *wire, size_t count, Struct *s)
+{
+    for (size_t i = 0; i < count; ++i)
+        Wire<Struct>::Codec::decode(static_cast<const char *>(wire) + i * sizeof(Struct), s[i]);
+}
+
+// REQUIRES: wire has room for sizeof(Struct) bytes
+// MODIFIES: wire
+template <class Struct>
+inline void encode_wire(const Struct &s, void *wire)
+{
+    encode_wire(&s, 1, wire);
+}
+
+// REQUIRES: wire holds sizeof(Struct) bytes
+template <class Struct>
+inline Struct decode_wire(const void *wire)
+{
+    Struct s;
+    decode_wire(wire, 1, &s);
+    return s;
+}
+
+// REQUIRES: wire has room for sizeof(PacketHeader) bytes
+// MODIFIES: wire
+inline void encode_header(const PacketHeader &header, void *wire)
+{
+    encode_wire(header, wire);
+}
+
+// REQUIRES: wire holds at least sizeof(PacketHeader) bytes
+inline PacketHeader decode_header(const void *wire)
+{
+    return decode_wire<PacketHeader>(wire);
+}
+
+// What a header may claim beyond its own type's rule
+struct HeaderLimits
+{
+    uint32_t max_data; // Largest DATA / PARITY payload
+    uint32_t max_ack;  // Largest ACK payload
+};
+
+// The length a header of each type may carry: at most limit(), and either
+// exactly the payload bytes that followed it in the datagram (exact) or no
+// more than them
+template <unsigned Type>
+struct PacketRule;
+
+// START: length covers its StartInfo (and DeltaInfo), or is 0; an MTU probe
+// pads the datagram beyond it
+template <>
+struct PacketRule<PACKET_START>
+{
+    static const bool exact = false;
+    static uint32_t limit(const HeaderLimits &) { return 0xFFFFFFFFU; }
+};
+
+// END: the header alone
+template <>
+struct PacketRule<PACKET_END>
+{
+    static const bool exact = true;
+    static uint32_t limit(const HeaderLimits &) { return 0; }
+};
+
+// DATA: exactly one chunk, no larger than any flow's chunks
+template <>
+struct PacketRule<PACKET_DATA>
+{
+    static const bool exact = true;
+    static uint32_t limit(const HeaderLimits &limits) { return limits.max_data; }
+};
+
+// ACK: bare, or a StartInfo reply or SACK bitmap of exactly length bytes
+template <>
+struct PacketRule<PACKET_ACK>
+{
+    static const bool exact = true;
+    static uint32_t limit(const HeaderLimits &limits) { return limits.max_ack; }
+};
+
+// PARITY: a FecInfo and one symbol, which together fill a chunk
+template <>
+struct PacketRule<PACKET_PARITY>
+{
+    static const bool exact = true;
+    static uint32_t limit(const HeaderLimits &limits) { return limits.max_data; }
+};
+
+// REQUIRES: packet_len >= sizeof(PacketHeader)
+// EFFECTS: true if header passes the rule of its type for a datagram of
+//          packet_len bytes. The rules are looked up by type rather than
+//          switched on, so a batch of mixed types costs no mispredicted jump
+inline bool header_valid(const PacketHeader &header, size_t packet_len,
+                         const HeaderLimits &limits)
+{
+    const bool exact[] = {PacketRule<PACKET_START>::exact, PacketRule<PACKET_END>::exact,
+                          PacketRule<PACKET_DATA>::exact, PacketRule<PACKET_ACK>::exact,
+                          PacketRule<PACKET_PARITY>::exact};
+    const uint32_t limit[] = {PacketRule<PACKET_START>::limit(limits),
+                              PacketRule<PACKET_END>::limit(limits),
+                              PacketRule<PACKET_DATA>::limit(limits),
+                              PacketRule<PACKET_ACK>::limit(limits),
+                              PacketRule<PACKET_PARITY>::limit(limits)};
+    size_t payload = packet_len - sizeof(PacketHeader);
+    uint32_t type = header.type, length = header.length;
+    if (type > PACKET_PARITY)
+        return false;
+    return (length <= limit[type]) & (exact[type] ? length == payload : length <= payload);
+}
+
+// REQUIRES: in.packet(i) / in.length(i) describe n datagrams (BatchIO);
+//           out and ok have room for n
+// MODIFIES: out, ok
+// EFFECTS: decode_headers() for datagrams [first, n), one at a time
+template <class Datagrams>
+inline void decode_headers_scalar(const Datagrams &in, size_t first, size_t n,
+                                  const HeaderLimits &limits, PacketHeader *out, uint8_t *ok)
+{
+    for (size_t i = first; i < n; ++i)
+    {
+        size_t len = in.length(i);
+        if (len < sizeof(PacketHeader))
+        {
+            out[i] = PacketHeader{0, 0, 0, 0};
+            ok[i] = false;
+            continue;
+        }
+        out[i] = decode_header(in.packet(i));
+        ok[i] = header_valid(out[i], len, limits);
+    }
+}
+
+#ifdef CODEC_HAVE_X86
+// MODIFIES: out[i], out[i + 4]
+// EFFECTS: The headers of datagrams i and i + 4, decoded into the two
+//          halves of a vector by one byte shuffle and stored. A datagram
+//          too short to hold a header decodes as zeros
+template <class Datagrams>
+__attribute__((target("avx2"))) inline __m256i
+load_header_pair(const Datagrams &in, size_t i, PacketHeader *out)
+{
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    if (in.length(i) >= sizeof(PacketHeader))
+        lo = _mm_loadu_si128((const __m128i *)in.packet(i));
+    if (in.length(i + 4) >= sizeof(PacketHeader))
+        hi = _mm_loadu_si128((const __m128i *)in.packet(i + 4));
+    __m256i h = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1),
+                                    swap);
+    _mm_storeu_si128((__m128i *)&out[i], _mm256_castsi256_si128(h));
+    _mm_storeu_si128((__m128i *)&out[i + 4], _mm256_extracti128_si256(h, 1));
+    return h;
+}
+
+// EFFECTS: A datagram size as a 32-bit lane; a size that does not fit is
+//          far too large for any header to claim
+inline int32_t header_lane_len(size_t len)
+{
+    return len < 0x7FFFFFFF ? (int32_t)len : 0x7FFFFFFF;
+}
+
+// REQUIRES: in.packet(i) / in.length(i) describe n datagrams (BatchIO);
+//           out and ok have room for n
+// MODIFIES: out, ok
+// EFFECTS: decode_headers() eight datagrams at a time: four header pairs
+//          are loaded and swapped, transposed so that lane k holds the type
+//          and length of header k, and checked against every PacketRule at
+//          once with compare masks (header_valid() lane by lane)
+template <class Datagrams>
+__attribute__((target("avx2"))) void
+decode_headers_avx2(const Datagrams &in, size_t n, const HeaderLimits &limits,
+                    PacketHeader *out, uint8_t *ok)
+{
+    const __m256i max_data = _mm256_set1_epi32(limits.max_data);
+    const __m256i max_ack = _mm256_set1_epi32(limits.max_ack);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i lens = _mm256_setr_epi32(
+            header_lane_len(in.length(i)), header_lane_len(in.length(i + 1)),
+            header_lane_len(in.length(i + 2)), header_lane_len(in.length(i + 3)),
+            header_lane_len(in.length(i + 4)), header_lane_len(in.length(i + 5)),
+            header_lane_len(in.length(i + 6)), header_lane_len(in.length(i + 7)));
+        __m256i h0 = load_header_pair(in, i, out), h1 = load_header_pair(in, i + 1, out);
+        __m256i h2 = load_header_pair(in, i + 2, out), h3 = load_header_pair(in, i + 3, out);
+
+        // Rows are headers (k and k + 4 in each half); words 0 and 2 of
+        // each row are the type and length
+        __m256i lo01 = _mm256_unpacklo_epi32(h0, h1); // t0 t1 s0 s1 | t4 t5 s4 s5
+        __m256i lo23 = _mm256_unpacklo_epi32(h2, h3);
+        __m256i hi01 = _mm256_unpackhi_epi32(h0, h1); // l0 l1 c0 c1 | l4 l5 c4 c5
+        __m256i hi23 = _mm256_unpackhi_epi32(h2, h3);
+        __m256i types = _mm256_unpacklo_epi64(lo01, lo23);
+        __m256i lengths = _mm256_unpacklo_epi64(hi01, hi23);
+
+        const __m256i header = _mm256_set1_epi32(sizeof(PacketHeader));
+        __m256i truncated = _mm256_cmpgt_epi32(header, lens);
+        __m256i payloads = _mm256_sub_epi32(lens, header);
+        __m256i start = _mm256_cmpeq_epi32(types, _mm256_set1_epi32(PACKET_START));
+        __m256i data = _mm256_cmpeq_epi32(types, _mm256_set1_epi32(PACKET_DATA));
+        __m256i parity = _mm256_cmpeq_epi32(types, _mm256_set1_epi32(PACKET_PARITY));
+        data = _mm256_or_si256(data, parity);
+        __m256i ack = _mm256_cmpeq_epi32(types, _mm256_set1_epi32(PACKET_ACK));
+        __m256i end = _mm256_cmpeq_epi32(types, _mm256_set1_epi32(PACKET_END));
+        // END's limit is 0; START is bounded by its payload alone
+        __m256i limit = _mm256_or_si256(_mm256_and_si256(data, max_data),
+                                        _mm256_and_si256(ack, max_ack));
+        __m256i le_limit = _mm256_cmpeq_epi32(_mm256_min_epu32(lengths, limit), lengths);
+        __m256i le_payload = _mm256_cmpeq_epi32(_mm256_min_epu32(lengths, payloads), lengths);
+        __m256i exact = _mm256_and_si256(_mm256_cmpeq_epi32(lengths, payloads), le_limit);
+        exact = _mm256_and_si256(exact, _mm256_or_si256(_mm256_or_si256(data, ack), end));
+        __m256i valid = _mm256_or_si256(_mm256_and_si256(start, le_payload), exact);
+
+        // One byte per lane, 0 or 1: the packs keep each half's four lanes
+        valid = _mm256_andnot_si256(truncated, valid);
+        valid = _mm256_packs_epi16(_mm256_packs_epi32(valid, valid), valid);
+        valid = _mm256_and_si256(valid, _mm256_set1_epi8(1));
+        int32_t first = _mm_cvtsi128_si32(_mm256_castsi256_si128(valid));
+        int32_t second = _mm_cvtsi128_si32(_mm256_extracti128_si256(valid, 1));
+        memcpy(ok + i, &first, sizeof(first));
+        memcpy(ok + i + 4, &second, sizeof(second));
+    }
+    decode_headers_scalar(in, i, n, limits, out, ok);
+}
+#endif
+
+// REQUIRES: in.packet(i) / in.length(i) describe n datagrams (BatchIO);
+//           out and ok have room for n
+// MODIFIES: out, ok
+// EFFECTS: Decode every datagram's header and check it against its type's
+//          PacketRule; ok[i] is false for anything that fails or is too
+//          short to hold a header (out[i] is then all zeros)
+template <class Datagrams>
+inline void decode_headers(const Datagrams &in, size_t n, const HeaderLimits &limits,
+                           PacketHeader *out, uint8_t *ok)
+{
+#ifdef CODEC_HAVE_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2)
+    {
+        decode_headers_avx2(in, n, limits, out, ok);
+        return;
+    }
+#endif
+    decode_headers_scalar(in, 0, n, limits, out, ok);
+}
+
+#endif
@@ -1,12 +1,153 @@
 #ifndef __PACKET_HEADER_H__
 #define __PACKET_HEADER_H__
 
+#include <stdint.h>
+
+// Goes on the wire big-endian, through encode_header() / decode_header()
+// in PacketCodec.h; never sent as it sits in memory. Neither are the payload
+// structs below, which go through encode_wire() / decode_wire()
 struct PacketHeader
 {
-    unsigned int type;     // 0: START; 1: END; 2: DATA; 3: ACK
+    unsigned int type;     // 0: START; 1: END; 2: DATA; 3: ACK; 4: PARITY
     unsigned int seqNum;   // Described below
     unsigned int length;   // Length of data; 0 for ACK packets
     unsigned int checksum; // 32-bit CRC
 };
 
+// StartInfo.flags: features a sender asks for in START; the receiver's ACK
+// echoes the subset it accepted
+#define START_RANGE 0x1     // Connection carries one byte range of a larger file
+#define START_SACK 0x2      // DATA ACKs may carry a selective-ACK bitmap
+#define START_FEC 0x4       // Sender adds PARITY packets to blocks of DATA
+#define START_MTU 0x8       // DATA chunks larger than a 1500-byte MTU allows
+#define START_RESUME 0x10   // Output is checkpointed so a later run can resume it
+#define START_DELTA 0x20    // DATA is the new file's signatures (DeltaSync.h)
+#define START_COMPRESS 0x40 // DATA payloads are compressed frames (LzCodec.h)
+#define START_BATCH 0x80    // DATA carries many files, each after a header
+
+// SACK ACK (START_SACK accepted): an ordinary cumulative ACK (type 3, seqNum
+// = next expected) followed by `length` bytes of big-endian uint64_t words,
+// checksum = CRC of those bytes. Bit i of word i / 64 set means seqNum + 1 + i is
+// already held (seqNum itself is the first hole). Words past the highest
+// held packet are not sent; with nothing out of order the ACK is a plain
+// 16-byte header
+#define SACK_MAX_WORDS 16 // Covers 1024 packets above the cumulative ACK
+
+// Reject: an END from the receiver (type 1, seqNum = the connection's START /
+// END seqNum, length 0) says it gave up on the connection, whose data it
+// could not deliver. It answers whatever else the sender sends for that
+// connection the same way until it forgets it, and never ACKs its END, so
+// the sender fails instead of retrying or reporting success
+
+// PARITY packet (type 4, START_FEC accepted): seqNum is the first DATA
+// seqNum of the block it protects; length / checksum cover the payload, a
+// FecInfo followed by one coded symbol (FecCodec.h). Symbols are a chunk's
+// 2-byte big-endian length followed by its data zero-padded to the FEC
+// chunk size, so a rebuilt chunk comes back with its length
+struct FecInfo
+{
+    uint16_t data_count;  // DATA packets in the block
+    uint8_t parity_index; // Code row this symbol belongs to
+    uint8_t parity_count; // PARITY packets sent for the block
+};
+
+// Optional START payload (length >= sizeof(StartInfo), checksum over all of
+// it; anything past the StartInfo is zero padding). Receivers that do not
+// know it ACK START without a payload, which tells the sender that none of
+// the features were accepted.
+// A sender probing a larger MTU pads START to the full packet size: an ACK
+// proves the path carries packets that big, and a receiver whose buffers
+// are smaller sees it truncated and stays silent
+struct StartInfo
+{
+    uint32_t flags;
+    uint32_t transfer_id;  // Shared by every stream of one transfer (and run,
+                           // with START_RESUME)
+    uint32_t stream_index; // START_RANGE: which stream this is
+    uint32_t stream_count; // START_RANGE: how many streams make up the file
+    uint64_t offset;       // START_RANGE: file offset of this stream's data
+    uint64_t file_size;    // START_RANGE, START_RESUME: size of the whole file
+    uint32_t max_chunk;    // START_MTU: DATA payload bytes; the ACK's is final
+    uint32_t reserved;
+};
+
+// Resumable transfers (START_RESUME). The receiver names the output after
+// transfer_id and checkpoints it in RESUME_UNIT_BYTES ranges of the file,
+// each with its CRC.
+// A START_RESUME without START_RANGE asks what the receiver already has from
+// `offset` on: its ACK is the StartInfo followed by up to RESUME_MAX_RUNS
+// ResumeRuns (length and checksum cover both), runs of complete ranges it
+// has re-read and verified against their CRCs. A full ACK may not be the
+// end; the sender asks again from where its last run ends. It re-checks
+// each run against its own file and then sends everything else as
+// START_RANGE | START_RESUME streams starting on range boundaries
+#define RESUME_UNIT_BYTES (1 << 20)
+#define RESUME_MAX_RUNS 56 // An ACK with every run still fits a 1500-byte MTU
+
+struct ResumeRun
+{
+    uint64_t offset;   // Multiple of RESUME_UNIT_BYTES
+    uint64_t length;   // Whole ranges; the last may end at file_size
+    uint32_t checksum; // CRC32 of those bytes
+    uint32_t reserved;
+};
+
+// Delta transfers (START_DELTA, DeltaSync.h). Before a resumable transfer,
+// a session with START_DELTA (and no START_RANGE) names, in a DeltaInfo
+// after its StartInfo, an old copy of the file in the receiver's output
+// directory. Its DATA is one DeltaSignature per RESUME_UNIT_BYTES block of
+// the new file. On END the receiver copies every block it finds in the old
+// copy into the transfer's output and marks its range done, so the resume
+// query that follows reports it and the sender skips it
+#define DELTA_MAX_NAME 64
+
+struct DeltaInfo
+{
+    char basis[DELTA_MAX_NAME]; // NUL-terminated file name, no directories
+};
+
+struct DeltaSignature
+{
+    uint32_t weak;      // CRC32 of the block
+    uint32_t reserved;
+    uint64_t strong[2]; // MurmurHash3 x64-128 of the block
+};
+
+// Compressed DATA (START_COMPRESS). Every DATA payload is a CompressInfo
+// followed by a frame that decodes on its own to raw_length bytes of the
+// file, which follow on from the previous packet's. Packets still fill the
+// negotiated chunk size, so each one carries as much of the file as it
+// compresses to; at most COMPRESS_MAX_RATIO chunks' worth, which bounds the
+// receiver's decode buffers. FEC, SACK and retransmissions see only the
+// payloads as sent
+#define COMPRESS_STORED 0 // Frame is the raw bytes
+#define COMPRESS_LZ 1     // Frame is an LZ block (LzCodec.h)
+#define COMPRESS_MAX_RATIO 8
+
+struct CompressInfo
+{
+    uint16_t method;     // COMPRESS_STORED or COMPRESS_LZ
+    uint16_t reserved;
+    uint32_t raw_length; // File bytes the frame decodes to
+};
+
+// Batch transfers (START_BATCH, never with START_RANGE, START_RESUME,
+// START_DELTA or START_COMPRESS). One session carries many files back to
+// back in a single seqNum space, so the window stays full across file
+// boundaries. Each file starts with a header DATA packet, a BatchFileInfo
+// followed by name_length bytes of the file's name, and then `chunks` DATA
+// packets of its contents; the next file's header follows directly. The
+// receiver writes each file to its own FILE-i.out and lists the FILE-i.out
+// names with the original ones in BATCH-<transfer_id>.txt
+#define BATCH_MAX_NAME 1024
+
+struct BatchFileInfo
+{
+    uint32_t index;       // Position of the file in the batch, from 0
+    uint32_t chunks;      // DATA packets of contents that follow this one
+    uint64_t size;        // Bytes of contents
+    uint16_t name_length; // Name bytes after the BatchFileInfo
+    uint16_t reserved[3];
+};
+
 #endif
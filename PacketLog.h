@@ -0,0 +1,297 @@
+#ifndef __PACKET_LOG_H__
+#define __PACKET_LOG_H__
+
+#include "PacketHeader.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Ring capacity in records (power of two) and how much formatted text is
+// gathered before one write()
+#define LOG_RING_RECORDS (1 << 14)
+#define LOG_WRITE_BYTES (256 * 1024)
+// How long the writer thread sleeps once it has drained every ring
+#define LOG_IDLE_SLEEP_US 1000
+
+// Record type used for "# srtt <us> rttvar <us> rto <us>" lines; the three
+// values travel in seqNum / length / checksum
+#define LOG_RTT_RECORD 0xFFFFFFFFu
+
+// Binary logs start with this 8-byte magic followed by packed LogRecords
+#define LOG_BINARY_MAGIC "WTPLOG1"
+
+// One logged packet; the timestamp is microseconds since the Unix epoch
+struct LogRecord
+{
+    uint32_t type;
+    uint32_t seqNum;
+    uint32_t length;
+    uint32_t checksum;
+    uint64_t timestamp_us;
+};
+
+class PacketLog;
+
+// The one background thread that drains every open PacketLog in the process,
+// so a sender driving hundreds of sessions still has a single writer
+class LogWriter
+{
+public:
+    static LogWriter &instance()
+    {
+        static LogWriter writer;
+        return writer;
+    }
+
+    void add(PacketLog *log);
+    void remove(PacketLog *log);
+
+private:
+    LogWriter() : stop(false) {}
+    ~LogWriter();
+    void run();
+
+    std::mutex mutex; // Guards logs; held while any of them is drained
+    std::vector<PacketLog *> logs;
+    std::thread thread;
+    bool stop;
+};
+
+// Asynchronous packet log for senders and receivers.
+//   The thread that sends and receives packets only copies a LogRecord into
+//   a lock-free single-producer ring; the shared LogWriter thread drains it
+//   and writes the file in large write() calls, so no formatting or flushing
+//   happens on the packet path. Each log has exactly one producer thread.
+//   Text logs hold "<type> <seqNum> <length> <checksum>" per line. Binary logs
+//   (binary == true) hold the raw records including timestamps and are turned
+//   back into text by tools/wtp_logcat.
+//   The writer drains whenever a ring is non-empty and flushes before it
+//   sleeps, so a killed receiver loses at most the last millisecond.
+class PacketLog
+{
+public:
+    PacketLog() : fd(-1), binary(false), ring(LOG_RING_RECORDS), head(0), tail(0)
+    {
+    }
+
+    PacketLog(const std::string &path, bool binary) : PacketLog()
+    {
+        open(path, binary);
+    }
+
+    ~PacketLog() { close(); }
+
+    // MODIFIES: *this
+    // EFFECTS: Truncate path and hand the log to the writer thread
+    void open(const std::string &path, bool binary_format)
+    {
+        close();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("ERROR opening log " + path);
+        binary = binary_format;
+        if (binary)
+            out.append(LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC));
+        LogWriter::instance().add(this);
+    }
+
+    // REQUIRES: called from the producer thread
+    // EFFECTS: Drain everything logged so far and close the file
+    void close()
+    {
+        if (fd < 0)
+            return;
+        LogWriter::instance().remove(this);
+        ::close(fd);
+        fd = -1;
+    }
+
+    // REQUIRES: called only from the log's producer thread
+    // MODIFIES: ring
+    // EFFECTS: Record one packet header
+    void log(const PacketHeader &header)
+    {
+        push(header.type, header.seqNum, header.length, header.checksum);
+    }
+
+    // EFFECTS: Record the retransmission timer state (all in microseconds)
+    void log_rtt(uint64_t srtt, uint64_t rttvar, uint64_t rto)
+    {
+        push(LOG_RTT_RECORD, srtt, rttvar, rto);
+    }
+
+    // MODIFIES: text
+    // EFFECTS: Append the text-log line for record, optionally prefixed with
+    //          its timestamp
+    static void format(const LogRecord &record, std::string &text, bool timestamp)
+    {
+        if (timestamp)
+        {
+            append_number(text, record.timestamp_us);
+            text += ' ';
+        }
+        if (record.type == LOG_RTT_RECORD)
+        {
+            text += "# srtt ";
+            append_number(text, record.seqNum);
+            text += " rttvar ";
+            append_number(text, record.length);
+            text += " rto ";
+            append_number(text, record.checksum);
+        }
+        else
+        {
+            append_number(text, record.type);
+            text += ' ';
+            append_number(text, record.seqNum);
+            text += ' ';
+            append_number(text, record.length);
+            text += ' ';
+            append_number(text, record.checksum);
+        }
+        text += '\n';
+    }
+
+private:
+    friend class LogWriter;
+
+    void push(uint32_t type, uint32_t seqNum, uint32_t length, uint32_t checksum)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        // Full ring: the writer is behind on disk, wait for it rather than
+        // dropping records
+        while (h - tail.load(std::memory_order_acquire) == ring.size())
+            std::this_thread::yield();
+
+        LogRecord &record = ring[h & (ring.size() - 1)];
+        record.type = type;
+        record.seqNum = seqNum;
+        record.length = length;
+        record.checksum = checksum;
+        record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // REQUIRES: LogWriter::mutex is held
+    // EFFECTS: Format or copy every published record out of the ring and
+    //          write it
+    void drain()
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        for (; t != h; ++t)
+        {
+            const LogRecord &record = ring[t & (ring.size() - 1)];
+            if (binary)
+                out.append((const char *)&record, sizeof(record));
+            else
+                format(record, out, false);
+            if (out.size() >= LOG_WRITE_BYTES)
+            {
+                tail.store(t + 1, std::memory_order_release);
+                write_out();
+            }
+        }
+        tail.store(t, std::memory_order_release);
+        write_out();
+    }
+
+    void write_out()
+    {
+        size_t done = 0;
+        while (done < out.size())
+        {
+            ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                break; // Disk trouble must not stall the transfer
+            done += n;
+        }
+        out.clear();
+    }
+
+    static void append_number(std::string &text, uint64_t value)
+    {
+        char digits[20];
+        int n = 0;
+        do
+        {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        while (n > 0)
+            text += digits[--n];
+    }
+
+    int fd;
+    bool binary;
+    std::vector<LogRecord> ring;
+    std::atomic<uint64_t> head; // Next slot the producer fills
+    std::atomic<uint64_t> tail; // Next slot the writer drains
+    std::string out; // Pending bytes for the next write(); writer-only
+};
+
+inline void LogWriter::add(PacketLog *log)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    logs.push_back(log);
+    if (!thread.joinable())
+        thread = std::thread(&LogWriter::run, this);
+}
+
+// EFFECTS: Stop draining log after writing out whatever it still holds
+inline void LogWriter::remove(PacketLog *log)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    log->drain();
+    for (size_t i = 0; i < logs.size(); ++i)
+    {
+        if (logs[i] == log)
+        {
+            logs[i] = logs.back();
+            logs.pop_back();
+            break;
+        }
+    }
+}
+
+inline LogWriter::~LogWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+inline void LogWriter::run()
+{
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stop)
+                return;
+            for (size_t i = 0; i < logs.size(); ++i)
+                logs[i]->drain();
+        }
+        // Napping between passes batches records into fewer, larger writes
+        std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_SLEEP_US));
+    }
+}
+
+#endif
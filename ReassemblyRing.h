@@ -0,0 +1,388 @@
+#ifndef __REASSEMBLY_RING_H__
+#define __REASSEMBLY_RING_H__
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "LzCodec.h"
+#include "Telemetry.h"
+#include "DiskWriter.h"
+
+// Told about everything a ReassemblyRing writes, in file order, just before
+// it goes out (e.g. to checksum it on the way)
+class WriteObserver
+{
+public:
+    virtual ~WriteObserver() {}
+
+    // EFFECTS: iov[0..count) is about to be written at file offset
+    virtual void wrote(uint64_t offset, const iovec *iov, size_t count) = 0;
+};
+
+// Sends one connection's chunks to more than one file (START_BATCH): asked,
+// in seqNum order, where each delivered chunk goes
+class ChunkRouter
+{
+public:
+    virtual ~ChunkRouter() {}
+
+    enum Route
+    {
+        WRITE,    // File data: fd and offset are set
+        CONSUMED, // Taken here (a file header); ends the write it would have joined
+        FAILED    // Cannot be delivered; failed() holds and the receiver
+                  // rejects the connection, so its sender fails too
+    };
+
+    // EFFECTS: Where chunk seq (data, len) goes. A file only changes after
+    //          a CONSUMED chunk
+    virtual Route route(uint32_t seq, const char *data, size_t len, int &fd,
+                        uint64_t &offset) = 0;
+
+    // EFFECTS: Everything routed below seq is on disk
+    virtual void written(uint32_t seq) = 0;
+};
+
+// Receive-side reassembly buffer for one connection.
+//   A preallocated ring of chunk-sized slots holds every DATA packet in
+//   [next_expected, next_expected + window). Storing a packet and sliding
+//   next_expected over the slots it completes are O(1) per packet with no
+//   heap allocation.
+//   In-order data is not written per packet: the ring keeps `coalesce` extra
+//   slots so delivered chunks can wait and go to the file in one pwritev()
+//   once that many have accumulated (or on flush()). Writes are positioned,
+//   so a connection carrying one byte range of a file lands at its offset.
+//   Given a DiskWriter, those writes are asynchronous: up to `depth` of them
+//   are in flight, gathered straight from the slots, which are reused only
+//   once their write finishes (depth * coalesce more slots make room). With
+//   all of them in flight, delivering more waits for the oldest.
+//   Compressed payloads (START_COMPRESS) are kept as they arrived, for SACK
+//   and FEC, and decoded only on their way to the file. One that does not
+//   decode fails the connection (failed()): nothing more is stored or
+//   written, and the caller drops it.
+//   Given a ChunkRouter, each write goes wherever the router puts its first
+//   chunk instead of to one fd at a running offset; a chunk the router
+//   cannot place fails the connection the same way.
+class ReassemblyRing
+{
+public:
+    // REQUIRES: disk (if any) outlives the ring
+    ReassemblyRing(size_t window, size_t chunk_size, size_t coalesce,
+                   DiskWriter *disk = NULL, size_t depth = 1)
+        : window(window), chunk_sz(chunk_size), coalesce(coalesce ? coalesce : 1),
+          slots(window + this->coalesce * (disk ? std::max<size_t>(depth, 1) + 1 : 1)),
+          buf(slots * chunk_sz), slot_seq(slots, 0), slot_len(slots, 0),
+          filled(slots, false), disk(disk), writes(disk ? std::max<size_t>(depth, 1) : 1),
+          write_head(0), write_count(0), fd(-1), next(0), top(0), submitted(0), written(0),
+          file_offset(0), observer(NULL), router(NULL), raw_limit(0), broken(false),
+          bytes_out(NULL), write_time(NULL)
+    {
+        // Synchronous writes may take everything delivered at once
+        max_batch = std::min<size_t>(disk ? this->coalesce : slots, IOV_MAX);
+        for (size_t w = 0; w < writes.size(); ++w)
+            writes[w].iov.resize(max_batch);
+    }
+
+    ~ReassemblyRing() { drain(); }
+
+    // REQUIRES: bytes and write_us outlive the ring, or are NULL
+    // MODIFIES: *this
+    // EFFECTS: Count bytes written to the file in bytes and time each
+    //          write, from submission to completion, into write_us
+    //          (microseconds)
+    void set_stats(Counter *bytes, Histogram *write_us)
+    {
+        bytes_out = bytes;
+        write_time = write_us;
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Start a new connection expecting first_seq, whose data is
+    //          written to fd starting at byte offset and shown to watcher
+    //          (if any) first. decode_limit > 0 means payloads are
+    //          compressed, each to at most that many bytes. A chunk_router
+    //          (if any) places every chunk instead of fd and offset
+    void reset(int out_fd, uint32_t first_seq, uint64_t offset = 0,
+               WriteObserver *watcher = NULL, size_t decode_limit = 0,
+               ChunkRouter *chunk_router = NULL)
+    {
+        drain();
+        std::fill(filled.begin(), filled.end(), false);
+        fd = out_fd;
+        next = top = submitted = written = first_seq;
+        file_offset = offset;
+        observer = watcher;
+        router = chunk_router;
+        raw_limit = decode_limit;
+        broken = false;
+        for (size_t w = 0; w < writes.size(); ++w)
+            writes[w].decoded.resize(std::min(coalesce, max_batch) * raw_limit);
+    }
+
+    // Cumulative ACK value: the next in-order seqNum not yet received
+    uint32_t next_expected() const { return next; }
+
+    // True once delivered data could not be decoded or routed; the
+    // connection is lost
+    bool failed() const { return broken; }
+
+    // REQUIRES: len <= chunk size
+    // MODIFIES: *this
+    // EFFECTS: Buffer a DATA packet if it falls inside the window and is not
+    //          a duplicate, then deliver any run it completes. Returns false
+    //          if the packet was dropped (always, once failed())
+    bool store(uint32_t seq, const char *data, size_t len)
+    {
+        if (broken || seq < next || seq >= next + window)
+            return false;
+
+        size_t slot = seq % slots;
+        if (filled[slot] && slot_seq[slot] == seq)
+            return false;
+
+        memcpy(&buf[slot * chunk_sz], data, len);
+        slot_seq[slot] = seq;
+        slot_len[slot] = len;
+        filled[slot] = true;
+        top = std::max(top, seq + 1);
+
+        while (filled[next % slots] && slot_seq[next % slots] == next)
+            ++next;
+        if (next - submitted >= coalesce)
+            push();
+        return true;
+    }
+
+    // EFFECTS: The bytes buffered for seq, or NULL if it never arrived or
+    //          its slot was reused. Delivered chunks stay readable until then
+    const char *held(uint32_t seq, size_t &len) const
+    {
+        size_t slot = seq % slots;
+        if (slot_seq[slot] != seq || !(filled[slot] || seq < next))
+            return NULL;
+        len = slot_len[slot];
+        return &buf[slot * chunk_sz];
+    }
+
+    // REQUIRES: words has room for max_words
+    // MODIFIES: words
+    // EFFECTS: Selective-ACK bitmap of what is buffered past the first hole:
+    //          bit i of words[i / 64] is set if next_expected() + 1 + i is
+    //          held. Returns how many words reach the highest held packet,
+    //          0 when nothing is out of order
+    size_t sack_bitmap(uint64_t *words, size_t max_words) const
+    {
+        if (top <= next + 1)
+            return 0;
+        size_t count = std::min<size_t>(max_words, (top - next - 2) / 64 + 1);
+        std::fill(words, words + count, 0);
+        uint32_t end = std::min<uint64_t>(top, next + 1 + count * 64);
+        for (uint32_t seq = next + 1; seq < end; ++seq)
+        {
+            size_t slot = seq % slots;
+            if (filled[slot] && slot_seq[slot] == seq)
+            {
+                uint32_t bit = seq - next - 1;
+                words[bit / 64] |= (uint64_t)1 << (bit % 64);
+            }
+        }
+        return count;
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Start writing every delivered chunk to the output file,
+    //          decoded first if the connection is compressed, without
+    //          waiting for the writes (unless all `depth` are in flight).
+    //          A payload that does not decode or route stops delivery for
+    //          good (failed()); throws on a failed write
+    void push()
+    {
+        // Compressed chunks decode into a buffer for up to `coalesce` of them
+        size_t batch = raw_limit ? std::min(coalesce, max_batch) : max_batch;
+        retire();
+        while (submitted < next && !broken)
+        {
+            if (write_count == writes.size())
+            {
+                disk->reap(true); // Every write is in flight: wait for one
+                retire();
+                continue;
+            }
+
+            PendingWrite &w = writes[(write_head + write_count) % writes.size()];
+            size_t count = 0;
+            size_t bytes = 0;
+            uint32_t seq = submitted;
+            int out_fd = fd;
+            uint64_t offset = file_offset;
+            while (seq < next && count < batch)
+            {
+                size_t slot = seq % slots;
+                char *data = &buf[slot * chunk_sz];
+                size_t len = slot_len[slot];
+                if (raw_limit)
+                {
+                    char *out = &w.decoded[count * raw_limit];
+                    if (!decompress_payload(data, len, out, raw_limit, len))
+                    {
+                        broken = true; // What came before it is still written
+                        break;
+                    }
+                    data = out;
+                }
+                ++seq;
+                if (router)
+                {
+                    int to;
+                    uint64_t at;
+                    ChunkRouter::Route route = router->route(seq - 1, data, len, to, at);
+                    if (route == ChunkRouter::FAILED)
+                    {
+                        broken = true;
+                        break;
+                    }
+                    if (route == ChunkRouter::CONSUMED)
+                    {
+                        if (count > 0)
+                            break; // The next chunk starts another file
+                        continue;
+                    }
+                    if (count == 0)
+                    {
+                        out_fd = to;
+                        offset = at;
+                    }
+                }
+                w.iov[count].iov_base = data;
+                w.iov[count].iov_len = len;
+                bytes += len;
+                ++count;
+            }
+
+            if (observer)
+                observer->wrote(offset, &w.iov[0], count);
+            w.io = DiskWrite{out_fd, &w.iov[0], count, offset, bytes, count == 0, 0};
+            w.end = seq;
+            if (write_time)
+                w.start = std::chrono::steady_clock::now();
+            ++write_count;
+            submitted = seq;
+            file_offset = offset + bytes;
+            if (count == 0)
+                retire(); // Nothing but file headers: no write to wait for
+            else if (disk)
+                disk->submit(&w.io);
+            else
+            {
+                if (!write_fully(w.io.fd, w.io.iov, count, w.io.offset, bytes))
+                    w.io.error = errno;
+                w.io.done = true;
+                retire();
+            }
+        }
+    }
+
+    // MODIFIES: *this
+    // EFFECTS: Write every delivered chunk to the output file and wait until
+    //          all of it is there; throws like push()
+    void flush()
+    {
+        push();
+        while (write_count > 0)
+        {
+            disk->reap(true);
+            retire();
+        }
+    }
+
+private:
+    // One write of delivered chunks, in flight from push() until retired
+    struct PendingWrite
+    {
+        DiskWrite io;
+        std::vector<iovec> iov;
+        std::vector<char> decoded; // Decoded chunks it gathers from
+        uint32_t end;              // One past its last seqNum
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // MODIFIES: *this
+    // EFFECTS: Free the slots of finished writes, oldest first, so slots
+    //          are only reused in order; throws if a write failed
+    void retire()
+    {
+        while (write_count > 0 && writes[write_head].io.done)
+        {
+            PendingWrite &w = writes[write_head];
+            if (w.io.error)
+                throw std::runtime_error("ERROR writing output file");
+            if (bytes_out)
+                bytes_out->add(w.io.bytes);
+            if (write_time)
+                write_time->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                       std::chrono::steady_clock::now() - w.start).count());
+            for (; written < w.end; ++written)
+                filled[written % slots] = false;
+            write_head = (write_head + 1) % writes.size();
+            --write_count;
+            if (router)
+                router->written(written);
+        }
+    }
+
+    // EFFECTS: Wait out every write in flight, errors and all, before the
+    //          slots it reads from go away
+    void drain()
+    {
+        while (write_count > 0)
+        {
+            if (!writes[write_head].io.done)
+            {
+                disk->reap(true);
+                continue;
+            }
+            written = writes[write_head].end;
+            write_head = (write_head + 1) % writes.size();
+            --write_count;
+        }
+    }
+
+    size_t window;
+    size_t chunk_sz;
+    size_t coalesce;
+    size_t slots;
+
+    std::vector<char> buf;
+    std::vector<uint32_t> slot_seq;
+    std::vector<uint32_t> slot_len;
+    std::vector<bool> filled;
+
+    DiskWriter *disk; // NULL: write inline
+    std::vector<PendingWrite> writes; // Circular, oldest at write_head
+    size_t write_head;
+    size_t write_count;
+    size_t max_batch; // Chunks per write
+
+    int fd;
+    uint32_t next;      // Next in-order seqNum expected
+    uint32_t top;       // One past the highest seqNum stored
+    uint32_t submitted; // Everything below this has been handed to a write
+    uint32_t written;   // Everything below this is on disk
+    uint64_t file_offset; // Where chunk #submitted goes in the file
+    WriteObserver *observer;
+    ChunkRouter *router;
+    size_t raw_limit;   // Decoded size bound; 0 = not compressed
+    bool broken;        // A payload failed to decode or route; see failed()
+    Counter *bytes_out; // Telemetry, if set_stats() was called
+    Histogram *write_time;
+};
+
+#endif
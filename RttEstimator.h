@@ -0,0 +1,82 @@
+#ifndef __RTT_ESTIMATOR_H__
+#define __RTT_ESTIMATOR_H__
+
+#include "PacketLog.h"
+
+#include <chrono>
+#include <algorithm>
+
+// Retransmission timeout estimator (RFC 6298)
+//   SRTT   <- 7/8 SRTT + 1/8 R
+//   RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R|
+//   RTO    <- SRTT + max(G, 4 RTTVAR), clamped to [min_rto, max_rto]
+// Callers apply Karn's algorithm: only packets that were sent exactly once
+// may be passed to sample(), and backoff() doubles the RTO on a timeout
+// until the next valid sample arrives
+class RttEstimator
+{
+public:
+    typedef std::chrono::microseconds usec;
+
+    RttEstimator(usec initial_rto, usec min_rto, usec max_rto)
+        : min_rto(min_rto), max_rto(max_rto), srtt(0), rttvar(0),
+          rto(clamp(initial_rto)), logged_rto(0), have_sample(false)
+    {
+    }
+
+    // EFFECTS: Fold one RTT measurement into SRTT/RTTVAR and recompute RTO
+    void sample(usec rtt)
+    {
+        if (!have_sample)
+        {
+            srtt = rtt;
+            rttvar = rtt / 2;
+            have_sample = true;
+        }
+        else
+        {
+            usec err = srtt > rtt ? srtt - rtt : rtt - srtt;
+            rttvar = (rttvar * 3 + err) / 4;
+            srtt = (srtt * 7 + rtt) / 8;
+        }
+        rto = clamp(srtt + std::max(granularity(), rttvar * 4));
+    }
+
+    // EFFECTS: Exponential backoff after a retransmission timeout
+    void backoff() { rto = clamp(rto * 2); }
+
+    // EFFECTS: Add a "# srtt <us> rttvar <us> rto <us>" line to a sender log
+    //          when the RTO has moved by more than 1/8 since the last such line
+    void log_if_moved(PacketLog &log)
+    {
+        usec diff = rto > logged_rto ? rto - logged_rto : logged_rto - rto;
+        if (diff * 8 <= logged_rto)
+            return;
+
+        logged_rto = rto;
+        log.log_rtt(srtt.count(), rttvar.count(), rto.count());
+    }
+
+    usec current_rto() const { return rto; }
+    usec current_srtt() const { return srtt; }
+    usec current_rttvar() const { return rttvar; }
+
+private:
+    // Timers are armed with millisecond poll() timeouts
+    static usec granularity() { return usec(1000); }
+
+    usec clamp(usec value) const
+    {
+        return std::min(max_rto, std::max(min_rto, value));
+    }
+
+    usec min_rto;
+    usec max_rto;
+    usec srtt;
+    usec rttvar;
+    usec rto;
+    usec logged_rto;
+    bool have_sample;
+};
+
+#endif
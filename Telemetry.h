@@ -0,0 +1,345 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Histogram buckets split every power of two into 2^HISTOGRAM_SUB_BITS, so
+// a value is placed within 1/16 of itself; values (microseconds) are
+// clamped below 2^HISTOGRAM_MAX_BITS, a little over an hour
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+// Live metrics for senders and receivers.
+//   Every Counter and Histogram has exactly one writer, the thread that runs
+//   the session or worker it belongs to, so an update is a relaxed load and
+//   store of a word that thread owns: no locked instruction, no fence, no
+//   cache line shared with another writer. A StatsServer thread reads them
+//   at any time; each value it reads is whole and recent, though a snapshot
+//   is not atomic across values.
+
+class Counter
+{
+public:
+    explicit Counter(uint64_t initial = 0) : value(initial) {}
+
+    void add(uint64_t n = 1)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+// Log-linear histogram in the style of HdrHistogram: values below
+// 2^HISTOGRAM_SUB_BITS have a bucket each, larger ones share a bucket with
+// the values that agree with them in their top HISTOGRAM_SUB_BITS + 1 bits
+class Histogram
+{
+public:
+    Histogram() : buckets(HISTOGRAM_BUCKETS), min(UINT64_MAX) {}
+
+    void record(uint64_t value)
+    {
+        buckets[index(value)].add();
+        sum.add(value);
+        if (value > max.get())
+            max.set(value);
+        if (value < min.get())
+            min.set(value);
+    }
+
+    // EFFECTS: {"count", "min", "mean", "p50", "p90", "p99", "p999", "max"}
+    //          as a JSON object; percentiles are the top of their bucket
+    std::string json() const
+    {
+        // The mean divides by the buckets' own total, never a second count;
+        // record() fills the bucket before the sum, which is read first
+        uint64_t sum_snap = sum.get();
+        std::vector<uint64_t> snap(buckets.size());
+        uint64_t total = 0;
+        for (size_t i = 0; i < snap.size(); ++i)
+            total += snap[i] = buckets[i].get();
+
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        static const char *names[] = {"p50", "p90", "p99", "p999"};
+        std::ostringstream out;
+        uint64_t low = total ? min.get() : 0, high = total ? max.get() : 0;
+        out << "{\"count\":" << total << ",\"min\":" << low << ",\"mean\":"
+            << (total ? sum_snap / total : 0);
+        size_t i = 0;
+        uint64_t seen = 0;
+        for (int q = 0; q < 4; ++q)
+        {
+            uint64_t rank = total * quantiles[q];
+            while (i < snap.size() && seen + snap[i] <= rank)
+                seen += snap[i++];
+            uint64_t value = i < snap.size() ? std::min(upper(i), high) : high;
+            out << ",\"" << names[q] << "\":" << std::max(value, low);
+        }
+        out << ",\"max\":" << high << "}";
+        return out.str();
+    }
+
+private:
+    static size_t index(uint64_t value)
+    {
+        value = std::min<uint64_t>(value, ((uint64_t)1 << HISTOGRAM_MAX_BITS) - 1);
+        if (value < (1u << HISTOGRAM_SUB_BITS))
+            return value;
+        int top = 63 - __builtin_clzll(value); // >= HISTOGRAM_SUB_BITS
+        int shift = top - HISTOGRAM_SUB_BITS;
+        return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+               ((value >> shift) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+    }
+
+    // EFFECTS: Largest value that lands in bucket i
+    static uint64_t upper(size_t i)
+    {
+        size_t group = i >> HISTOGRAM_SUB_BITS;
+        uint64_t sub = i & ((1u << HISTOGRAM_SUB_BITS) - 1);
+        if (group == 0)
+            return sub;
+        return (((1u << HISTOGRAM_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+    }
+
+    std::vector<Counter> buckets;
+    Counter sum;
+    Counter max;
+    Counter min;
+};
+
+// Builds one JSON object, field by field
+class JsonObject
+{
+public:
+    JsonObject() : first(true) { out << '{'; }
+
+    JsonObject &count(const char *name, uint64_t value)
+    {
+        key(name) << value;
+        return *this;
+    }
+
+    JsonObject &number(const char *name, double value)
+    {
+        key(name) << value;
+        return *this;
+    }
+
+    JsonObject &text(const char *name, const std::string &value)
+    {
+        std::ostream &o = key(name);
+        o << '"';
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            unsigned char c = value[i];
+            if (c == '"' || c == '\\')
+                o << '\\' << c;
+            else if (c < 0x20)
+            {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                o << esc;
+            }
+            else
+                o << c;
+        }
+        o << '"';
+        return *this;
+    }
+
+    // REQUIRES: json is a JSON value
+    JsonObject &raw(const char *name, const std::string &json)
+    {
+        key(name) << json;
+        return *this;
+    }
+
+    std::string str() const { return out.str() + '}'; }
+
+private:
+    std::ostream &key(const char *name)
+    {
+        if (!first)
+            out << ',';
+        first = false;
+        return out << '"' << name << "\":";
+    }
+
+    std::ostringstream out;
+    bool first;
+};
+
+// Every Stats object a process has created, for the StatsServer to list.
+// Entries are added at setup and never dropped, so finished sessions still
+// show in the totals; only add() and list() take the lock
+template <class Stats>
+class StatsRegistry
+{
+public:
+    std::shared_ptr<Stats> add(Stats *stats)
+    {
+        std::shared_ptr<Stats> entry(stats);
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(entry);
+        return entry;
+    }
+
+    std::vector<std::shared_ptr<Stats> > list() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::shared_ptr<Stats> > entries;
+};
+
+// Serves snapshot() from a thread of its own, so the threads moving packets
+// never wait on it:
+//   to every client that connects to the Unix socket at socket_path (e.g.
+//   `tools/wtp_stats PATH`), one JSON document and a newline, and
+//   every interval_ms, and once more on shutdown, one line appended to
+//   dump_path (JSON Lines).
+// Either may be left out: an empty socket_path or an interval of 0
+class StatsServer
+{
+public:
+    StatsServer(const std::string &socket_path, const std::string &dump_path,
+                long interval_ms, std::function<std::string()> snapshot)
+        : socket_path(socket_path), interval(interval_ms), snapshot(snapshot),
+          listen_fd(-1), dump_fd(-1)
+    {
+        if (pipe2(wake, O_CLOEXEC) != 0)
+            throw std::runtime_error("ERROR creating stats pipe");
+        if (interval.count() > 0)
+        {
+            dump_fd = open(dump_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (dump_fd < 0)
+                throw std::runtime_error("ERROR opening stats file " + dump_path);
+        }
+        if (!socket_path.empty())
+        {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (socket_path.size() >= sizeof(addr.sun_path))
+                throw std::runtime_error("ERROR stats socket path too long");
+            memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+            unlink(socket_path.c_str()); // Left behind by an earlier run
+            listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (listen_fd < 0 || bind(listen_fd, (const sockaddr *)&addr, sizeof(addr)) != 0 ||
+                listen(listen_fd, 8) != 0)
+                throw std::runtime_error("ERROR binding stats socket " + socket_path);
+        }
+        thread = std::thread(&StatsServer::run, this);
+    }
+
+    ~StatsServer()
+    {
+        char byte = 0;
+        if (write(wake[1], &byte, 1) < 0)
+            perror("stats");
+        thread.join();
+        if (dump_fd >= 0)
+        {
+            dump();
+            close(dump_fd);
+        }
+        if (listen_fd >= 0)
+        {
+            close(listen_fd);
+            unlink(socket_path.c_str());
+        }
+        close(wake[0]);
+        close(wake[1]);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void run()
+    {
+        Clock::time_point next_dump = Clock::now() + interval;
+        while (true)
+        {
+            int timeout = -1;
+            if (dump_fd >= 0)
+                timeout = std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                next_dump - Clock::now()).count());
+            pollfd fds[2] = {{wake[0], POLLIN, 0}, {listen_fd, POLLIN, 0}};
+            int ready = poll(fds, listen_fd >= 0 ? 2 : 1, timeout);
+            if (ready < 0 && errno != EINTR)
+                return;
+            if (fds[0].revents)
+                return;
+            if (listen_fd >= 0 && (fds[1].revents & POLLIN))
+            {
+                int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (client >= 0)
+                {
+                    send_all(client, snapshot() + "\n", true);
+                    close(client);
+                }
+            }
+            if (dump_fd >= 0 && Clock::now() >= next_dump)
+            {
+                dump();
+                next_dump += interval;
+            }
+        }
+    }
+
+    void dump() { send_all(dump_fd, snapshot() + "\n", false); }
+
+    // EFFECTS: Write all of text to fd, a client socket or the dump file;
+    //          give up quietly on error (a client that hung up, a full disk).
+    //          A client that hung up raises no SIGPIPE
+    static void send_all(int fd, const std::string &text, bool client)
+    {
+        for (size_t done = 0; done < text.size();)
+        {
+            const char *at = text.data() + done;
+            ssize_t n = client ? send(fd, at, text.size() - done, MSG_NOSIGNAL)
+                               : write(fd, at, text.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            done += n;
+        }
+    }
+
+    std::string socket_path;
+    std::chrono::milliseconds interval;
+    std::function<std::string()> snapshot;
+    int listen_fd;
+    int dump_fd;
+    int wake[2]; // Written once to stop the thread
+    std::thread thread;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <map>
 #include <chrono>
 #include "PacketHeader.h"
+#include "PacketCodec.h"
 #include <sys/select.h>
 
 // ... [Other includes and initializations]
@@ -41,15 +42,15 @@ int main()
             size_t packet_size = sizeof(header) + data_size;
             std::vector<char> send_packet(packet_size);
 
-            // Copy header and data into send_packet
-            memcpy(send_packet.data(), &header, sizeof(header));
+            // Encode header and copy data into send_packet
+            encode_header(header, send_packet.data());
             memcpy(send_packet.data() + sizeof(header), chunks.front().data(), data_size);
 
             // Calculate checksum
             header.checksum = crc32(send_packet.data(), packet_size);
 
             // Update header with checksum in send_packet
-            memcpy(send_packet.data(), &header, sizeof(header));
+            encode_header(header, send_packet.data());
 
             // Send packet
             ssize_t sent_bytes = sendto(sockfd, send_packet.data(), packet_size, 0, (struct sockaddr *)&recv_addr, sizeof(recv_addr));
@@ -84,12 +85,12 @@ int main()
         {
             // Receive ACK
             ssize_t recv_bytes = recvfrom(sockfd, recv_packet, sizeof(recv_packet), 0, NULL, NULL);
-            if (recv_bytes > 0)
+            if (recv_bytes >= (ssize_t)sizeof(PacketHeader))
             {
-                PacketHeader *ack_header = reinterpret_cast<PacketHeader *>(recv_packet);
-                if (ack_header->type == 3) // ACK type
+                PacketHeader ack_header = decode_header(recv_packet);
+                if (ack_header.type == 3) // ACK type
                 {
-                    uint32_t ack_seqNum = ack_header->seqNum;
+                    uint32_t ack_seqNum = ack_header.seqNum;
                     // Remove acknowledged packet
                     outstanding_packets.erase(ack_seqNum);
                 }
@@ -109,8 +110,8 @@ int main()
                 size_t packet_size = sizeof(packetData.header) + data_size;
                 std::vector<char> resend_packet(packet_size);
 
-                // Copy header and data into resend_packet
-                memcpy(resend_packet.data(), &packetData.header, sizeof(packetData.header));
+                // Encode header and copy data into resend_packet
+                encode_header(packetData.header, resend_packet.data());
                 memcpy(resend_packet.data() + sizeof(packetData.header), packetData.data.data(), data_size);
 
                 // Send packet
@@ -1,38 +1,179 @@
 #include "wReceiver.h"
 
-wReceiver::wReceiver()
+// REQUIRES: None
+// MODIFIES: receiver_log
+// EFFECTS: Write one packet header to the receiver log
+void wReceiver::log_packet(const PacketHeader &header)
 {
+    receiver_log.log(header);
 }
 
-int main(int argc, char *argv[])
+static bool same_peer(const sockaddr_in &a, const sockaddr_in &b)
 {
-    int sockfd;
-    char buffer[1024];
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    int n;
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+// REQUIRES: None
+// MODIFIES: io, receiver_log
+// EFFECTS: Queue an ACK carrying seqNum; it leaves with the batch's flush
+void wReceiver::send_ack(uint32_t seqNum, const sockaddr_in &to)
+{
+    PacketHeader ack{PACKET_ACK, seqNum, 0, 0};
+    char wire[sizeof(PacketHeader)];
+    encode_header(ack, wire);
+    io->queue(wire, sizeof(wire), NULL, 0, to);
+    log_packet(ack);
+}
+
+// REQUIRES: header.type == 0
+// MODIFIES: connection state, file_count
+// EFFECTS: Open FILE-i.out for a new connection and ACK the START. A START
+//          from anyone else while connected is ignored
+void wReceiver::handle_start(const PacketHeader &header, const sockaddr_in &from)
+{
+    if (connected)
+    {
+        // Our ACK was lost; repeat it so the sender can begin
+        if (same_peer(from, peer) && header.seqNum == start_seq)
+            send_ack(header.seqNum, from);
+        return;
+    }
+
+    string path = output_dir + "/FILE-" + std::to_string(file_count) + ".out";
+    out_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check_error(out_fd);
+
+    connected = true;
+    peer = from;
+    start_seq = header.seqNum;
+    ring.reset(out_fd, 1); // DATA seqNums begin at 1
+    send_ack(header.seqNum, from);
+}
+
+// REQUIRES: header.type == 1
+// MODIFIES: connection state, file_count
+// EFFECTS: Flush and close the current file, then ACK the END. A repeated END
+//          for the connection that just finished is ACKed again
+void wReceiver::handle_end(const PacketHeader &header, const sockaddr_in &from)
+{
+    if (!same_peer(from, peer))
+        return;
+
+    if (connected)
+    {
+        ring.flush();
+        close(out_fd);
+        out_fd = -1;
+        connected = false;
+        ++file_count;
+    }
+    send_ack(header.seqNum, from);
+}
+
+// REQUIRES: header.type == 2, checksum already validated
+// MODIFIES: ring
+// EFFECTS: Buffer the chunk if it is in the window and ACK cumulatively
+void wReceiver::handle_data(const PacketHeader &header, const char *payload)
+{
+    ring.store(header.seqNum, payload, header.length);
+    send_ack(ring.next_expected(), peer);
+}
 
-    // Create socket
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+// REQUIRES: None
+// MODIFIES: connection state
+// EFFECTS: Validate a datagram and dispatch it by packet type
+void wReceiver::handle_packet(const char *packet, size_t len, const sockaddr_in &from)
+{
+    if (len < sizeof(PacketHeader))
+        return;
+
+    PacketHeader header = decode_header(packet);
+    log_packet(header);
+
+    // 1c) Drop anything truncated or corrupted
+    HeaderLimits limits = {FILE_CHUNK_SIZE, (uint32_t)ACK_MAX_PAYLOAD};
+    if (!header_valid(header, len, limits))
+        return;
+
+    if (header.type == 0)
+        handle_start(header, from);
+    else if (header.type == 1)
+        handle_end(header, from);
+    else if (header.type == 2 && connected && same_peer(from, peer))
+    {
+        const char *payload = packet + sizeof(PacketHeader);
+        if (crc32(payload, header.length) != header.checksum)
+            return;
+        handle_data(header, payload);
+    }
+}
+
+// REQUIRES: argc >= 5
+// MODIFIES: None
+// EFFECTS: Driver for wReceiver functionality
+wReceiver::wReceiver(char *argv[], const CliOptions &options)
+    : output_dir(argv[3]), io(NULL),
+      ring(std::stoul(argv[2]), FILE_CHUNK_SIZE, WRITE_COALESCE_CHUNKS),
+      connected(false), start_seq(0), out_fd(-1), file_count(0)
+{
+    memset(&peer, 0, sizeof(peer));
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     check_error(sockfd);
 
+    // Leave room for whole windows arriving back-to-back
+    int rcvbuf = SOCKET_BUFFER_BYTES;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
     // Bind to port
+    struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(8888);
-    check_error(bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0);
+    server_addr.sin_port = htons(std::stoi(argv[1]));
+    check_error(bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)));
+
+    receiver_log.open(argv[4], options.has("binary-log"));
+    BatchIO batch_io(sockfd, options.get_long("batch", DEFAULT_BATCH_SIZE),
+                     MAX_SEND_DATA, !options.has("no-mmsg"));
+    io = &batch_io;
+
+    // Serve connections one after another until killed
+    while (true)
+    {
+        pollfd pfd = {sockfd, POLLIN, 0};
+        if (poll(&pfd, 1, IDLE_FLUSH_MS) <= 0)
+        {
+            // Quiet link: push partially coalesced data out
+            if (connected)
+                ring.flush();
+            continue;
+        }
+
+        size_t n;
+        while ((n = io->receive()) > 0)
+        {
+            for (size_t i = 0; i < n; ++i)
+                handle_packet(io->packet(i), io->length(i), io->source(i));
+            io->flush();
+            if (n < io->batch_size())
+                break; // Socket drained
+        }
+    }
+}
 
-    // NOW WE START TO RECEIVE AND SHIT
-    // Receive data
-    n = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &addr_len);
-    buffer[n] = '\0';
-    printf("Client: %s\n", buffer);
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        std::cout << "Invalid Input.\nUsage: ./wReceiver "
+                  << "<port-num> <window-size> <output-dir> <log>"
+                  << " [--batch=N] [--no-mmsg] [--binary-log]" << std::endl;
+        exit(1);
+    }
 
-    // Send response
-    const char *message = "Hello from server";
-    sendto(sockfd, message, strlen(message), 0, (struct sockaddr *)&client_addr, addr_len);
+    CliOptions options(argc, argv, 5);
+    wReceiver receiver(argv, options);
 
-    close(sockfd);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,11 +1,28 @@
 #include "wSender.h"
+#include "BatchIO.h"
+#include "ReassemblyRing.h"
+
+#include <poll.h>
+
+// In-order chunks are written out once this many have accumulated
+#define WRITE_COALESCE_CHUNKS 64
+// Datagrams per recvmmsg / sendmmsg call (override with --batch=N)
+#define DEFAULT_BATCH_SIZE 32
+// Requested SO_RCVBUF (the kernel caps it at net.core.rmem_max)
+#define SOCKET_BUFFER_BYTES (8 << 20)
+// Idle wake-up used to push partially coalesced data to disk
+#define IDLE_FLUSH_MS 100
 
 class wReceiver
 {
-    wReceiver::wReceiver();
+public:
+    wReceiver(char *argv[], const CliOptions &options);
+
+private:
     // Steps:
     // 1. Receive and store the file from wSender from ONE connection
     // 1a) Ignore any additional START in the middle of the connection
+    //      (a resent START for the current connection is ACKed again)
     // 1b) Should be named FILE-i.out (i == num files we've recvd so far)
     // 1c) Calculate and validate checksum (drop if not correct)
     // 1d) Send cumulative ACK with seqNum expected to recv next
@@ -14,5 +31,25 @@ class wReceiver
     //       If it receives a packet with seqNum=N, it will check for the highest sequence number (say M)
     //       of the in­order packets it has already received and send ACK with seqNum=M+1.
     //      If next expected N, drop all with seqNum >= N + window-size
+    //      Out-of-order packets wait in a ReassemblyRing; in-order data is
+    //      written to FILE-i.out in coalesced writev() calls
+    void handle_packet(const char *packet, size_t len, const sockaddr_in &from);
+    void handle_start(const PacketHeader &header, const sockaddr_in &from);
+    void handle_end(const PacketHeader &header, const sockaddr_in &from);
+    void handle_data(const PacketHeader &header, const char *payload);
+    void send_ack(uint32_t seqNum, const sockaddr_in &to);
+
     // 2. LOGGING (EVERY PACKET SENT + RECEIVED)
-};
\ No newline at end of file
+    void log_packet(const PacketHeader &header);
+
+    std::string output_dir;
+    PacketLog receiver_log;
+    BatchIO *io;
+    ReassemblyRing ring;
+
+    bool connected;
+    sockaddr_in peer;    // Sender of the current (or last) connection
+    uint32_t start_seq;  // START / END seqNum of that connection
+    int out_fd;
+    unsigned file_count; // i in FILE-i.out
+};
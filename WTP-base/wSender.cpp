@@ -1,27 +1,5 @@
 #include "wSender.h"
 
-// REQUIRES: None
-// MODIFIES: chunks
-// EFFECTS: Split file into FILE_CHUNK_SIZE chunks and append to chunks deque
-void wSender::split_file_chunks(deque<string> &chunks,
-                                const string &file_in)
-{
-    std::ifstream instream(file_in);
-
-    char file_chunk[FILE_CHUNK_SIZE];
-    while (!instream.eof())
-    {
-        instream.read(file_chunk, FILE_CHUNK_SIZE);
-
-        // # bytes actually read
-        std::streamsize bytes_read = instream.gcount();
-        if (bytes_read > 0)
-            chunks.push_back(string(file_chunk, bytes_read));
-    }
-
-    instream.close();
-}
-
 // FIXME - Consider that START and END may not be received - must confirm?
 // REQUIRES: None
 // MODIFIES: None
@@ -29,152 +7,199 @@ void wSender::split_file_chunks(deque<string> &chunks,
 void wSender::send_start(int sockfd,
                          sockaddr_in &recv_addr,
                          PacketHeader &header,
-                         std::ofstream &outfile)
+                         PacketLog &log)
 {
     char start_buf[sizeof(PacketHeader)];
-    memcpy(start_buf, &header, sizeof(header));
+    encode_header(header, start_buf);
 
     // Send START and log
     sendto(sockfd, start_buf, sizeof(start_buf),
            0, (struct sockaddr *)&recv_addr, sizeof(recv_addr));
 
-    outfile << header.type << header.seqNum
-            << header.length << header.checksum << std::endl;
+    log.log(header);
 
     // Receive ACK, write to PacketHeader object and log
     char recv_buf[sizeof(PacketHeader)];
     recvfrom(sockfd, recv_buf, sizeof(recv_buf), 0, NULL, NULL);
 
-    PacketHeader recv_header;
-    memcpy(&recv_header, &recv_buf, sizeof(recv_header));
+    PacketHeader recv_header = decode_header(recv_buf);
 
-    outfile << recv_header.type << recv_header.seqNum
-            << recv_header.length << recv_header.checksum << std::endl;
+    log.log(recv_header);
 }
 
-// REQUIRES: chunks.size() > 0
-// MODIFIES: header, outfile
-// EFFECTS: Copy data into char buffers and send min(chunks.size(), outstanding_limit) packets
-void wSender::send_window(deque<string> &chunks,
-                          PacketHeader &header,
-                          size_t outstanding_limit,
-                          int sockfd,
-                          sockaddr_in &recv_addr,
-                          std::ofstream &outfile)
+// REQUIRES: header.seqNum is the first unacked seqNum
+// MODIFIES: header, pacer, log
+// EFFECTS: Send up to outstanding_limit packets starting at header.seqNum.
+//          Each is queued on io as the header and the chunk in place, using
+//          the chunk's cached CRC, and leaves with its batch (one sendmmsg())
+//          once the pacer allows it; a batch is flushed before the pacer
+//          sleeps. Returns # sent
+uint32_t wSender::send_window(ChunkSource &chunks,
+                              PacketHeader &header,
+                              size_t outstanding_limit,
+                              Pacer &pacer,
+                              BatchIO &io,
+                              sockaddr_in &recv_addr,
+                              PacketLog &log)
 {
-    char send_packet[MAX_SEND_DATA];
-    uint32_t i = 0;
+    // Header in the first 16 bytes, then the chunk (<= 1472 total); io
+    // copies the header, the chunk stays in place until acked
+    char wire[sizeof(PacketHeader)];
+
     uint32_t sent_packets = 0;
+    Chunk chunk;
     while (sent_packets < outstanding_limit &&
-           sent_packets < chunks.size())
+           chunks.get(header.seqNum - 1, chunk))
     {
         // type & seqNum were previously set correctly
-        header.length = chunks[i].size();
-        header.checksum = crc32(chunks[i].c_str(), chunks[i].size());
-
-        // First copy header into the first 16 bytes
-        memcpy(send_packet, &header, sizeof(header));
-        // Then copy data into the next bytes according to size
-        memcpy(send_packet + sizeof(header), chunks[i].c_str(), chunks[i].size());
+        header.length = chunk.size;
+        header.checksum = chunk.checksum;
+        encode_header(header, wire);
 
-        // <= 1472
-        size_t packet_size = sizeof(header) + chunks[i].size();
-        sendto(sockfd, send_packet, packet_size,
-               0, (struct sockaddr *)&recv_addr, sizeof(recv_addr));
+        if (!pacer.consume(sizeof(header) + chunk.size))
+        {
+            io.flush(); // What the pacer allowed so far goes now
+            pacer.wait(sizeof(header) + chunk.size);
+        }
+        io.queue(wire, sizeof(wire), chunk.data, chunk.size, recv_addr);
 
-        outfile << header.type << header.seqNum
-                << header.length << header.checksum << std::endl;
+        log.log(header);
 
         ++sent_packets;
         ++header.seqNum;
-        ++i;
     }
+    io.flush();
+
+    return sent_packets;
 }
 
-// REQUIRES: chunks.size() > 0
-// MODIFIES: chunks, header, cur_seq_num
-// EFFECTS: Call recvfrom() min(chunks.size(), outstanding_limit) times, shifting window if poss
-//          Places received-packet seqNum into a set to evaluate which need resent. Resets seqNum.
-void wSender::try_receive(deque<string> &chunks,
+// REQUIRES: sent_packets > 0
+// MODIFIES: chunks, header, cur_seq_num, rtt, cc
+// EFFECTS: Take up to sent_packets ACKs, a batch per recvmmsg(), until the RTO
+//          expires,
+//          advancing cur_seq_num to the highest cumulative ACK seen. Chunks
+//          below it are released and header.seqNum is reset to resend from
+//          cur_seq_num. If the window held no retransmissions (sample_start is
+//          set), its first ACK is an RTT sample; a round without progress
+//          backs the RTO off (Karn). Every ACK that advances is reported to cc;
+//          a round that leaves a hole is a loss, one without progress a timeout
+void wSender::try_receive(ChunkSource &chunks,
                           PacketHeader &header,
-                          size_t outstanding_limit,
+                          uint32_t sent_packets,
                           uint32_t &cur_seq_num,
+                          RttEstimator &rtt,
+                          CongestionControl &cc,
+                          Clock::time_point sample_start,
                           int sockfd,
-                          std::ofstream &outfile)
+                          BatchIO &io,
+                          PacketLog &log)
 {
-    char recv_packet[sizeof(PacketHeader)];
-    unordered_set<uint32_t> received_seq;
-    while (received_seq.size() < outstanding_limit &&
-           received_seq.size() < chunks.size())
+    Clock::time_point deadline = Clock::now() + rtt.current_rto();
+    uint32_t start_seq_num = cur_seq_num;
+    uint32_t received = 0;
+    while (received < sent_packets)
     {
-        ssize_t bytes_received = recvfrom(
-            sockfd, recv_packet, sizeof(PacketHeader), 0, NULL, NULL);
-
-        if (bytes_received == -1)
+        size_t n = io.receive();
+        if (n == 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            Clock::time_point now = Clock::now();
+            if (now >= deadline)
                 break; // Timeout occurred
-            else
+            // Round up so a sub-millisecond remainder still waits
+            int wait_ms = (std::chrono::duration_cast<std::chrono::microseconds>(
+                               deadline - now).count() + 999) / 1000;
+            pollfd pfd = {sockfd, POLLIN, 0};
+            if (poll(&pfd, 1, wait_ms) < 0 && errno != EINTR)
                 throw std::runtime_error("Error receiving data");
+            continue;
         }
 
-        // Decode the received bytes into a PacketHeader object
-        PacketHeader received_header;
-        memcpy(&received_header, recv_packet, sizeof(PacketHeader));
-
-        outfile << received_header.type << received_header.seqNum
-                << received_header.length << received_header.checksum << std::endl;
-
-        // Insert the seqNum into the unordered_set
-        received_seq.insert(received_header.seqNum);
+        for (size_t i = 0; i < n; ++i)
+        {
+            ++received;
+            if (io.length(i) < sizeof(PacketHeader))
+                continue; // Too short to hold a header
+
+            // Decode the received bytes into a PacketHeader object
+            PacketHeader received_header = decode_header(io.packet(i));
+
+            log.log(received_header);
+
+            // ACK seqNum is the next seqNum the receiver expects
+            if (received_header.type == 3 && received_header.seqNum > cur_seq_num)
+            {
+                RttEstimator::usec sample(0);
+                if (cur_seq_num == start_seq_num && sample_start != Clock::time_point())
+                {
+                    sample = std::chrono::duration_cast<RttEstimator::usec>(
+                        Clock::now() - sample_start);
+                    rtt.sample(sample);
+                    rtt.log_if_moved(log);
+                }
+                cc.on_ack(received_header.seqNum - cur_seq_num, sample);
+                cur_seq_num = received_header.seqNum;
+            }
+        }
     }
 
-    // Process received_seq set and move window accordingly
-    while (received_seq.find(cur_seq_num) != received_seq.end())
+    if (cur_seq_num == start_seq_num)
     {
-        ++cur_seq_num;
-        chunks.pop_front();
+        rtt.backoff();
+        rtt.log_if_moved(log);
+        cc.on_timeout();
     }
+    else if (cur_seq_num < header.seqNum)
+        cc.on_loss(); // Part of the window went missing
+
+    // Everything below cur_seq_num is acked; let the source drop it
+    chunks.release(cur_seq_num - 1);
 
     // It's possible that this doesn't get changed at all
     header.seqNum = cur_seq_num;
 }
 
+// REQUIRES: start_seq is the seqNum the START went out with
+// MODIFIES: header, log
+// EFFECTS: Send END; it matches its START so a receiver can tell it from a
+//          stray END of another connection
 void wSender::send_end(int sockfd,
                        sockaddr_in &recv_addr,
                        PacketHeader &header,
-                       uint32_t cur_seq_num,
-                       std::ofstream &outfile)
+                       uint32_t start_seq,
+                       PacketLog &log)
 {
     char end_buf[sizeof(PacketHeader)];
     header.type = 1;
-    header.seqNum = cur_seq_num;
+    header.seqNum = start_seq;
     header.length = 0;
     header.checksum = 0;
 
-    // Copy PacketHeader into end_buf
-    memcpy(end_buf, &header, sizeof(header));
+    // Encode PacketHeader into end_buf
+    encode_header(header, end_buf);
 
     // Send END and log
     sendto(sockfd, end_buf, sizeof(end_buf),
            0, (struct sockaddr *)&recv_addr, sizeof(recv_addr));
 
-    outfile << header.type << header.seqNum << header.length << header.checksum << std::endl;
+    log.log(header);
 }
 
-// REQUIRES: argc == 6
+// REQUIRES: argc >= 6
 // MODIFIES: None
 // EFFECTS: Driver for wSender functionality
-wSender::wSender(char *argv[])
+wSender::wSender(char *argv[], const CliOptions &options)
 {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     check_error(sockfd);
 
-    // Set the socket receive timeout to 500 ms
-    // I'm using this as the general transmission timeout, not sure if correct
+    // The window timeout tracks the measured RTT instead of a fixed 500 ms;
+    // the socket receive timeout only bounds the wait for START's ACK
+    RttEstimator rtt(std::chrono::milliseconds(INITIAL_RTO_MS),
+                     std::chrono::milliseconds(options.get_long("rto-min", DEFAULT_RTO_MIN_MS)),
+                     std::chrono::milliseconds(options.get_long("rto-max", DEFAULT_RTO_MAX_MS)));
     struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 500000; // 500 milliseconds
+    tv.tv_sec = INITIAL_RTO_MS / 1000;
+    tv.tv_usec = (INITIAL_RTO_MS % 1000) * 1000;
     check_error(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
 
     // Receiver details
@@ -184,42 +209,66 @@ wSender::wSender(char *argv[])
     recv_addr.sin_port = htons(std::stoi(argv[2]));
     recv_addr.sin_addr.s_addr = inet_addr(argv[1]);
 
-    // Create chunks deque
-    deque<string> chunks;
-    split_file_chunks(chunks, string(argv[4]));
+    // Stream the input file; memory is bounded by the window
+    uint32_t outstanding_limit = std::stoul(argv[3]);
+    ChunkSource chunks(string(argv[4]), FILE_CHUNK_SIZE, outstanding_limit);
+
+    // argv[3] caps the window; the congestion controller picks the size
+    std::unique_ptr<CongestionControl> cc =
+        CongestionControl::create(options.get("cc", "reno"), outstanding_limit);
+    Pacer pacer(MAX_SEND_DATA);
+    bool pace_auto = configure_pacing(pacer, options.get("pace", ""), sockfd);
+    // ACKs are header-only, but room for a full packet costs little
+    BatchIO io(sockfd, options.get_long("batch", DEFAULT_BATCH_SIZE), MAX_SEND_DATA,
+               !options.has("no-mmsg"));
 
     // Send start and begin stream
-    std::ofstream sender_log(argv[5]);
+    PacketLog sender_log(argv[5], options.has("binary-log"));
     PacketHeader header{0, 0, 0, 0};
     send_start(sockfd, recv_addr, header, sender_log);
+    uint32_t start_seq = header.seqNum;
 
     header.type = 2;   // DATA for all of next stage
     header.seqNum = 1; // Begin the sequence at 1
     uint32_t cur_seq_num = 1;
 
-    uint32_t outstanding_limit = std::stoul(argv[3]);
-    while (!chunks.empty())
+    uint32_t highest_sent = 0;
+    while (true)
     {
-        send_window(chunks, header, outstanding_limit,
-                    sockfd, recv_addr, sender_log);
-        try_receive(chunks, header, outstanding_limit,
-                    cur_seq_num, sockfd, sender_log);
+        // Only a window of first transmissions yields an unambiguous RTT
+        Clock::time_point sample_start;
+        if (cur_seq_num > highest_sent)
+            sample_start = Clock::now();
+
+        if (pace_auto)
+            pacer.set_window_rate(cc->window(), cc->in_slow_start(), rtt.current_srtt());
+        uint32_t sent_packets = send_window(chunks, header, cc->window(), pacer,
+                                            io, recv_addr, sender_log);
+        if (sent_packets == 0)
+            break; // Every chunk has been acked
+        highest_sent = std::max(highest_sent, header.seqNum - 1);
+        try_receive(chunks, header, sent_packets, cur_seq_num,
+                    rtt, *cc, sample_start, sockfd, io, sender_log);
     }
 
-    send_end(sockfd, recv_addr, header, cur_seq_num, sender_log);
+    send_end(sockfd, recv_addr, header, start_seq, sender_log);
     close(sockfd);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 6)
+    if (argc < 6)
     {
         std::cout << "Invalid Input.\nUsage: ./wSender "
-                  << "<receiver-IP> <receiver-port> <window-size> <input-file> <log>" << std::endl;
+                  << "<receiver-IP> <receiver-port> <window-size> <input-file> <log>"
+                  << " [--rto-min=MS] [--rto-max=MS] [--batch=N] [--no-mmsg]"
+                  << " [--cc=reno|delay|fixed]"
+                  << " [--pace=auto|MBIT] [--binary-log]" << std::endl;
         exit(1);
     }
 
-    wSender sender(argv);
+    CliOptions options(argc, argv, 6);
+    wSender sender(argv, options);
 
     return 0;
 }
@@ -1,13 +1,18 @@
 #include "PacketHeader.h"
+#include "PacketCodec.h"
 #include "crc32.h"
+#include "ChunkSource.h"
+#include "RttEstimator.h"
+#include "CongestionControl.h"
+#include "Pacer.h"
+#include "CliOptions.h"
+#include "PacketLog.h"
+#include "BatchIO.h"
 
 #include <chrono>
-#include <deque>
 #include <vector>
 #include <string>
-#include <unordered_set>
 #include <iostream>
-#include <fstream>
 #include <stdexcept>
 #include <cstring>
 #include <cstdlib>
@@ -18,6 +23,7 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <poll.h>
 
 // UDP Header 8B; IP Protocol Header 20B
 // 1500 - (8 + 20) = 1472 for total send data
@@ -25,10 +31,17 @@
 // UDP Header 8B; IP Protocol Header 20B; PacketHeader 16B
 // 1500 - (8 + 20 + 16) = 1456 for file data chunks
 #define FILE_CHUNK_SIZE 1456
+// Window timeout before the first RTT sample, and its default clamps
+// (override with --rto-min=MS / --rto-max=MS)
+#define INITIAL_RTO_MS 500
+#define DEFAULT_RTO_MIN_MS 5
+#define DEFAULT_RTO_MAX_MS 2000
+// Datagrams per sendmmsg / recvmmsg call (override with --batch=N)
+#define DEFAULT_BATCH_SIZE 32
+
+typedef std::chrono::steady_clock Clock;
 
-using std::deque;
 using std::string;
-using std::unordered_set;
 using std::vector;
 
 void check_error(int input)
@@ -40,44 +53,52 @@ void check_error(int input)
 class wSender
 {
 public:
-    wSender(char *argv[]);
-
-    // **Match a chunk to a given SeqNum
-    // We don't HAVE to do this now
-    // But it's something to think about for OPT
+    wSender(char *argv[], const CliOptions &options);
 
 private:
-    // 1. Read in input file
-    void split_file_chunks(deque<string> &chunks,
-                           const string &file_in);
+    // 1. Input file is streamed through a ChunkSource (ChunkSource.h)
+    //      DATA seqNum s carries chunk s - 1, i.e. file offset
+    //      (s - 1) * FILE_CHUNK_SIZE; nothing is read ahead of the window
 
     // 2. Setup and send packets USING UDP!
     void send_start(int recv_sock,
                     sockaddr_in &recv_addr,
                     PacketHeader &header,
-                    std::ofstream &outfile);
-    void send_window(deque<string> &chunks,
-                     PacketHeader &header,
-                     size_t outstanding_limit,
-                     int sockfd,
-                     sockaddr_in &recv_addr,
-                     std::ofstream &outfile);
+                    PacketLog &log);
+    //      With --pace, packets are spread out by a token bucket (Pacer.h)
+    //      DATA leaves a batch at a time through BatchIO (BatchIO.h)
+    uint32_t send_window(ChunkSource &chunks,
+                         PacketHeader &header,
+                         size_t outstanding_limit,
+                         Pacer &pacer,
+                         BatchIO &io,
+                         sockaddr_in &recv_addr,
+                         PacketLog &log);
 
     // 3. Receive and track the ACKs that we get and retransmit accordingly
     //      Retransmit ALL of the window if packet M + 1 ACK has not been recvd
-    void try_receive(deque<string> &chunks,
+    //      The window timeout is the adaptive RTO from RttEstimator
+    //      Each round sends at most the CongestionControl window, which the
+    //      window-size argument only caps
+    //      ACKs are drained a batch at a time, also through BatchIO
+    void try_receive(ChunkSource &chunks,
                      PacketHeader &header,
-                     size_t outstanding_limit,
+                     uint32_t sent_packets,
                      uint32_t &cur_seq_num,
+                     RttEstimator &rtt,
+                     CongestionControl &cc,
+                     Clock::time_point sample_start,
                      int sockfd,
-                     std::ofstream &outfile);
+                     BatchIO &io,
+                     PacketLog &log);
 
-    // 4. Send an END message
+    // 4. Send an END message carrying the START's seqNum
     void send_end(int sockfd,
                   sockaddr_in &recv_addr,
                   PacketHeader &header,
-                  uint32_t cur_seq_num,
-                  std::ofstream &outfile);
+                  uint32_t start_seq,
+                  PacketLog &log);
 
     // 5. LOGGING
+    //      Every packet sent or received goes to a PacketLog (PacketLog.h)
 };
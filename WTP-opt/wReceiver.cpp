@@ -0,0 +1,1121 @@
+#include "wReceiver.h"
+
+// REQUIRES: None
+// MODIFIES: receiver_log
+// EFFECTS: Write one packet header to this worker's log
+void ReceiverWorker::log_packet(const PacketHeader &header)
+{
+    receiver_log.log(header);
+}
+
+// EFFECTS: Every worker's stats, for the stats endpoint
+static StatsRegistry<ReceiverStats> &receiver_stats()
+{
+    static StatsRegistry<ReceiverStats> registry;
+    return registry;
+}
+
+string ReceiverStats::json() const
+{
+    return JsonObject()
+        .text("name", name)
+        .count("packets", packets.get())
+        .count("corrupt", corrupt.get())
+        .count("data", data.get())
+        .count("data_dropped", data_dropped.get())
+        .count("parity", parity.get())
+        .count("fec_rebuilt", fec_rebuilt.get())
+        .count("acks_sent", acks_sent.get())
+        .count("bytes_written", bytes_written.get())
+        .count("flows_started", flows_started.get())
+        .count("flows_finished", flows_finished.get())
+        .count("flows_failed", flows_failed.get())
+        .count("active_flows", active_flows.get())
+        .raw("ack_delay_us", ack_delay_us.json())
+        .raw("write_us", write_us.json())
+        .str();
+}
+
+// EFFECTS: Reserve the blocks of an output file whose final size is known,
+//          so writes never stop to allocate and the file lands in few
+//          extents. Filesystems without fallocate() are left as they are
+static void preallocate(int fd, uint64_t size)
+{
+    if (size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS)
+        perror("fallocate");
+}
+
+static uint64_t flow_key(const sockaddr_in &addr)
+{
+    return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+// REQUIRES: None
+// MODIFIES: None
+// EFFECTS: Open this worker's SO_REUSEPORT socket on the shared port
+ReceiverWorker::ReceiverWorker(ReceiverConfig &config, const string &log_path)
+    : config(config), receiver_log(log_path, config.binary_log),
+      stats(receiver_stats().add(new ReceiverStats(log_path)))
+{
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    check_error(sockfd);
+
+    int one = 1;
+    check_error(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)));
+    int rcvbuf = SOCKET_BUFFER_BYTES;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(config.port);
+    check_error(bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)));
+
+    io.reset(new BatchIO(sockfd, config.batch_size,
+                         config.max_chunk + sizeof(PacketHeader), config.use_mmsg));
+    if (config.use_gso)
+        io->enable_gso();
+    if (config.use_gro)
+        io->enable_gro();
+    limits = HeaderLimits{(uint32_t)config.max_chunk, (uint32_t)ACK_MAX_PAYLOAD};
+    disk = DiskWriter::create(config.disk);
+    jobs.reset(new JobThread());
+}
+
+ReceiverWorker::~ReceiverWorker()
+{
+    jobs.reset(); // Nothing may still be reading a flow's files
+    for (auto &entry : flows)
+        close_flow(*entry.second);
+    close(sockfd);
+}
+
+// REQUIRES: None
+// MODIFIES: io, receiver_log
+// EFFECTS: Queue an ACK carrying seqNum; it leaves with the batch's flush
+void ReceiverWorker::send_ack(uint32_t seqNum, const sockaddr_in &to)
+{
+    PacketHeader ack{PACKET_ACK, seqNum, 0, 0};
+    char wire[sizeof(PacketHeader)];
+    encode_header(ack, wire);
+    io->queue(wire, sizeof(wire), NULL, 0, to);
+    log_packet(ack);
+    stats->acks_sent.add();
+}
+
+// REQUIRES: None
+// MODIFIES: flow
+// EFFECTS: Flush and close the flow's output file, if still open. A stream
+//          of a multi-stream transfer closes the shared file only when it is
+//          the last of its transfer to finish
+void ReceiverWorker::close_flow(Flow &flow)
+{
+    if (flow.out_fd < 0)
+        return;
+    flow.ring.flush();
+    if (flow.router)
+        flow.router->close_all();
+
+    if (flow.accepted & START_DELTA)
+    {
+        close(flow.out_fd);
+        unlink(resume_path(flow.info.transfer_id, ".sig").c_str());
+    }
+    else if (flow.accepted & START_RESUME)
+    {
+        close(flow.out_fd);
+        finish_resume(flow);
+    }
+    else if (flow.accepted & START_RANGE)
+    {
+        std::lock_guard<std::mutex> lock(config.files_mutex);
+        TransferKey key(flow.peer.sin_addr.s_addr, flow.info.transfer_id);
+        auto it = config.shared_files.find(key);
+        if (it != config.shared_files.end() && ++it->second.ended >= it->second.streams)
+        {
+            close(it->second.fd);
+            config.shared_files.erase(it);
+        }
+    }
+    else
+        close(flow.out_fd);
+    flow.out_fd = -1;
+}
+
+// REQUIRES: flow's data could not be delivered
+// MODIFIES: flow
+// EFFECTS: Close what the flow wrote and refuse the sender. The flow
+//          lingers, finished, so whatever else the sender sends for it is
+//          refused again rather than ACKed: it cannot take the transfer
+//          for a finished one, and learns it failed
+void ReceiverWorker::reject_flow(Flow &flow)
+{
+    close_flow(flow);
+    stats->flows_failed.add();
+    flow.finished = true;
+    flow.rejected = true;
+    flow.last_heard = Clock::now();
+    send_reject(flow);
+}
+
+// REQUIRES: flow.rejected
+// MODIFIES: io, receiver_log
+// EFFECTS: Tell the flow's sender that its transfer failed: an END from the
+//          receiver, with the START / END seqNum
+void ReceiverWorker::send_reject(const Flow &flow)
+{
+    PacketHeader reject{PACKET_END, flow.start_seq, 0, 0};
+    char wire[sizeof(PacketHeader)];
+    encode_header(reject, wire);
+    io->queue(wire, sizeof(wire), NULL, 0, flow.peer);
+    log_packet(reject);
+}
+
+// EFFECTS: Where a START_RESUME transfer keeps its partial output (".part"),
+//          its checkpoint (".ckpt") or the signatures of a delta (".sig")
+string ReceiverWorker::resume_path(uint32_t transfer_id, const char *suffix) const
+{
+    return config.output_dir + "/RESUME-" + std::to_string(transfer_id) + suffix;
+}
+
+// REQUIRES: None
+// MODIFIES: file_count, shared_files
+// EFFECTS: Open FILE-i.out for a new connection. Streams of a multi-stream
+//          transfer share one file, sized and preallocated up front, and get
+//          its descriptor. A resumable stream opens the transfer's partial
+//          output without truncating what earlier runs wrote
+int ReceiverWorker::open_output(Flow &flow)
+{
+    if (flow.accepted & START_BATCH)
+    {
+        string path = config.output_dir + "/BATCH-" + std::to_string(flow.info.transfer_id) +
+                      ".txt";
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        check_error(fd);
+        return fd;
+    }
+    if (flow.accepted & START_DELTA)
+    {
+        int fd = open(resume_path(flow.info.transfer_id, ".sig").c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC, 0644);
+        check_error(fd);
+        return fd;
+    }
+    if (flow.accepted & START_RESUME)
+    {
+        int fd = open(resume_path(flow.info.transfer_id, ".part").c_str(),
+                      O_WRONLY | O_CREAT, 0644);
+        check_error(fd);
+        check_error(ftruncate(fd, flow.info.file_size));
+        preallocate(fd, flow.info.file_size);
+        return fd;
+    }
+
+    std::unique_lock<std::mutex> lock(config.files_mutex, std::defer_lock);
+    TransferKey key(flow.peer.sin_addr.s_addr, flow.info.transfer_id);
+    if (flow.accepted & START_RANGE)
+    {
+        lock.lock();
+        auto it = config.shared_files.find(key);
+        if (it != config.shared_files.end())
+            return it->second.fd;
+    }
+
+    unsigned i = config.file_count++;
+    string path = config.output_dir + "/FILE-" + std::to_string(i) + ".out";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check_error(fd);
+
+    if (flow.accepted & START_RANGE)
+    {
+        check_error(ftruncate(fd, flow.info.file_size));
+        preallocate(fd, flow.info.file_size);
+        config.shared_files[key] = SharedFile{fd, flow.info.stream_count, 0};
+    }
+    return fd;
+}
+
+// REQUIRES: info.flags & START_RESUME
+// MODIFIES: checkpoints
+// EFFECTS: The transfer's checkpoint, loaded from disk (or begun) the first
+//          time one of its streams arrives
+std::shared_ptr<Checkpoint> ReceiverWorker::open_checkpoint(const StartInfo &info)
+{
+    std::lock_guard<std::mutex> lock(config.files_mutex);
+    std::shared_ptr<Checkpoint> &checkpoint = config.checkpoints[info.transfer_id];
+    if (!checkpoint || checkpoint->size() != info.file_size)
+        checkpoint.reset(new Checkpoint(resume_path(info.transfer_id, ".ckpt"),
+                                        info.transfer_id, info.file_size));
+    return checkpoint;
+}
+
+// REQUIRES: None
+// EFFECTS: The flow a job was posted for, if it is still the connection
+//          whose START seqNum is start_seq; NULL otherwise
+Flow *ReceiverWorker::job_flow(uint64_t key, uint32_t start_seq)
+{
+    auto it = flows.find(key);
+    if (it == flows.end() || !it->second->busy || it->second->start_seq != start_seq)
+        return NULL;
+    return it->second.get();
+}
+
+// REQUIRES: flow is a resume query (START_RESUME without START_RANGE)
+// MODIFIES: flow, checkpoint
+// EFFECTS: Verify the partial output against its checkpoint from the
+//          query's offset on, on the job thread, then ACK the START with the
+//          runs of good ranges. Re-reading the file can take seconds; the
+//          flow is busy meanwhile and this worker keeps serving the others
+void ReceiverWorker::answer_resume(Flow &flow)
+{
+    string path = resume_path(flow.info.transfer_id, ".part");
+    std::shared_ptr<Checkpoint> checkpoint = flow.checkpoint;
+    uint64_t from = flow.info.offset;
+    std::shared_ptr<vector<char> > encoded(new vector<char>());
+    uint64_t key = flow_key(flow.peer);
+    uint32_t start_seq = flow.start_seq;
+
+    flow.busy = true;
+    jobs->post(
+        [path, checkpoint, from, encoded]() {
+            ResumeRun runs[RESUME_MAX_RUNS];
+            int fd = open(path.c_str(), O_RDONLY);
+            size_t count = checkpoint->verify(fd, runs, RESUME_MAX_RUNS, from);
+            if (fd >= 0)
+                close(fd);
+            encoded->resize(count * sizeof(ResumeRun));
+            encode_wire(runs, count, encoded->data());
+        },
+        [this, key, start_seq, encoded]() {
+            Flow *flow = job_flow(key, start_seq);
+            if (!flow)
+                return;
+            flow->busy = false;
+            flow->resume_runs.swap(*encoded);
+            flow->last_heard = Clock::now();
+            send_start_ack(*flow);
+        });
+}
+
+// REQUIRES: flow's output is closed
+// MODIFIES: file_count, checkpoints
+// EFFECTS: Once every range of the flow's transfer is done, rename the
+//          partial output to the next FILE-i.out and drop the checkpoint.
+//          Whichever stream closes last does this, once
+void ReceiverWorker::finish_resume(const Flow &flow)
+{
+    if (!flow.checkpoint || !flow.checkpoint->complete())
+        return;
+
+    std::lock_guard<std::mutex> lock(config.files_mutex);
+    auto it = config.checkpoints.find(flow.info.transfer_id);
+    if (it == config.checkpoints.end() || it->second != flow.checkpoint)
+        return; // Another stream got here first
+
+    config.checkpoints.erase(it);
+    unsigned i = config.file_count++;
+    string path = config.output_dir + "/FILE-" + std::to_string(i) + ".out";
+    check_error(rename(resume_path(flow.info.transfer_id, ".part").c_str(), path.c_str()));
+    unlink(resume_path(flow.info.transfer_id, ".ckpt").c_str());
+}
+
+// REQUIRES: fd is open for writing
+// EFFECTS: Write all len bytes at offset; false on error
+static bool pwrite_all(int fd, const char *p, size_t len, uint64_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// REQUIRES: list_fd is the flow's open, empty list of files
+BatchRouter::BatchRouter(ReceiverConfig &config, int list_fd)
+    : config(config), list_fd(list_fd), list_bytes(0), next_index(0), remaining(0),
+      file_fd(-1), file_offset(0)
+{
+}
+
+BatchRouter::~BatchRouter()
+{
+    close_all();
+}
+
+// MODIFIES: *this, file_count, the list of files
+// EFFECTS: Content chunks go to the current file, in order. A header opens
+//          the next FILE-i.out at its full size, lists it and is consumed;
+//          FAILED if it is malformed or its file cannot be created or listed
+ChunkRouter::Route BatchRouter::route(uint32_t seq, const char *data, size_t len, int &fd,
+                                      uint64_t &offset)
+{
+    if (remaining > 0)
+    {
+        --remaining;
+        fd = file_fd;
+        offset = file_offset;
+        file_offset += len;
+        return WRITE;
+    }
+
+    if (len < sizeof(BatchFileInfo))
+        return FAILED;
+    BatchFileInfo info = decode_wire<BatchFileInfo>(data);
+    if (info.index != next_index || info.name_length > len - sizeof(info) ||
+        (info.size == 0) != (info.chunks == 0))
+        return FAILED;
+
+    string out = "FILE-" + std::to_string(config.file_count++) + ".out";
+    file_fd = open((config.output_dir + "/" + out).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file_fd < 0)
+        return FAILED;
+    if (info.size > 0)
+    {
+        if (ftruncate(file_fd, info.size) != 0)
+        {
+            close(file_fd);
+            return FAILED;
+        }
+        preallocate(file_fd, info.size);
+        open_files.push_back(std::make_pair(seq + 1 + info.chunks, file_fd));
+    }
+    else
+        close(file_fd); // Nothing will be written to it
+
+    // One line per file; the name is the sender's, made safe for the list
+    string name(data + sizeof(info), info.name_length);
+    for (size_t i = 0; i < name.size(); ++i)
+        if ((unsigned char)name[i] < 0x20)
+            name[i] = '?';
+    string line = out + "\t" + std::to_string(info.size) + "\t" + name + "\n";
+    if (!pwrite_all(list_fd, line.data(), line.size(), list_bytes))
+        return FAILED;
+    list_bytes += line.size();
+
+    ++next_index;
+    remaining = info.chunks;
+    file_offset = 0;
+    return CONSUMED;
+}
+
+// MODIFIES: *this
+// EFFECTS: Close every file whose chunks are all below seq
+void BatchRouter::written(uint32_t seq)
+{
+    while (!open_files.empty() && open_files.front().first <= seq)
+    {
+        close(open_files.front().second);
+        open_files.pop_front();
+    }
+}
+
+void BatchRouter::close_all()
+{
+    for (size_t i = 0; i < open_files.size(); ++i)
+        close(open_files[i].second);
+    open_files.clear();
+    remaining = 0;
+}
+
+// REQUIRES: sig_fd holds the signatures of a file_size-byte file
+// MODIFIES: checkpoint, the partial output at part_path
+// EFFECTS: Look for every block the signatures describe (and the checkpoint
+//          does not yet hold) in the old copy at basis_path, copy each one
+//          found into place in the partial output and mark its range done.
+//          Hashing runs on hash_threads threads
+static void match_delta(int sig_fd, uint64_t file_size, const string &basis_path,
+                        const string &part_path, Checkpoint &checkpoint,
+                        unsigned hash_threads)
+{
+    uint64_t count = (file_size + RESUME_UNIT_BYTES - 1) / RESUME_UNIT_BYTES;
+    vector<char> wire(count * sizeof(DeltaSignature));
+    struct stat st;
+    if (fstat(sig_fd, &st) != 0 || (uint64_t)st.st_size != wire.size() ||
+        (count && pread(sig_fd, wire.data(), wire.size(), 0) != (ssize_t)wire.size()))
+        return; // Incomplete signatures: the resume sends everything
+    vector<DeltaSignature> sigs(count);
+    decode_wire(wire.data(), count, sigs.data());
+
+    int basis_fd = open(basis_path.c_str(), O_RDONLY);
+    if (basis_fd < 0)
+        return;
+    void *basis = MAP_FAILED;
+    if (fstat(basis_fd, &st) == 0 && st.st_size >= RESUME_UNIT_BYTES)
+        basis = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, basis_fd, 0);
+    close(basis_fd);
+    if (basis == MAP_FAILED)
+        return;
+
+    // Ranges already held are not looked for, nor is a short last block
+    vector<bool> wanted(count);
+    for (uint64_t u = 0; u < count; ++u)
+        wanted[u] = !checkpoint.done(u) && checkpoint.unit_length(u) == RESUME_UNIT_BYTES;
+    vector<int64_t> found = delta_match(static_cast<const char *>(basis), st.st_size,
+                                        sigs, wanted, hash_threads);
+
+    int fd = open(part_path.c_str(), O_WRONLY | O_CREAT, 0644);
+    check_error(fd);
+    check_error(ftruncate(fd, file_size));
+    for (uint64_t u = 0; u < count; ++u)
+        if (found[u] >= 0 &&
+            pwrite_all(fd, static_cast<const char *>(basis) + found[u], RESUME_UNIT_BYTES,
+                       u * RESUME_UNIT_BYTES))
+            checkpoint.finish(u, sigs[u].weak);
+    close(fd);
+    munmap(basis, st.st_size);
+}
+
+// REQUIRES: flow accepted START_DELTA and its DATA has all been flushed
+// MODIFIES: flow, checkpoint, the transfer's partial output
+// EFFECTS: Match the flow's signatures against its old copy (match_delta)
+//          on the job thread, then close the flow and ACK its END. Hashing
+//          the old copy can take seconds; the flow is busy meanwhile and
+//          this worker keeps serving the others
+void ReceiverWorker::apply_delta(Flow &flow)
+{
+    int sig_fd = flow.out_fd; // Closed by close_flow, after the job
+    uint64_t file_size = flow.info.file_size;
+    string basis_path = config.output_dir + "/" + flow.delta.basis;
+    string part_path = resume_path(flow.info.transfer_id, ".part");
+    std::shared_ptr<Checkpoint> checkpoint = flow.checkpoint;
+    unsigned hash_threads = config.hash_threads;
+    uint64_t key = flow_key(flow.peer);
+    uint32_t start_seq = flow.start_seq;
+
+    flow.busy = true;
+    jobs->post(
+        [sig_fd, file_size, basis_path, part_path, checkpoint, hash_threads]() {
+            match_delta(sig_fd, file_size, basis_path, part_path, *checkpoint,
+                        hash_threads);
+        },
+        [this, key, start_seq]() {
+            Flow *flow = job_flow(key, start_seq);
+            if (!flow)
+                return;
+            flow->busy = false;
+            close_flow(*flow);
+            stats->flows_finished.add();
+            flow->finished = true;
+            flow->last_heard = Clock::now();
+            send_ack(start_seq, flow->peer);
+        });
+}
+
+// REQUIRES: None
+// MODIFIES: io, receiver_log
+// EFFECTS: ACK the flow's START, carrying the granted flags if it had a
+//          StartInfo payload, and the verified runs for a resume query
+void ReceiverWorker::send_start_ack(const Flow &flow)
+{
+    if (flow.accepted == 0 && flow.info.flags == 0)
+    {
+        send_ack(flow.start_seq, flow.peer);
+        return;
+    }
+
+    // Staged whole: the reply must outlive this call until the batch flushes
+    // The runs stay in the flow until the batch flushes
+    StartInfo reply = flow.info;
+    reply.flags = flow.accepted;
+    size_t run_bytes = flow.resume_runs.size();
+    char buf[sizeof(PacketHeader) + sizeof(StartInfo)];
+    char *info = buf + sizeof(PacketHeader);
+    encode_wire(reply, info);
+    PacketHeader ack{PACKET_ACK, flow.start_seq, (unsigned)(sizeof(reply) + run_bytes),
+                     crc32_update(crc32(info, sizeof(reply)),
+                                  flow.resume_runs.data(), run_bytes)};
+    encode_header(ack, buf);
+    io->queue(buf, sizeof(buf), flow.resume_runs.data(), run_bytes, flow.peer);
+    log_packet(ack);
+    stats->acks_sent.add();
+}
+
+// REQUIRES: flow.accepted & START_SACK
+// MODIFIES: io, receiver_log
+// EFFECTS: Queue the flow's cumulative ACK with a bitmap of the packets it
+//          holds beyond the first hole (a plain ACK if there are none)
+void ReceiverWorker::send_sack(const Flow &flow)
+{
+    uint64_t words[SACK_MAX_WORDS];
+    size_t count = flow.ring.sack_bitmap(words, SACK_MAX_WORDS);
+    if (count == 0)
+    {
+        send_ack(flow.ring.next_expected(), flow.peer);
+        return;
+    }
+
+    size_t bytes = count * sizeof(uint64_t);
+    char buf[sizeof(PacketHeader) + sizeof(words)];
+    char *bitmap = buf + sizeof(PacketHeader);
+    for (size_t w = 0; w < count; ++w)
+        store_big_endian(words[w], bitmap + w * sizeof(uint64_t));
+    PacketHeader ack{PACKET_ACK, flow.ring.next_expected(), (unsigned)bytes,
+                     crc32(bitmap, bytes)};
+    encode_header(ack, buf);
+    io->queue(buf, sizeof(ack) + bytes, NULL, 0, flow.peer);
+    log_packet(ack);
+    stats->acks_sent.add();
+}
+
+// REQUIRES: header.type == 0
+// MODIFIES: flows
+// EFFECTS: Start a new flow for this sender, or re-ACK the START of its
+//          current one. A different START mid-connection is ignored. A valid
+//          StartInfo payload negotiates START_* features. A START that did
+//          not fit our buffers is an MTU probe we cannot serve: no ACK.
+//          A resume query opens no output and carries no DATA. A delta
+//          names an old copy of the file in the output directory
+void ReceiverWorker::handle_start(const PacketHeader &header, const char *payload,
+                                  size_t len, const sockaddr_in &from)
+{
+    std::unique_ptr<Flow> &flow = flows[flow_key(from)];
+    if (flow && (!flow->finished || header.seqNum == flow->start_seq))
+    {
+        // A late duplicate of a lingering flow's START is answered, not
+        // taken for a new transfer; a busy flow's job answers it
+        if (flow->busy)
+            return;
+        if (header.seqNum == flow->start_seq && flow->rejected)
+            send_reject(*flow);
+        else if (header.seqNum == flow->start_seq)
+            send_start_ack(*flow);
+        return;
+    }
+
+    StartInfo info;
+    memset(&info, 0, sizeof(info));
+    DeltaInfo delta;
+    memset(&delta, 0, sizeof(delta));
+    uint32_t accepted = 0;
+    size_t chunk_size = FILE_CHUNK_SIZE;
+    if (header.length >= sizeof(StartInfo) && len == header.length &&
+        crc32(payload, len) == header.checksum)
+    {
+        info = decode_wire<StartInfo>(payload);
+        if ((info.flags & START_RANGE) && info.stream_count > 0 &&
+            info.offset <= info.file_size)
+            accepted |= START_RANGE;
+        accepted |= info.flags & (START_SACK | START_FEC | START_COMPRESS);
+        if ((info.flags & START_DELTA) && !(info.flags & START_RANGE) &&
+            header.length >= sizeof(StartInfo) + sizeof(DeltaInfo))
+        {
+            memcpy(&delta, payload + sizeof(StartInfo), sizeof(DeltaInfo));
+            delta.basis[DELTA_MAX_NAME - 1] = '\0';
+            if (delta.basis[0] != '\0' && delta.basis[0] != '.' &&
+                strchr(delta.basis, '/') == NULL)
+                accepted |= START_DELTA;
+        }
+        // Resumed streams begin on a range boundary (or are empty)
+        if ((info.flags & START_RESUME) &&
+            (!(info.flags & START_RANGE) ||
+             ((accepted & START_RANGE) && (info.offset % RESUME_UNIT_BYTES == 0 ||
+                                           info.offset == info.file_size))))
+            accepted |= START_RESUME;
+        // A batch is one plain session of whole files
+        if ((info.flags & START_BATCH) &&
+            !(info.flags & (START_RANGE | START_RESUME | START_DELTA | START_COMPRESS)))
+            accepted |= START_BATCH;
+        if ((info.flags & START_MTU) && info.max_chunk > FILE_CHUNK_SIZE)
+        {
+            accepted |= START_MTU;
+            chunk_size = std::min<size_t>(info.max_chunk, config.max_chunk);
+            info.max_chunk = chunk_size; // Echoed back as the final size
+        }
+    }
+
+    // Slots are sized for the flow's chunks
+    if (!flow || flow->chunk_size != chunk_size)
+    {
+        flow.reset(new Flow(config.window, chunk_size, disk.get(), config.disk_depth));
+        flow->ring.set_stats(&stats->bytes_written, &stats->write_us);
+    }
+    stats->flows_started.add();
+    flow->info = info;
+    flow->accepted = accepted;
+    flow->peer = from;
+    flow->start_seq = header.seqNum;
+    flow->finished = false;
+    flow->last_heard = Clock::now();
+    flow->fec.clear();
+    flow->tracker.reset();
+    flow->checkpoint.reset();
+    flow->resume_runs.clear();
+    flow->delta = delta;
+    if (accepted & (START_RESUME | START_DELTA))
+        flow->checkpoint = open_checkpoint(info);
+    if ((accepted & START_RESUME) && !(accepted & START_RANGE))
+    {
+        flow->out_fd = -1;
+        answer_resume(*flow); // ACKed once verified
+        return;
+    }
+    flow->out_fd = open_output(*flow);
+
+    // DATA seqNums begin at 1; a range lands at its own offset
+    uint64_t offset = flow->accepted & START_RANGE ? flow->info.offset : 0;
+    if (flow->accepted & START_RESUME)
+        flow->tracker.reset(new RangeTracker(*flow->checkpoint, offset));
+    // Compressed payloads decode to at most COMPRESS_MAX_RATIO chunks each
+    size_t decode_limit = flow->accepted & START_COMPRESS ? COMPRESS_MAX_RATIO * chunk_size
+                                                          : 0;
+    flow->router.reset(flow->accepted & START_BATCH ? new BatchRouter(config, flow->out_fd)
+                                                    : NULL);
+    flow->ring.reset(flow->out_fd, 1, offset, flow->tracker.get(), decode_limit,
+                     flow->router.get());
+    send_start_ack(*flow);
+}
+
+// REQUIRES: header.type == 1
+// MODIFIES: flows
+// EFFECTS: Close the sender's file and ACK its END; the flow lingers so a
+//          resent END is ACKed again. A flow whose data could not all be
+//          delivered is rejected instead. A delta flow is ACKed only once
+//          its delta is applied (apply_delta)
+void ReceiverWorker::handle_end(const PacketHeader &header, const sockaddr_in &from)
+{
+    auto it = flows.find(flow_key(from));
+    if (it == flows.end() || header.seqNum != it->second->start_seq)
+        return; // Stray or from an older connection: must not cut this one short
+
+    Flow &flow = *it->second;
+    if (flow.busy)
+        return; // Its job ACKs once done
+    if (flow.rejected)
+    {
+        send_reject(flow);
+        return;
+    }
+    if (flow.out_fd >= 0)
+        flow.ring.flush();
+    if (flow.ring.failed())
+    {
+        reject_flow(flow); // The file is incomplete: never ACK its END
+        return;
+    }
+    if ((flow.accepted & START_DELTA) && flow.out_fd >= 0)
+    {
+        apply_delta(flow); // ACKs the END once applied
+        return;
+    }
+    close_flow(flow);
+    if (!flow.finished)
+        stats->flows_finished.add();
+    flow.finished = true;
+    flow.last_heard = Clock::now();
+    send_ack(header.seqNum, from);
+}
+
+// REQUIRES: None
+// MODIFIES: io, receiver_log
+// EFFECTS: ACK the flow's data cumulatively, with a SACK bitmap if the
+//          sender asked for one
+void ReceiverWorker::ack_data(const Flow &flow)
+{
+    if (flow.ring.failed())
+        return; // Rejected
+    if (flow.accepted & START_SACK)
+        send_sack(flow);
+    else
+        send_ack(flow.ring.next_expected(), flow.peer);
+}
+
+// REQUIRES: header.type == 2, checksum already validated
+// MODIFIES: flow
+// EFFECTS: Buffer the chunk if it is in the flow's window and ACK it. A
+//          chunk may complete what a block's parity needs to rebuild the rest
+void ReceiverWorker::handle_data(Flow &flow, const PacketHeader &header, const char *payload)
+{
+    flow.last_heard = Clock::now();
+    bool stored = flow.ring.store(header.seqNum, payload, header.length);
+    if (stored)
+        stats->data.add();
+    else
+        stats->data_dropped.add();
+    if (stored && !flow.fec.empty())
+    {
+        auto it = flow.fec.upper_bound(header.seqNum);
+        if (it != flow.fec.begin())
+        {
+            --it;
+            if (header.seqNum < it->first + it->second.data_count)
+                fec_recover(flow, it->first);
+        }
+    }
+    ack_data(flow);
+}
+
+// REQUIRES: header.type == 4, checksum already validated, flow accepted
+//           START_FEC
+// MODIFIES: flow
+// EFFECTS: Keep the parity symbol for its block if the block still has
+//          holes, and rebuild them as soon as there are enough symbols
+void ReceiverWorker::handle_parity(Flow &flow, const PacketHeader &header,
+                                   const char *payload)
+{
+    FecInfo info = decode_wire<FecInfo>(payload);
+    uint32_t first = header.seqNum;
+    uint32_t next = flow.ring.next_expected();
+    if (info.data_count == 0 || info.data_count > FEC_MAX_DATA ||
+        info.parity_index >= info.parity_count || info.parity_count > FEC_MAX_PARITY ||
+        first + info.data_count <= next || first >= next + config.window)
+        return; // Malformed, already complete or beyond the window
+
+    flow.last_heard = Clock::now();
+    FecBlock &block = flow.fec[first];
+    for (size_t r = 0; r < block.rows.size(); ++r)
+        if (block.rows[r] == info.parity_index)
+            return; // Duplicate
+    block.data_count = info.data_count;
+    block.rows.push_back(info.parity_index);
+    const uint8_t *symbol = (const uint8_t *)payload + sizeof(info);
+    block.symbols.emplace_back(symbol, symbol + FEC_SYMBOL_SIZE(flow.chunk_size));
+
+    if (fec_recover(flow, first))
+        ack_data(flow);
+
+    // Blocks the cumulative ACK has passed need nothing more
+    while (!flow.fec.empty())
+    {
+        auto oldest = flow.fec.begin();
+        if (oldest->first + oldest->second.data_count > flow.ring.next_expected())
+            break;
+        flow.fec.erase(oldest);
+    }
+}
+
+// REQUIRES: flow.fec holds a block starting at first
+// MODIFIES: flow
+// EFFECTS: If the block has at least as many parity symbols as holes,
+//          rebuild and store the missing chunks (Gauss-Jordan on the Cauchy
+//          submatrix, FecCodec.h) and forget the block. Returns true if
+//          anything was rebuilt
+bool ReceiverWorker::fec_recover(Flow &flow, uint32_t first)
+{
+    FecBlock &block = flow.fec[first];
+    vector<unsigned> lost;
+    for (unsigned i = 0; i < block.data_count; ++i)
+    {
+        size_t len;
+        if (!flow.ring.held(first + i, len))
+            lost.push_back(i);
+    }
+    if (lost.empty())
+    {
+        flow.fec.erase(first);
+        return false;
+    }
+    if (lost.size() > block.rows.size())
+        return false;
+
+    unsigned e = lost.size();
+    vector<uint8_t> inverse(e * e);
+    if (!fec_invert(e, &block.rows[0], &lost[0], &inverse[0]))
+        return false;
+
+    // Syndrome r: parity row minus everything the block did deliver
+    for (unsigned i = 0, t = 0; i < block.data_count; ++i)
+    {
+        if (t < e && lost[t] == i)
+        {
+            ++t;
+            continue;
+        }
+        size_t len = 0;
+        const char *data = flow.ring.held(first + i, len);
+        uint8_t len16[sizeof(uint16_t)]; // The symbol's length prefix, big-endian
+        store_big_endian((uint16_t)len, len16);
+        for (unsigned r = 0; r < e; ++r)
+        {
+            uint8_t c = fec_coefficient(block.rows[r], i);
+            fec_mul_add(&block.symbols[r][0], len16, c, sizeof(len16));
+            fec_mul_add(&block.symbols[r][sizeof(len16)], (const uint8_t *)data, c, len);
+        }
+    }
+
+    size_t symbol_size = FEC_SYMBOL_SIZE(flow.chunk_size);
+    vector<uint8_t> symbol(symbol_size);
+    for (unsigned t = 0; t < e; ++t)
+    {
+        std::fill(symbol.begin(), symbol.end(), 0);
+        for (unsigned r = 0; r < e; ++r)
+            fec_mul_add(&symbol[0], &block.symbols[r][0], inverse[t * e + r],
+                        symbol_size);
+        uint16_t len = load_big_endian<uint16_t>(&symbol[0]);
+        if (len <= FEC_CHUNK_SIZE(flow.chunk_size) &&
+            flow.ring.store(first + lost[t], (const char *)&symbol[sizeof(len)], len))
+            stats->fec_rebuilt.add();
+    }
+    flow.fec.erase(first);
+    return true;
+}
+
+// REQUIRES: header is the decoded header of packet (len bytes) if it holds
+//           one; valid says whether it passed its PacketRule
+// MODIFIES: flows
+// EFFECTS: Dispatch a datagram to its sender's flow
+void ReceiverWorker::handle_packet(const PacketHeader &header, bool valid, const char *packet,
+                                   size_t len, const sockaddr_in &from)
+{
+    if (len < sizeof(PacketHeader))
+        return;
+    log_packet(header);
+    stats->packets.add();
+
+    // Drop anything truncated or corrupted
+    if (!valid)
+    {
+        if (header.type == PACKET_DATA || header.type == PACKET_PARITY)
+            stats->corrupt.add();
+        return;
+    }
+
+    if (header.type == PACKET_START)
+        handle_start(header, packet + sizeof(PacketHeader),
+                     len - sizeof(PacketHeader), from);
+    else if (header.type == PACKET_END)
+        handle_end(header, from);
+    else if (header.type == PACKET_DATA)
+    {
+        auto it = flows.find(flow_key(from));
+        if (it != flows.end() && it->second->rejected)
+            send_reject(*it->second);
+        if (it == flows.end() || it->second->finished || it->second->busy ||
+            it->second->out_fd < 0)
+            return;
+
+        const char *payload = packet + sizeof(PacketHeader);
+        if (header.length > it->second->chunk_size ||
+            crc32(payload, header.length) != header.checksum)
+        {
+            stats->corrupt.add();
+            return;
+        }
+        handle_data(*it->second, header, payload);
+        if (it->second->ring.failed())
+            reject_flow(*it->second);
+    }
+    else if (header.type == PACKET_PARITY)
+    {
+        auto it = flows.find(flow_key(from));
+        if (it == flows.end() || it->second->finished || it->second->busy ||
+            it->second->out_fd < 0 || !(it->second->accepted & START_FEC))
+            return;
+
+        const char *payload = packet + sizeof(PacketHeader);
+        if (header.length != sizeof(FecInfo) + FEC_SYMBOL_SIZE(it->second->chunk_size) ||
+            crc32(payload, header.length) != header.checksum)
+        {
+            stats->corrupt.add();
+            return;
+        }
+        stats->parity.add();
+        handle_parity(*it->second, header, payload);
+        if (it->second->ring.failed())
+            reject_flow(*it->second);
+    }
+}
+
+// REQUIRES: None
+// MODIFIES: flows
+// EFFECTS: Start writing the coalesced data of every live flow; drop flows
+//          that finished a while ago or whose sender went silent. Busy flows
+//          are left to their jobs
+void ReceiverWorker::reap_flows()
+{
+    Clock::time_point now = Clock::now();
+    for (auto it = flows.begin(); it != flows.end();)
+    {
+        Flow &flow = *it->second;
+        if (flow.busy)
+        {
+            ++it;
+            continue;
+        }
+        Clock::duration quiet = now - flow.last_heard;
+        if ((flow.finished && quiet > std::chrono::milliseconds(FLOW_LINGER_MS)) ||
+            quiet > std::chrono::milliseconds(FLOW_IDLE_TIMEOUT_MS))
+        {
+            close_flow(flow);
+            it = flows.erase(it);
+            continue;
+        }
+        if (!flow.finished)
+        {
+            flow.ring.push();
+            if (flow.ring.failed())
+                reject_flow(flow);
+        }
+        ++it;
+    }
+    stats->active_flows.set(flows.size());
+}
+
+// REQUIRES: None
+// MODIFIES: flows
+// EFFECTS: Serve this worker's share of the flows until the process exits
+void ReceiverWorker::run()
+{
+    Clock::time_point last_reap = Clock::now();
+    while (true)
+    {
+        pollfd pfd[2] = {{sockfd, POLLIN, 0}, {jobs->ready_fd(), POLLIN, 0}};
+        if (poll(pfd, 2, IDLE_FLUSH_MS) <= 0)
+            pfd[0].revents = pfd[1].revents = 0;
+        if (pfd[1].revents)
+        {
+            jobs->finish(); // Finished jobs queue their ACKs
+            io->flush();
+        }
+        if (pfd[0].revents)
+        {
+            size_t n;
+            while ((n = io->receive()) > 0)
+            {
+                Clock::time_point received = Clock::now();
+                if (headers.size() < n)
+                {
+                    headers.resize(n);
+                    header_ok.resize(n);
+                }
+                decode_headers(*io, n, limits, &headers[0], &header_ok[0]);
+                for (size_t i = 0; i < n; ++i)
+                    handle_packet(headers[i], header_ok[i], io->packet(i), io->length(i),
+                                  io->source(i));
+                if (disk)
+                    disk->reap(false); // Submits the batch's writes together
+                io->flush();
+                stats->ack_delay_us.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                               Clock::now() - received).count());
+                if (n < io->batch_size())
+                    break; // Socket drained
+            }
+        }
+
+        // Quiet link or busy one, flows are tidied every idle period
+        if (Clock::now() - last_reap >= std::chrono::milliseconds(IDLE_FLUSH_MS))
+        {
+            reap_flows();
+            if (disk)
+                disk->reap(false);
+            last_reap = Clock::now();
+        }
+    }
+}
+
+// EFFECTS: Totals over every worker, then each worker, as JSON
+static string stats_snapshot(Clock::time_point started)
+{
+    vector<std::shared_ptr<ReceiverStats> > workers = receiver_stats().list();
+    uint64_t packets = 0, data = 0, dropped = 0, rebuilt = 0, written = 0, active = 0;
+    string list;
+    for (size_t k = 0; k < workers.size(); ++k)
+    {
+        packets += workers[k]->packets.get();
+        data += workers[k]->data.get();
+        dropped += workers[k]->data_dropped.get();
+        rebuilt += workers[k]->fec_rebuilt.get();
+        written += workers[k]->bytes_written.get();
+        active += workers[k]->active_flows.get();
+        list += (k ? "," : "") + workers[k]->json();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+    string totals = JsonObject()
+                        .count("packets", packets)
+                        .count("data", data)
+                        .count("data_dropped", dropped)
+                        .count("fec_rebuilt", rebuilt)
+                        .count("bytes_written", written)
+                        .count("active_flows", active)
+                        .number("write_mbit", written * 8 / 1e6 / std::max(seconds, 1e-3))
+                        .str();
+    return JsonObject()
+        .text("role", "receiver")
+        .count("uptime_ms", seconds * 1000)
+        .raw("totals", totals)
+        .raw("workers", "[" + list + "]")
+        .str();
+}
+
+// REQUIRES: argc >= 5
+// MODIFIES: None
+// EFFECTS: Start --workers=N receiver threads sharing the port. With one
+//          worker the log is <log>; otherwise worker k logs to <log>.k.
+//          --stats=SOCKET / --stats-every=MS serve live metrics as the
+//          sender does (JSON Lines in <log>.stats)
+wReceiver::wReceiver(char *argv[], const CliOptions &options)
+{
+    ReceiverConfig config;
+    config.port = std::stoi(argv[1]);
+    config.window = std::stoul(argv[2]);
+    config.output_dir = argv[3];
+    config.batch_size = options.get_long("batch", DEFAULT_BATCH_SIZE);
+    config.use_mmsg = !options.has("no-mmsg");
+    config.binary_log = options.has("binary-log");
+    config.use_gso = !options.has("no-gso");
+    config.use_gro = !options.has("no-gro");
+    // Largest DATA chunk a sender may negotiate with START_MTU
+    long mtu = std::min<long>(options.get_long("mtu", DEFAULT_MTU), MAX_MTU);
+    config.max_chunk = std::max<long>(mtu, DEFAULT_MTU) - UDP_IP_HEADERS - sizeof(PacketHeader);
+    config.hash_threads = options.get_long("hash-threads", std::thread::hardware_concurrency());
+    config.disk = options.get("disk", "auto");
+    config.disk_depth = options.get_long("disk-depth", DEFAULT_DISK_DEPTH);
+    config.file_count = 0;
+
+    long workers = options.get_long("workers", 1);
+    if (workers < 1)
+        throw std::runtime_error("ERROR --workers must be positive");
+
+    // Bind every socket before any thread runs so the port is fully sharded
+    vector<std::unique_ptr<ReceiverWorker> > pool;
+    for (long k = 0; k < workers; ++k)
+    {
+        string log_path = argv[4];
+        if (workers > 1)
+            log_path += "." + std::to_string(k);
+        pool.emplace_back(new ReceiverWorker(config, log_path));
+    }
+
+    std::unique_ptr<StatsServer> stats_server;
+    if (options.has("stats") || options.has("stats-every"))
+    {
+        Clock::time_point started = Clock::now();
+        stats_server.reset(new StatsServer(options.get("stats", ""),
+                                           string(argv[4]) + ".stats",
+                                           options.get_long("stats-every", 0),
+                                           [started]() { return stats_snapshot(started); }));
+    }
+
+    vector<std::thread> threads;
+    for (long k = 0; k < workers; ++k)
+        threads.emplace_back(&ReceiverWorker::run, pool[k].get());
+    for (size_t k = 0; k < threads.size(); ++k)
+        threads[k].join();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        std::cout << "Invalid Input.\nUsage: ./wReceiver "
+                  << "<port-num> <window-size> <output-dir> <log>"
+                  << " [--workers=N] [--batch=N] [--no-mmsg] [--mtu=BYTES]"
+                  << " [--no-gso] [--no-gro] [--hash-threads=N] [--stats=SOCKET]"
+                  << " [--stats-every=MS] [--disk=auto|uring|threads|sync]"
+                  << " [--disk-depth=N] [--binary-log]" << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 5);
+    wReceiver receiver(argv, options);
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "wSender.h"
+#include "PacketCodec.h"
+#include "BatchIO.h"
+#include "ReassemblyRing.h"
+#include "Checkpoint.h"
+#include "DeltaSync.h"
+#include "JobThread.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// In-order chunks are written out once this many have accumulated
+#define WRITE_COALESCE_CHUNKS 64
+// Writes of coalesced chunks each flow may have in flight (--disk-depth=N)
+#define DEFAULT_DISK_DEPTH 4
+// Requested SO_RCVBUF per worker socket (capped by net.core.rmem_max)
+#define SOCKET_BUFFER_BYTES (8 << 20)
+// Idle wake-up used to flush coalesced data and reap flows
+#define IDLE_FLUSH_MS 100
+// A connection that is silent this long is abandoned and its file closed
+#define FLOW_IDLE_TIMEOUT_MS 60000
+// A finished flow is kept this long to re-ACK a resent END
+#define FLOW_LINGER_MS 5000
+
+// PARITY received for one block that still has holes (START_FEC flows)
+struct FecBlock
+{
+    uint16_t data_count;
+    vector<unsigned> rows;          // Code row of each symbol
+    vector<vector<uint8_t> > symbols;
+};
+
+class BatchRouter;
+
+// Per-connection state, keyed by the sender's address and port. Each flow
+// owns its reassembly window and output file, so any number of senders can
+// transfer at once
+struct Flow
+{
+    Flow(size_t window, size_t chunk_size, DiskWriter *disk, size_t disk_depth)
+        : ring(window, chunk_size, WRITE_COALESCE_CHUNKS, disk, disk_depth),
+          chunk_size(chunk_size), start_seq(0), accepted(0), out_fd(-1), finished(false),
+          rejected(false), busy(false)
+    {
+    }
+
+    std::unique_ptr<BatchRouter> router; // START_BATCH: outlives the ring's writes
+    ReassemblyRing ring;
+    size_t chunk_size;  // Largest DATA payload; above FILE_CHUNK_SIZE with START_MTU
+    sockaddr_in peer;
+    uint32_t start_seq; // START / END seqNum of this connection
+    uint32_t accepted;  // START_* flags granted; 0 for a plain START
+    StartInfo info;     // The sender's StartInfo when accepted != 0
+    int out_fd;         // Borrowed from a SharedFile for START_RANGE flows;
+                        // the list of files for START_BATCH flows
+    bool finished;      // END seen; lingering only to re-ACK it
+    bool rejected;      // Its data could not be delivered; lingering, also
+                        // finished, only to refuse the sender (send_reject)
+    bool busy;          // A job is reading its files: its packets are ignored
+                        // and it is not reaped until the job's done() runs
+    Clock::time_point last_heard;
+    std::map<uint32_t, FecBlock> fec; // Keyed by the block's first seqNum
+
+    // START_RESUME / START_DELTA: the transfer's checkpoint, and either the
+    // runs a resume query was answered with (encoded, as the ACK carries
+    // them) or the tracker checksumming this range; a delta flow's DATA
+    // (signatures) goes to a scratch file
+    DeltaInfo delta;
+    std::shared_ptr<Checkpoint> checkpoint;
+    std::unique_ptr<RangeTracker> tracker;
+    vector<char> resume_runs;
+};
+
+// Output file written by every stream of one multi-stream transfer, keyed
+// by sender IP and transfer_id. Streams may land on different workers, so
+// the table is guarded by ReceiverConfig::files_mutex (touched at START/END
+// only); each stream pwrite()s its own range
+struct SharedFile
+{
+    int fd;
+    uint32_t streams; // Streams that make up the file
+    uint32_t ended;   // Streams that have finished (or were abandoned)
+};
+
+typedef std::pair<uint32_t, uint32_t> TransferKey;
+
+// Live metrics of one worker (Telemetry.h), written only by its thread
+struct ReceiverStats
+{
+    explicit ReceiverStats(const string &name) : name(name) {}
+
+    // EFFECTS: This worker as a JSON object
+    string json() const;
+
+    const string name; // The worker's log path
+
+    Counter packets;      // Datagrams received
+    Counter corrupt;      // DATA / PARITY failing the length or CRC check
+    Counter data;         // DATA stored in a flow's window
+    Counter data_dropped; // DATA outside the window or already held
+    Counter parity;
+    Counter fec_rebuilt;  // Chunks rebuilt from parity
+    Counter acks_sent;
+    Counter bytes_written;
+    Counter flows_started;
+    Counter flows_finished;
+    Counter flows_failed; // Rejected over data that could not be delivered
+    Counter active_flows; // Gauge, refreshed every IDLE_FLUSH_MS
+
+    Histogram ack_delay_us; // A batch leaving recvmmsg to its ACKs leaving sendmmsg
+    Histogram write_us;     // Each pwritev() of coalesced chunks
+};
+
+// Settings and state shared by every worker thread
+struct ReceiverConfig
+{
+    int port;
+    size_t window;
+    string output_dir;
+    size_t batch_size;
+    bool use_mmsg;
+    bool binary_log;
+    bool use_gso;
+    bool use_gro;
+    size_t max_chunk; // --mtu: largest chunk START_MTU may grant
+    unsigned hash_threads; // --hash-threads: START_DELTA matching
+    string disk;           // --disk: DiskWriter backend of each worker
+    size_t disk_depth;     // --disk-depth: writes in flight per flow
+    std::atomic<unsigned> file_count; // Next i for FILE-i.out
+
+    std::mutex files_mutex;
+    std::map<TransferKey, SharedFile> shared_files;
+    // START_RESUME transfers seen since startup, by transfer_id
+    std::map<uint32_t, std::shared_ptr<Checkpoint> > checkpoints;
+};
+
+// Splits the DATA of a START_BATCH flow into its files. Each file header
+// opens the next FILE-i.out and adds a line to the flow's output, the list
+// BATCH-<transfer_id>.txt: FILE-i.out, the size, and the sender's name for
+// it. A file is closed once its last chunk is on disk
+class BatchRouter : public ChunkRouter
+{
+public:
+    BatchRouter(ReceiverConfig &config, int list_fd);
+    ~BatchRouter();
+
+    Route route(uint32_t seq, const char *data, size_t len, int &fd, uint64_t &offset);
+    void written(uint32_t seq);
+
+    // EFFECTS: Close every file still open; the flow is over
+    void close_all();
+
+private:
+    ReceiverConfig &config;
+    int list_fd;
+    uint64_t list_bytes;
+    uint32_t next_index; // BatchFileInfo.index of the next header
+    uint32_t remaining;  // Content chunks of the current file still to come
+    int file_fd;         // The current file
+    uint64_t file_offset; // Where its next chunk goes
+    // Files with writes to come: one past the last seqNum of each, and its fd
+    std::deque<std::pair<uint32_t, int> > open_files;
+};
+
+// One worker thread with its own SO_REUSEPORT socket. The kernel hashes each
+// sender's 4-tuple onto one of the sockets, so a flow always lands on the
+// same worker and flows need no locking
+class ReceiverWorker
+{
+public:
+    ReceiverWorker(ReceiverConfig &config, const string &log_path);
+    ~ReceiverWorker();
+
+    void run();
+
+private:
+    void handle_packet(const PacketHeader &header, bool valid, const char *packet, size_t len,
+                       const sockaddr_in &from);
+    void handle_start(const PacketHeader &header, const char *payload, size_t len,
+                      const sockaddr_in &from);
+    int open_output(Flow &flow);
+    std::shared_ptr<Checkpoint> open_checkpoint(const StartInfo &info);
+    void answer_resume(Flow &flow);
+    Flow *job_flow(uint64_t key, uint32_t start_seq);
+    void finish_resume(const Flow &flow);
+    void apply_delta(Flow &flow);
+    string resume_path(uint32_t transfer_id, const char *suffix) const;
+    void send_start_ack(const Flow &flow);
+    void handle_end(const PacketHeader &header, const sockaddr_in &from);
+    void handle_data(Flow &flow, const PacketHeader &header, const char *payload);
+    void handle_parity(Flow &flow, const PacketHeader &header, const char *payload);
+    bool fec_recover(Flow &flow, uint32_t first);
+    void ack_data(const Flow &flow);
+    void send_ack(uint32_t seqNum, const sockaddr_in &to);
+    void send_sack(const Flow &flow);
+    void send_reject(const Flow &flow);
+    void close_flow(Flow &flow);
+    void reject_flow(Flow &flow);
+    void reap_flows();
+
+    // LOGGING (EVERY PACKET SENT + RECEIVED)
+    void log_packet(const PacketHeader &header);
+
+    ReceiverConfig &config;
+    int sockfd;
+    std::unique_ptr<BatchIO> io;
+    HeaderLimits limits;
+    vector<PacketHeader> headers; // Decoded from each batch io received
+    vector<uint8_t> header_ok;    // Whether each passed its PacketRule
+    std::unique_ptr<DiskWriter> disk; // NULL with --disk=sync; outlives the flows
+    std::unique_ptr<JobThread> jobs;  // Resume checks and deltas, off this thread
+    PacketLog receiver_log;
+    std::unordered_map<uint64_t, std::unique_ptr<Flow> > flows;
+    std::shared_ptr<ReceiverStats> stats; // Listed by the --stats endpoint
+};
+
+class wReceiver
+{
+public:
+    wReceiver(char *argv[], const CliOptions &options);
+};
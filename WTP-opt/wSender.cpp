@@ -0,0 +1,1340 @@
+#include "wSender.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// EFFECTS: Every session this process has created, for the stats endpoint
+static StatsRegistry<SessionStats> &sender_stats()
+{
+    static StatsRegistry<SessionStats> registry;
+    return registry;
+}
+
+static const char *phase_names[] = {"idle", "starting", "started", "sending", "ending",
+                                    "done"};
+
+string SessionStats::json() const
+{
+    double seconds = std::chrono::duration<double>(Clock::now() - created).count();
+    return JsonObject()
+        .text("name", name)
+        .text("phase", phase_names[phase.get()])
+        .count("elapsed_ms", seconds * 1000)
+        .count("data_sent", data_sent.get())
+        .count("data_resent", data_resent.get())
+        .count("parity_sent", parity_sent.get())
+        .count("bytes_sent", bytes_sent.get())
+        .count("bytes_acked", bytes_acked.get())
+        .count("acks", acks.get())
+        .count("fast_retransmits", fast_retransmits.get())
+        .count("timeouts", timeouts.get())
+        .count("cwnd", cwnd.get())
+        .count("in_flight", in_flight.get())
+        .count("srtt_us", srtt_us.get())
+        .count("rto_us", rto_us.get())
+        .number("goodput_mbit", bytes_acked.get() * 8 / 1e6 / std::max(seconds, 1e-3))
+        .raw("rtt_us", rtt_us.json())
+        .raw("ack_latency_us", ack_latency_us.json())
+        .str();
+}
+
+// REQUIRES: None
+// MODIFIES: outfile
+// EFFECTS: Write one packet header to the sender log
+void wSender::log_packet(const PacketHeader &header)
+{
+    sender_log.log(header);
+}
+
+// REQUIRES: phase is STARTING or ENDING
+// MODIFIES: control_tries, control_sent, control_deadline
+// EFFECTS: (Re)send the START or END header, with the StartInfo (and
+//          DeltaInfo) as START payload if there is one (zero-padded to
+//          probe_bytes while probing the MTU), and arm its retry deadline
+void wSender::send_control()
+{
+    // Zero padding for probes; never changes, so queued datagrams may point
+    // at it until they are flushed
+    static const vector<char> padding(MAX_MTU, 0);
+
+    char send_buf[sizeof(PacketHeader) + sizeof(StartInfo) + sizeof(DeltaInfo)];
+    size_t send_len = sizeof(PacketHeader);
+    size_t pad = 0;
+    if (control.type == 0 && has_start_info)
+    {
+        encode_wire(start_info, send_buf + send_len);
+        send_len += sizeof(StartInfo);
+        if (start_info.flags & START_DELTA)
+        {
+            memcpy(send_buf + send_len, &delta_info, sizeof(DeltaInfo));
+            send_len += sizeof(DeltaInfo);
+        }
+        pad = probe_bytes > send_len ? probe_bytes - send_len : 0;
+        control.length = send_len - sizeof(PacketHeader) + pad;
+        control.checksum = crc32_update(crc32(send_buf + sizeof(PacketHeader),
+                                              send_len - sizeof(PacketHeader)),
+                                        &padding[0], pad);
+    }
+    encode_header(control, send_buf);
+
+    io->queue(send_buf, send_len, &padding[0], pad, recv_addr);
+    log_packet(control);
+
+    ++control_tries;
+    control_sent = Clock::now();
+    control_deadline = control_sent + rtt.current_rto();
+}
+
+// REQUIRES: phase is STARTING or ENDING, ack.type == 3
+// MODIFIES: phase, accepted_flags, rtt
+// EFFECTS: Finish the handshake if ack carries the control seqNum. A START
+//          ACK with a StartInfo payload says which requested flags were
+//          accepted; a bare ACK accepts none. ResumeRuns may follow it
+void wSender::handle_control_ack(const PacketHeader &ack, const char *payload, size_t len)
+{
+    if (ack.seqNum != control.seqNum)
+        return;
+
+    if (control_tries == 1)
+    {
+        RttEstimator::usec sample = std::chrono::duration_cast<RttEstimator::usec>(
+            Clock::now() - control_sent);
+        rtt.sample(sample);
+        stats->rtt_us.record(sample.count());
+    }
+
+    if (phase == ENDING)
+    {
+        phase = DONE;
+        return;
+    }
+
+    accepted_flags = 0;
+    resume_runs.clear();
+    if (has_start_info && len == ack.length && len >= sizeof(StartInfo) &&
+        len <= sizeof(StartInfo) + RESUME_MAX_RUNS * sizeof(ResumeRun) &&
+        (len - sizeof(StartInfo)) % sizeof(ResumeRun) == 0 &&
+        crc32(payload, len) == ack.checksum)
+    {
+        StartInfo reply = decode_wire<StartInfo>(payload);
+        accepted_flags = reply.flags & start_info.flags;
+        if (accepted_flags & START_MTU)
+            chunk_size = std::max<size_t>(FILE_CHUNK_SIZE,
+                                          std::min(reply.max_chunk, start_info.max_chunk));
+        if (accepted_flags & START_RESUME)
+        {
+            resume_runs.resize((len - sizeof(StartInfo)) / sizeof(ResumeRun));
+            decode_wire(payload + sizeof(StartInfo), resume_runs.size(), resume_runs.data());
+        }
+    }
+    sack = accepted_flags & START_SACK;
+    if (!(accepted_flags & START_FEC))
+        fec_block = 0;
+
+    phase = STARTED;
+    if (has_range)
+        begin_data();
+}
+
+// REQUIRES: phase == STARTED, has_range
+// MODIFIES: chunks, packed, batch, phase, pacer, fec_rows
+// EFFECTS: Open the range in chunks of the negotiated size (or start
+//          compressing it into payloads of that size, or open the batch)
+//          and start the sliding window at seqNum 1
+void wSender::begin_data()
+{
+    size_t size = fec_block ? FEC_CHUNK_SIZE(chunk_size) : chunk_size;
+    bool compress = accepted_flags & START_COMPRESS;
+    size_t read_size = compress ? COMPRESS_INPUT_BYTES : size;
+    size_t read_window = compress ? 2 : window;
+    ChunkSource *source = NULL;
+    if (batch_in)
+        batch.reset(new BatchChunks(*batch_in, size, window));
+    else if (buffer_in)
+        source = new ChunkSource(buffer_in->data(), buffer_in->size(), read_size, read_window);
+    else
+        source = new ChunkSource(file_in, read_size, read_window, range_offset, range_length);
+    if (compress)
+    {
+        packed.reset(new CompressedChunks(source, size, COMPRESS_MAX_RATIO * chunk_size,
+                                          window));
+        loop.watch(packed->wake_fd(), EPOLLIN, this);
+    }
+    else if (source)
+        chunks.reset(source);
+    pacer.set_packet_size(sizeof(PacketHeader) + chunk_size);
+    if (fec_block)
+        fec_rows.assign(std::min<uint32_t>(fec_block, FEC_MAX_PARITY),
+                        vector<uint8_t>(FEC_SYMBOL_SIZE(chunk_size)));
+    phase = SENDING;
+}
+
+// REQUIRES: Every DATA packet has been ACKed
+// MODIFIES: chunks, packed, batch, control, phase
+// EFFECTS: Release the input and begin the END handshake
+void wSender::begin_end()
+{
+    chunks.reset();
+    if (packed)
+        loop.unwatch(packed->wake_fd());
+    packed.reset();
+    batch.reset();
+    phase = ENDING;
+    control.type = 1;
+    control.length = 0;
+    control.checksum = 0;
+    control_tries = 0;
+    send_control();
+}
+
+// REQUIRES: seqNum lies in [base_seq, next_seq]
+// MODIFIES: ring, timers
+// EFFECTS: Queue a single DATA packet for (re)sending and arm its timer
+void wSender::transmit(uint32_t seqNum)
+{
+    PacketData &packet = ring[seqNum % window];
+
+    // Goes out with the rest of the batch on the next flush; the payload is
+    // gathered straight from the chunk, and header + CRC are reused as is
+    io->queue(packet.wire, sizeof(packet.wire),
+              packet.chunk.data, packet.chunk.size, recv_addr);
+    if (packet.retransmitted)
+    {
+        pacer.force(sizeof(PacketHeader) + packet.chunk.size); // Never held back
+        stats->data_resent.add();
+    }
+    log_packet(packet.header);
+    stats->data_sent.add();
+    stats->bytes_sent.add(packet.chunk.size);
+
+    packet.send_time = Clock::now();
+    TimerEntry timer = {seqNum, packet.send_time,
+                        packet.send_time + rtt.current_rto()};
+    timers.push(timer);
+}
+
+// EFFECTS: Point chunk at DATA payload #index from whichever source is open;
+//          false past the end of the input
+bool wSender::next_chunk(uint32_t index, Chunk &chunk)
+{
+    if (packed)
+        return packed->get(index, chunk);
+    return batch ? batch->get(index, chunk) : chunks->get(index, chunk);
+}
+
+// REQUIRES: None
+// MODIFIES: ring, next_seq, input_done
+// EFFECTS: Send every new chunk that fits in the congestion window (at most
+//          [base_seq, base_seq + window)), pausing while the socket buffer is
+//          full or until pace_deadline when the pacer is out of tokens
+void wSender::fill_window()
+{
+    Chunk chunk;
+    uint32_t limit = std::min(window, cc->window());
+    if (pace_auto)
+        pacer.set_window_rate(limit, cc->in_slow_start(), rtt.current_srtt());
+    pace_deadline = Clock::time_point::max();
+    while (!input_done && next_seq < base_seq + limit && !io->blocked())
+    {
+        if (packed && packed->pending(next_seq - 1))
+            break; // The compressor wakes the loop when it is ready
+        if (!next_chunk(next_seq - 1, chunk))
+        {
+            input_done = true;
+            if (fec_block && next_seq > fec_start)
+                fec_emit(); // Short last block
+            break;
+        }
+        if (!pacer.consume(sizeof(PacketHeader) + chunk.size))
+        {
+            pace_deadline = pacer.ready_at(sizeof(PacketHeader) + chunk.size);
+            break;
+        }
+
+        PacketData &packet = ring[next_seq % window];
+        packet.header.type = PACKET_DATA;
+        packet.header.seqNum = next_seq;
+        packet.header.length = chunk.size;
+        packet.header.checksum = chunk.checksum; // Cached by ChunkSource
+        encode_header(packet.header, packet.wire);
+        packet.chunk = chunk;
+        packet.acked = false;
+        packet.retransmitted = false;
+        packet.loss_seen = false;
+        packet.fec_after = 0;
+
+        transmit(next_seq);
+        packet.first_sent = packet.send_time;
+        ++next_seq;
+        if (fec_block)
+            fec_add(packet);
+    }
+}
+
+// REQUIRES: fec_block > 0; packet is the DATA packet just sent for the
+//           first time, next_seq - 1
+// MODIFIES: fec_rows, fec_parity, fec_sent
+// EFFECTS: Fold the packet into the open block's parity symbols, choosing
+//          how much parity the block gets when it is the first; emit the
+//          parity once the block is full
+void wSender::fec_add(const PacketData &packet)
+{
+    uint32_t col = packet.header.seqNum - fec_start;
+    if (col == 0)
+    {
+        fec_parity = fec_fixed;
+        if (!fec_parity)
+        {
+            double expected = fec_lost / std::max(1.0, fec_sent) * fec_block;
+            fec_parity = std::max(1.0, std::ceil(FEC_REDUNDANCY * expected));
+        }
+        fec_parity = std::min<uint32_t>(fec_parity, std::min<uint32_t>(fec_block,
+                                                                        FEC_MAX_PARITY));
+        for (uint32_t j = 0; j < fec_parity; ++j)
+            std::fill(fec_rows[j].begin(), fec_rows[j].end(), 0);
+    }
+
+    uint8_t len[sizeof(uint16_t)]; // The symbol's length prefix, big-endian
+    store_big_endian((uint16_t)packet.chunk.size, len);
+    for (uint32_t j = 0; j < fec_parity; ++j)
+    {
+        uint8_t c = fec_coefficient(j, col);
+        fec_mul_add(&fec_rows[j][0], len, c, sizeof(len));
+        fec_mul_add(&fec_rows[j][sizeof(len)], (const uint8_t *)packet.chunk.data, c,
+                    packet.chunk.size);
+    }
+
+    if (++fec_sent >= FEC_LOSS_HISTORY)
+    {
+        fec_sent /= 2;
+        fec_lost /= 2;
+    }
+    if (col + 1 == fec_block)
+        fec_emit();
+}
+
+// REQUIRES: fec_block > 0; the open block [fec_start, next_seq) is not empty
+// MODIFIES: fec_out, ring, fec_start
+// EFFECTS: Queue the block's PARITY packets (charged to the pacer, not the
+//          window) and open the next block
+void wSender::fec_emit()
+{
+    FecInfo info = {(uint16_t)(next_seq - fec_start), 0, (uint8_t)fec_parity};
+    for (uint32_t j = 0; j < fec_parity; ++j)
+    {
+        info.parity_index = j;
+        fec_out.emplace_back(sizeof(FecInfo) + FEC_SYMBOL_SIZE(chunk_size));
+        vector<uint8_t> &payload = fec_out.back();
+        encode_wire(info, &payload[0]);
+        memcpy(&payload[sizeof(info)], &fec_rows[j][0], FEC_SYMBOL_SIZE(chunk_size));
+
+        PacketHeader parity{PACKET_PARITY, fec_start, (unsigned)payload.size(),
+                            crc32(&payload[0], payload.size())};
+        char wire[sizeof(PacketHeader)];
+        encode_header(parity, wire);
+        io->queue(wire, sizeof(wire), &payload[0], payload.size(), recv_addr);
+        pacer.force(sizeof(PacketHeader) + payload.size());
+        log_packet(parity);
+        stats->parity_sent.add();
+    }
+
+    // Holes in this block may now be rebuilt by the receiver; apply_sack
+    // waits until it has seen data sent after the parity before resending
+    for (uint32_t seq = std::max(fec_start, base_seq); seq < next_seq; ++seq)
+        ring[seq % window].fec_after = next_seq;
+    fec_start = next_seq;
+}
+
+// MODIFIES: packet, fec_lost
+// EFFECTS: Count packet towards the FEC loss estimate, once
+void wSender::count_loss(PacketData &packet)
+{
+    if (!packet.loss_seen)
+    {
+        packet.loss_seen = true;
+        ++fec_lost;
+    }
+}
+
+// REQUIRES: ack.type == 3; sack_words holds count SACK words (count may be 0)
+// MODIFIES: ring, base_seq, cc
+// EFFECTS: Slide the window up to the cumulative ACK and release the chunks.
+//          The packet that completed the ACK gives an RTT sample (Karn).
+//          Without SACK, repeated ACKs for base_seq mean it was lost: resend
+//          it early and tell the congestion controller, once per window
+void wSender::process_ack(const PacketHeader &ack, const uint64_t *sack_words,
+                          size_t count)
+{
+    // Ignore stale ACKs and anything claiming data we never sent
+    if (ack.seqNum < base_seq || ack.seqNum > next_seq)
+        return;
+
+    if (ack.seqNum == base_seq)
+    {
+        if (sack)
+            apply_sack(sack_words, count);
+        else if (base_seq < next_seq && ++dup_acks == DUP_ACK_THRESHOLD)
+        {
+            if (base_seq >= recover_seq)
+            {
+                cc->on_loss();
+                recover_seq = next_seq;
+            }
+            count_loss(ring[base_seq % window]);
+            ring[base_seq % window].retransmitted = true;
+            stats->fast_retransmits.add();
+            transmit(base_seq);
+        }
+        return;
+    }
+
+    // A resent packet anywhere in the newly acked range makes the sample
+    // ambiguous, since the ACK may have been held back by it
+    bool clean_sample = true;
+    Clock::time_point now = Clock::now();
+    for (uint32_t seq = base_seq; seq < ack.seqNum; ++seq)
+    {
+        PacketData &packet = ring[seq % window];
+        packet.acked = true;
+        clean_sample = clean_sample && !packet.retransmitted;
+        stats->bytes_acked.add(packet.chunk.size);
+        stats->ack_latency_us.record(
+            std::chrono::duration_cast<RttEstimator::usec>(now - packet.first_sent).count());
+    }
+    RttEstimator::usec sample(0);
+    if (clean_sample)
+    {
+        sample = std::chrono::duration_cast<RttEstimator::usec>(
+            now - ring[(ack.seqNum - 1) % window].send_time);
+        rtt.sample(sample);
+        rtt.log_if_moved(sender_log);
+        stats->rtt_us.record(sample.count());
+    }
+    cc->on_ack(ack.seqNum - base_seq, sample);
+    dup_acks = 0;
+    base_seq = ack.seqNum;
+    if (packed)
+        packed->release(base_seq - 1);
+    else if (batch)
+        batch->release(base_seq - 1);
+    else
+        chunks->release(base_seq - 1);
+    if (sack)
+        apply_sack(sack_words, count);
+}
+
+// REQUIRES: sack; sack_words describes the packets after base_seq
+// MODIFIES: ring, cc
+// EFFECTS: Mark SACKed packets so their timers lapse, then resend every
+//          hole with at least DUP_ACK_THRESHOLD SACKed packets above it.
+//          Each hole is resent this way once; if that copy is lost too, its
+//          timer takes over. The controller hears of it once per window.
+//          A hole whose block parity is out is left to FEC until data sent
+//          after that parity has been SACKed
+void wSender::apply_sack(const uint64_t *sack_words, size_t count)
+{
+    uint32_t end = std::min<uint64_t>(next_seq, (uint64_t)base_seq + 1 + count * 64);
+    uint32_t held_above = 0;
+    uint32_t highest = 0; // Highest SACKed seqNum
+    for (uint32_t seq = end; seq-- > base_seq;)
+    {
+        PacketData &packet = ring[seq % window];
+        uint32_t bit = seq - base_seq - 1;
+        if (seq > base_seq && (sack_words[bit / 64] >> (bit % 64)) & 1)
+        {
+            packet.acked = true;
+            highest = std::max(highest, seq);
+            ++held_above;
+            continue;
+        }
+        if (held_above < DUP_ACK_THRESHOLD || packet.acked || packet.retransmitted)
+            continue;
+        count_loss(packet);
+        if (packet.fec_after && highest < packet.fec_after)
+            continue;
+
+        if (seq >= recover_seq)
+        {
+            cc->on_loss();
+            recover_seq = next_seq;
+        }
+        packet.retransmitted = true;
+        stats->fast_retransmits.add();
+        transmit(seq);
+    }
+}
+
+// EFFECTS: True if timer belongs to a packet that was since ACKed, SACKed
+//          or resent
+bool wSender::timer_stale(const TimerEntry &timer) const
+{
+    const PacketData &packet = ring[timer.seqNum % window];
+    return timer.seqNum < base_seq || packet.acked ||
+           packet.send_time != timer.send_time;
+}
+
+// REQUIRES: None
+// MODIFIES: ring, timers
+// EFFECTS: Resend only the packets whose own timer has expired. The RTO is
+//          backed off only when the oldest unacked packet expires; packets
+//          stuck behind that hole time out as a consequence, not as new losses
+void wSender::check_timeouts()
+{
+    Clock::time_point now = Clock::now();
+    while (!timers.empty())
+    {
+        TimerEntry timer = timers.top();
+        if (timer_stale(timer))
+        {
+            timers.pop(); // Acked or already resent
+            continue;
+        }
+        if (now < timer.deadline)
+            break;
+
+        timers.pop();
+        if (timer.seqNum == base_seq)
+        {
+            count_loss(ring[base_seq % window]);
+            rtt.backoff();
+            rtt.log_if_moved(sender_log);
+            cc->on_timeout();
+            recover_seq = next_seq;
+        }
+        ring[timer.seqNum % window].retransmitted = true;
+        stats->timeouts.add();
+        transmit(timer.seqNum);
+    }
+}
+
+// REQUIRES: None
+// MODIFIES: ring, base_seq, phase
+// EFFECTS: Drain every queued ACK a batch at a time without blocking and
+//          hand each to the current phase
+void wSender::drain_acks()
+{
+    size_t n;
+    HeaderLimits limits = {(uint32_t)chunk_size, (uint32_t)ACK_MAX_PAYLOAD};
+    while ((n = io->receive()) > 0)
+    {
+        if (ack_headers.size() < n)
+        {
+            ack_headers.resize(n);
+            ack_ok.resize(n);
+        }
+        decode_headers(*io, n, limits, &ack_headers[0], &ack_ok[0]);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (io->length(i) < sizeof(PacketHeader))
+                continue;
+
+            const PacketHeader &ack = ack_headers[i];
+            log_packet(ack);
+            if (ack_ok[i] && ack.type == PACKET_END && ack.seqNum == control.seqNum)
+                throw std::runtime_error("ERROR receiver rejected the transfer");
+            if (ack.type != PACKET_ACK || !ack_ok[i])
+                continue;
+            stats->acks.add();
+
+            const char *payload = io->packet(i) + sizeof(PacketHeader);
+            size_t len = io->length(i) - sizeof(PacketHeader);
+            if (phase == STARTING || phase == ENDING)
+                handle_control_ack(ack, payload, len);
+            else if (phase == SENDING && len == 0)
+                process_ack(ack, NULL, 0);
+            else if (phase == SENDING && sack && len % sizeof(uint64_t) == 0 &&
+                     len <= SACK_MAX_WORDS * sizeof(uint64_t) &&
+                     crc32(payload, len) == ack.checksum)
+            {
+                uint64_t words[SACK_MAX_WORDS];
+                for (size_t w = 0; w < len / sizeof(uint64_t); ++w)
+                    words[w] = load_big_endian<uint64_t>(payload + w * sizeof(uint64_t));
+                process_ack(ack, words, len / sizeof(uint64_t));
+            }
+        }
+        if (n < io->batch_size())
+            break; // Socket drained
+    }
+}
+
+// REQUIRES: None
+// MODIFIES: io, want_write
+// EFFECTS: Push queued datagrams to the kernel; while the socket buffer is
+//          full, watch for writability instead of spinning
+void wSender::flush()
+{
+    bool drained = io->flush();
+    if (drained)
+        fec_out.clear();
+    if (drained == want_write)
+    {
+        want_write = !drained;
+        loop.modify(sockfd, want_write ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+}
+
+// REQUIRES: None
+// MODIFIES: loop
+// EFFECTS: Give the loop this session's next deadline: the handshake retry,
+//          or the earliest live retransmission timer
+void wSender::rearm()
+{
+    Clock::time_point deadline = Clock::time_point::max();
+    if (phase == STARTING || phase == ENDING)
+        deadline = control_deadline;
+    else if (phase == SENDING)
+    {
+        while (!timers.empty() && timer_stale(timers.top()))
+            timers.pop(); // Acked or already resent
+        if (!timers.empty())
+            deadline = timers.top().deadline;
+        deadline = std::min(deadline, pace_deadline);
+    }
+
+    if (deadline == timer_set)
+        return;
+    timer_set = deadline;
+    if (deadline == Clock::time_point::max())
+        loop.cancel_timer(this);
+    else
+        loop.set_timer(this, deadline);
+}
+
+// REQUIRES: None
+// MODIFIES: ring, phase
+// EFFECTS: Refill the window (or move on to END once every packet is
+//          ACKed), then flush, re-arm and refresh the gauges
+void wSender::advance()
+{
+    if (phase == SENDING)
+    {
+        fill_window();
+        if (input_done && base_seq == next_seq)
+            begin_end();
+    }
+    flush();
+    rearm();
+
+    stats->phase.set(phase);
+    stats->cwnd.set(cc->window());
+    stats->in_flight.set(next_seq - base_seq);
+    stats->srtt_us.set(rtt.current_srtt().count());
+    stats->rto_us.set(rtt.current_rto().count());
+}
+
+// EFFECTS: The socket has ACKs to read and/or room to write, or the
+//          compressor has payloads ready
+void wSender::on_io(int fd, uint32_t events)
+{
+    if (packed && fd == packed->wake_fd())
+        packed->clear_wake();
+    else if (events & EPOLLIN)
+        drain_acks();
+    advance();
+}
+
+// EFFECTS: A handshake retry or a retransmission timer is due
+void wSender::on_timer()
+{
+    timer_set = Clock::time_point::max(); // The loop has consumed it
+    if (phase == STARTING || phase == ENDING)
+    {
+        if (Clock::now() >= control_deadline)
+        {
+            if (phase == STARTING && probe_bytes && control_tries >= MTU_PROBE_TRIES)
+            {
+                // The path (or receiver) drops packets this big: plain MTU
+                probe_bytes = 0;
+                start_info.flags &= ~START_MTU;
+                control_tries = 0;
+                send_control();
+            }
+            else if (control_tries >= MAX_HANDSHAKE_TRIES)
+            {
+                if (phase == STARTING)
+                    throw std::runtime_error("ERROR receiver never ACKed START");
+                // Every chunk was ACKed, but only the END ACK says the file
+                // was completed: without it the transfer did not succeed
+                throw std::runtime_error("ERROR receiver never ACKed END");
+            }
+            else
+            {
+                rtt.backoff();
+                send_control();
+            }
+        }
+    }
+    else if (phase == SENDING)
+        check_timeouts();
+    advance();
+}
+
+// EFFECTS: MTU of the route to `to` as the kernel knows it (interface MTU,
+//          or a smaller path MTU it has learned); DEFAULT_MTU if unknown
+static size_t route_mtu(const sockaddr_in &to)
+{
+    size_t mtu = DEFAULT_MTU;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return mtu;
+    int value;
+    socklen_t len = sizeof(value);
+    if (connect(fd, (const sockaddr *)&to, sizeof(to)) == 0 &&
+        getsockopt(fd, IPPROTO_IP, IP_MTU, &value, &len) == 0 && value > 0)
+        mtu = value;
+    close(fd);
+    return mtu;
+}
+
+// REQUIRES: argc >= 6
+// MODIFIES: loop
+// EFFECTS: Open the session's socket and log and register with the loop;
+//          nothing is sent yet
+wSender::wSender(char *argv[], const CliOptions &options, const string &log_path,
+                 EventLoop &loop)
+    : stats(sender_stats().add(new SessionStats(log_path))), loop(loop), io(NULL), want_write(false),
+      sender_log(log_path, options.has("binary-log")), phase(IDLE),
+      has_start_info(false), sack_requested(!options.has("no-sack")),
+      compress_requested(options.has("compress")),
+      accepted_flags(0), probe_bytes(0), control_tries(0),
+      buffer_in(NULL), batch_in(NULL), range_offset(0), range_length(0), has_range(false),
+      chunk_size(FILE_CHUNK_SIZE),
+      rtt(std::chrono::milliseconds(INITIAL_RTO_MS),
+          std::chrono::milliseconds(options.get_long("rto-min", DEFAULT_RTO_MIN_MS)),
+          std::chrono::milliseconds(options.get_long("rto-max", DEFAULT_RTO_MAX_MS))),
+      timer_set(Clock::time_point::max()), dup_acks(0), recover_seq(1), sack(false),
+      pacer(MAX_SEND_DATA), pace_auto(false), pace_deadline(Clock::time_point::max()),
+      base_seq(1), next_seq(1), input_done(false),
+      fec_block(options.get_long("fec", 0)), fec_fixed(options.get_long("fec-parity", 0)),
+      fec_start(1), fec_parity(0), fec_sent(0), fec_lost(0)
+{
+    // Non-blocking: a full send buffer parks the batch until EPOLLOUT
+    sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    check_error(sockfd);
+
+    // Receiver details
+    memset(&recv_addr, 0, sizeof(recv_addr));
+    recv_addr.sin_family = AF_INET;
+    recv_addr.sin_port = htons(std::stoi(argv[2]));
+    recv_addr.sin_addr.s_addr = inet_addr(argv[1]);
+
+    // --mtu=BYTES|auto: anything past DEFAULT_MTU is probed with a padded
+    // START; DF keeps the kernel from fragmenting instead
+    size_t mtu = DEFAULT_MTU;
+    string mtu_option = options.get("mtu", "");
+    if (mtu_option == "auto")
+        mtu = route_mtu(recv_addr);
+    else if (!mtu_option.empty())
+        mtu = std::stoul(mtu_option);
+    mtu = std::min<size_t>(mtu, MAX_MTU);
+    if (mtu < DEFAULT_MTU)
+        chunk_size = std::max<long>(mtu - UDP_IP_HEADERS - (long)sizeof(PacketHeader), 64);
+    if (mtu > DEFAULT_MTU)
+    {
+        probe_bytes = mtu - UDP_IP_HEADERS;
+        int pmtu = IP_PMTUDISC_DO;
+        setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu, sizeof(pmtu));
+    }
+
+    io = new BatchIO(sockfd, options.get_long("batch", DEFAULT_BATCH_SIZE),
+                     std::max<size_t>(mtu, DEFAULT_MTU) - UDP_IP_HEADERS,
+                     !options.has("no-mmsg"));
+    if (!options.has("no-gso"))
+        io->enable_gso();
+    if (!options.has("no-gro"))
+        io->enable_gro();
+
+    window = std::stoul(argv[3]);
+    if (window == 0)
+        throw std::runtime_error("ERROR window-size must be positive");
+    ring.resize(window);
+    cc = CongestionControl::create(options.get("cc", "reno"), window);
+    pace_auto = configure_pacing(pacer, options.get("pace", ""), sockfd);
+    if (fec_block > FEC_MAX_DATA)
+        throw std::runtime_error("ERROR --fec block must be at most " +
+                                 std::to_string(FEC_MAX_DATA));
+
+    // START and END share a random seqNum, as the receiver expects
+    std::random_device rd;
+    control = PacketHeader{0, (uint32_t)rd(), 0, 0};
+
+    loop.watch(sockfd, EPOLLIN, this);
+}
+
+wSender::~wSender()
+{
+    loop.cancel_timer(this);
+    loop.unwatch(sockfd);
+    if (packed)
+        loop.unwatch(packed->wake_fd());
+    delete io;
+    close(sockfd);
+}
+
+// REQUIRES: phase == IDLE
+// MODIFIES: phase, control
+// EFFECTS: Send START; the loop carries the handshake from here
+void wSender::start(const StartInfo *info, const DeltaInfo *delta)
+{
+    has_start_info = info != NULL || sack_requested || fec_block || probe_bytes ||
+                     compress_requested;
+    if (info)
+        start_info = *info;
+    else
+        start_info = StartInfo{0, 0, 0, 1, 0, 0, 0, 0};
+    if (probe_bytes)
+    {
+        start_info.flags |= START_MTU;
+        start_info.max_chunk = probe_bytes - sizeof(PacketHeader);
+    }
+    if (sack_requested)
+        start_info.flags |= START_SACK;
+    if (fec_block)
+        start_info.flags |= START_FEC;
+    if (compress_requested)
+        start_info.flags |= START_COMPRESS;
+    if (delta)
+    {
+        delta_info = *delta;
+        start_info.flags |= START_DELTA;
+    }
+    phase = STARTING;
+    send_control();
+    advance();
+}
+
+// REQUIRES: start() has been called
+// MODIFIES: range, phase
+// EFFECTS: Remember the range; data flows as soon as START is ACKed
+void wSender::transfer(const string &file, uint64_t offset, uint64_t length)
+{
+    file_in = file;
+    range_offset = offset;
+    range_length = length;
+    has_range = true;
+    if (phase == STARTED)
+    {
+        begin_data();
+        advance();
+    }
+}
+
+// REQUIRES: start() has been called
+// MODIFIES: range, phase
+// EFFECTS: As above, for a buffer
+void wSender::transfer(const vector<char> &data)
+{
+    buffer_in = &data;
+    transfer(string(), 0, data.size());
+}
+
+// REQUIRES: start() has been called with START_BATCH, and it was accepted
+// MODIFIES: range, phase
+// EFFECTS: As above, for a batch of files
+void wSender::transfer(const vector<BatchFile> &files)
+{
+    batch_in = &files;
+    transfer(string(), 0, 0);
+}
+
+// EFFECTS: Event-loop threads for `streams` concurrent sessions: one per
+//          stream, up to one per core
+static unsigned loop_threads(uint32_t streams)
+{
+    return std::max(1u, std::min<unsigned>(streams, std::thread::hardware_concurrency()));
+}
+
+// EFFECTS: Run body(t, loop) for t in [0, threads), each on its own thread
+//          with its own event loop, and wait for all of them; then rethrow
+//          the first exception any of them threw
+static void run_on_loops(unsigned threads, const std::function<void(unsigned, EventLoop &)> &body)
+{
+    vector<std::exception_ptr> errors(threads);
+    vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        pool.emplace_back([&, t]() {
+            try
+            {
+                EventLoop loop;
+                body(t, loop);
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (size_t t = 0; t < pool.size(); ++t)
+        pool[t].join();
+    for (size_t t = 0; t < errors.size(); ++t)
+        if (errors[t])
+            std::rethrow_exception(errors[t]);
+}
+
+// REQUIRES: streams > 1
+// MODIFIES: None
+// EFFECTS: Split the input file into `streams` chunk-aligned byte ranges and
+//          send each over its own session. Sessions are dealt round-robin
+//          to loop_threads() threads, each driving its share from its own
+//          event loop, so CRC, compression and syscalls use every core.
+//          Stream k logs to <log>.k. If the receiver does not accept
+//          START_RANGE on stream 0, that session carries the whole file
+//          instead
+static void send_parallel(char *argv[], const CliOptions &options, uint32_t streams)
+{
+    string file_in(argv[4]);
+    struct stat st;
+    if (stat(file_in.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        throw std::runtime_error("ERROR --streams needs a regular input file");
+
+    // Whole chunks per stream so every range starts on a chunk boundary
+    uint64_t file_size = st.st_size;
+    uint64_t total_chunks = (file_size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+    streams = std::max<uint64_t>(1, std::min<uint64_t>(streams, total_chunks));
+    uint64_t per_stream = (total_chunks + streams - 1) / streams;
+
+    // Stream k sends [offset(k), offset(k + 1))
+    std::random_device rd;
+    uint32_t transfer_id = rd();
+    vector<StartInfo> infos(streams + 1);
+    for (uint32_t k = 0; k <= streams; ++k)
+    {
+        uint64_t offset = std::min(file_size, k * per_stream * FILE_CHUNK_SIZE);
+        infos[k] = StartInfo{START_RANGE, transfer_id, k, streams, offset, file_size, 0, 0};
+    }
+
+    // Stream 0's START decides for all of them
+    std::promise<bool> range_promise;
+    std::shared_future<bool> range_accepted = range_promise.get_future().share();
+    string log_base(argv[5]);
+    unsigned threads = loop_threads(streams);
+    run_on_loops(threads, [&](unsigned t, EventLoop &loop) {
+        vector<std::unique_ptr<wSender> > sessions;
+        if (t == 0)
+        {
+            try
+            {
+                sessions.emplace_back(new wSender(argv, options, log_base + ".0", loop));
+                sessions[0]->start(&infos[0]);
+                loop.run([&]() { return sessions[0]->started(); });
+            }
+            catch (...)
+            {
+                range_promise.set_exception(std::current_exception());
+                throw;
+            }
+            bool ranges = sessions[0]->accepted() & START_RANGE;
+            range_promise.set_value(ranges);
+            if (!ranges)
+            {
+                // Plain receiver: this is now an ordinary single-stream transfer
+                sessions[0]->transfer(file_in, 0, UINT64_MAX);
+                loop.run([&]() { return sessions[0]->finished(); });
+                return;
+            }
+            sessions[0]->transfer(file_in, 0, infos[1].offset);
+        }
+        else if (!range_accepted.get())
+            return;
+
+        for (uint32_t k = t ? t : threads; k < streams; k += threads)
+        {
+            sessions.emplace_back(new wSender(argv, options,
+                                              log_base + "." + std::to_string(k), loop));
+            sessions.back()->start(&infos[k]);
+            sessions.back()->transfer(file_in, infos[k].offset,
+                                      infos[k + 1].offset - infos[k].offset);
+        }
+        loop.run([&]() {
+            for (size_t i = 0; i < sessions.size(); ++i)
+                if (!sessions[i]->finished())
+                    return false;
+            return true;
+        });
+    });
+}
+
+// REQUIRES: fd is open for reading
+// EFFECTS: True if the bytes run describes read back with its CRC
+static bool run_matches(int fd, const ResumeRun &run)
+{
+    vector<char> buf(RESUME_UNIT_BYTES);
+    uint32_t crc = 0;
+    for (uint64_t done = 0; done < run.length;)
+    {
+        size_t want = std::min<uint64_t>(buf.size(), run.length - done);
+        ssize_t n = pread(fd, &buf[0], want, run.offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        crc = crc32_update(crc, &buf[0], n);
+        done += n;
+    }
+    return crc == run.checksum;
+}
+
+// REQUIRES: fd is open on a regular file of file_size bytes
+// EFFECTS: The DeltaSignatures of every block of the file, encoded
+static vector<char> file_signatures(int fd, uint64_t file_size, unsigned threads)
+{
+    vector<DeltaSignature> sigs;
+    if (file_size > 0)
+    {
+        void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            throw std::runtime_error("ERROR mapping input file");
+        madvise(map, file_size, MADV_SEQUENTIAL);
+        sigs = delta_signatures(static_cast<const char *>(map), file_size, threads);
+        munmap(map, file_size);
+    }
+    vector<char> bytes(sigs.size() * sizeof(DeltaSignature));
+    encode_wire(sigs.data(), sigs.size(), bytes.data());
+    return bytes;
+}
+
+// REQUIRES: --resume or --delta
+// MODIFIES: None
+// EFFECTS: Send the input file as a resumable transfer. Its transfer_id
+//          comes from the file's name and size, so a rerun after a failure
+//          finds the receiver's checkpoint.
+//          With --delta=BASIS a session (<log>.delta) first sends the
+//          file's block signatures, hashed on --hash-threads threads, and
+//          the receiver fills in every block it finds in BASIS.
+//          Resume queries (<log>, then <log>.queryN) return the runs of
+//          ranges the receiver already has; runs whose CRC matches the
+//          local file are skipped and the rest is split into range-aligned
+//          pieces, sent as START_RANGE | START_RESUME sessions, at most
+//          `streams` at a time over loop_threads() event loops. Piece k
+//          logs to <log>.k.
+//          A receiver that does not accept START_DELTA / START_RESUME gets
+//          the whole file over that first session instead
+static void send_resumable(char *argv[], const CliOptions &options, uint32_t streams)
+{
+    string file_in(argv[4]);
+    int fd = open(file_in.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        throw std::runtime_error("ERROR --resume needs a regular input file");
+    uint64_t file_size = st.st_size;
+    string name = file_in.substr(file_in.find_last_of('/') + 1);
+    uint32_t transfer_id = crc32_update(crc32(name.data(), name.size()),
+                                        &file_size, sizeof(file_size));
+    string log_base(argv[5]);
+    EventLoop loop;
+
+    string basis = options.get("delta", "");
+    if (!basis.empty())
+    {
+        if (basis.size() >= DELTA_MAX_NAME || basis[0] == '.' ||
+            basis.find('/') != string::npos)
+            throw std::runtime_error("ERROR --delta takes a file name in the receiver's "
+                                     "output directory");
+        DeltaInfo delta;
+        memset(&delta, 0, sizeof(delta));
+        memcpy(delta.basis, basis.data(), basis.size());
+        vector<char> sigs = file_signatures(
+            fd, file_size, options.get_long("hash-threads", std::thread::hardware_concurrency()));
+
+        wSender session(argv, options, log_base + ".delta", loop);
+        StartInfo info{START_DELTA, transfer_id, 0, 1, 0, file_size, 0, 0};
+        session.start(&info, &delta);
+        loop.run([&]() { return session.started(); });
+        if (session.accepted() & START_DELTA)
+            session.transfer(sigs);
+        else
+        {
+            session.transfer(file_in, 0, UINT64_MAX);
+            close(fd);
+        }
+        loop.run([&]() { return session.finished(); });
+        if (!(session.accepted() & START_DELTA))
+            return;
+    }
+
+    // Ask what the receiver holds, RESUME_MAX_RUNS runs at a time
+    vector<ResumeRun> runs;
+    uint64_t from = 0;
+    for (int q = 0;; ++q)
+    {
+        wSender query(argv, options, q ? log_base + ".query" + std::to_string(q) : log_base,
+                      loop);
+        StartInfo info{START_RESUME, transfer_id, 0, 1, from, file_size, 0, 0};
+        query.start(&info);
+        loop.run([&]() { return query.started(); });
+        if (!(query.accepted() & START_RESUME) && q == 0)
+        {
+            close(fd);
+            query.transfer(file_in, 0, UINT64_MAX);
+            loop.run([&]() { return query.finished(); });
+            return;
+        }
+        const vector<ResumeRun> &got = query.resumable();
+        runs.insert(runs.end(), got.begin(), got.end());
+        query.transfer(file_in, 0, 0); // Nothing to send: straight to END
+        loop.run([&]() { return query.finished(); });
+        if (got.size() < RESUME_MAX_RUNS)
+            break;
+        from = got.back().offset + got.back().length;
+    }
+
+    // Everything outside a run that still matches is missing
+    vector<std::pair<uint64_t, uint64_t> > missing;
+    uint64_t covered = 0; // Bytes below this are settled
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        uint64_t end = runs[i].offset + runs[i].length;
+        if (runs[i].offset < covered || runs[i].offset % RESUME_UNIT_BYTES != 0 ||
+            end > file_size || (end % RESUME_UNIT_BYTES != 0 && end != file_size) ||
+            !run_matches(fd, runs[i]))
+            continue;
+        if (runs[i].offset > covered)
+            missing.push_back(std::make_pair(covered, runs[i].offset - covered));
+        covered = end;
+    }
+    if (covered < file_size)
+        missing.push_back(std::make_pair(covered, file_size - covered));
+    close(fd);
+
+    // Pieces of at most a 1/streams share each, in whole ranges. With
+    // nothing missing, one empty piece lets the receiver finish the file
+    uint64_t total = 0;
+    for (size_t i = 0; i < missing.size(); ++i)
+        total += missing[i].second;
+    uint64_t share = (total + streams - 1) / streams;
+    share = std::max<uint64_t>(RESUME_UNIT_BYTES,
+                               (share + RESUME_UNIT_BYTES - 1) / RESUME_UNIT_BYTES *
+                                   RESUME_UNIT_BYTES);
+    vector<std::pair<uint64_t, uint64_t> > pieces;
+    for (size_t i = 0; i < missing.size(); ++i)
+        for (uint64_t done = 0; done < missing[i].second; done += share)
+            pieces.push_back(std::make_pair(missing[i].first + done,
+                                            std::min(share, missing[i].second - done)));
+    if (pieces.empty())
+        pieces.push_back(std::make_pair(file_size, (uint64_t)0));
+
+    // Each thread keeps its share of `streams` sessions going, taking the
+    // next piece as one of its own finishes
+    std::atomic<size_t> next_piece(0);
+    unsigned threads = loop_threads(streams);
+    run_on_loops(threads, [&](unsigned t, EventLoop &piece_loop) {
+        size_t slots = streams / threads + (t < streams % threads);
+        vector<std::unique_ptr<wSender> > active;
+        piece_loop.run([&]() {
+            for (size_t i = 0; i < active.size();)
+            {
+                if (active[i]->finished())
+                    active.erase(active.begin() + i);
+                else
+                    ++i;
+            }
+            while (active.size() < slots)
+            {
+                size_t k = next_piece++;
+                if (k >= pieces.size())
+                    break;
+                StartInfo piece{START_RANGE | START_RESUME, transfer_id, (uint32_t)k,
+                                (uint32_t)pieces.size(), pieces[k].first, file_size, 0, 0};
+                active.emplace_back(new wSender(argv, options,
+                                                log_base + "." + std::to_string(k),
+                                                piece_loop));
+                active.back()->start(&piece);
+                active.back()->transfer(file_in, pieces[k].first, pieces[k].second);
+            }
+            return active.empty();
+        });
+    });
+}
+
+// MODIFIES: files
+// EFFECTS: Add every regular file under dir, recursively, named by its path
+//          below the top directory (prefix)
+static void list_directory(const string &dir, const string &prefix, vector<BatchFile> &files)
+{
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        throw std::runtime_error("ERROR reading directory " + dir);
+    vector<string> entries;
+    while (dirent *entry = readdir(handle))
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            entries.push_back(entry->d_name);
+    closedir(handle);
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        string path = dir + "/" + entries[i];
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            list_directory(path, prefix + entries[i] + "/", files);
+        else if (S_ISREG(st.st_mode))
+            files.push_back(BatchFile{path, prefix + entries[i]});
+    }
+}
+
+// EFFECTS: The files a batch transfer sends: with --files, the paths listed
+//          one per line in the input file; otherwise the regular files
+//          under the input directory, in name order
+static vector<BatchFile> batch_inputs(const string &input, const CliOptions &options)
+{
+    vector<BatchFile> files;
+    if (options.has("files"))
+    {
+        std::ifstream list(input.c_str());
+        if (!list)
+            throw std::runtime_error("ERROR opening file list " + input);
+        string line;
+        while (std::getline(list, line))
+            if (!line.empty())
+                files.push_back(BatchFile{line, line});
+    }
+    else
+        list_directory(input, "", files);
+    if (files.empty())
+        throw std::runtime_error("ERROR no files to send in " + input);
+    return files;
+}
+
+// REQUIRES: files is not empty
+// MODIFIES: None
+// EFFECTS: Send every file over one START_BATCH session, logged to <log>:
+//          one handshake for the lot, and the window runs on from one file
+//          into the next. A receiver that does not accept START_BATCH gets
+//          a plain session per file instead, one after another; file k > 0
+//          logs to <log>.k. Throws if the receiver rejects the batch, e.g.
+//          when it cannot create one of the files
+static void send_batch(char *argv[], const CliOptions &options,
+                       const vector<BatchFile> &files)
+{
+    if (options.has("compress") || options.has("resume") || options.has("delta") ||
+        options.get_long("streams", 1) > 1)
+        throw std::runtime_error("ERROR a batch is one plain session: --streams, --compress, "
+                                 "--resume and --delta need a single input file");
+
+    std::random_device rd;
+    StartInfo info{START_BATCH, rd(), 0, 1, 0, 0, 0, 0};
+    EventLoop loop;
+    string log_base(argv[5]);
+    wSender session(argv, options, log_base, loop);
+    session.start(&info);
+    loop.run([&]() { return session.started(); });
+    if (session.accepted() & START_BATCH)
+    {
+        session.transfer(files);
+        loop.run([&]() { return session.finished(); });
+        return;
+    }
+
+    session.transfer(files[0].path, 0, UINT64_MAX);
+    loop.run([&]() { return session.finished(); });
+    for (size_t k = 1; k < files.size(); ++k)
+    {
+        wSender next(argv, options, log_base + "." + std::to_string(k), loop);
+        next.start(NULL);
+        next.transfer(files[k].path, 0, UINT64_MAX);
+        loop.run([&]() { return next.finished(); });
+    }
+}
+
+// EFFECTS: Totals over every session so far, then each session, as JSON
+static string stats_snapshot(Clock::time_point started)
+{
+    vector<std::shared_ptr<SessionStats> > sessions = sender_stats().list();
+    uint64_t sent = 0, resent = 0, parity = 0, acked = 0, fast = 0, timeouts = 0;
+    string list;
+    for (size_t k = 0; k < sessions.size(); ++k)
+    {
+        sent += sessions[k]->data_sent.get();
+        resent += sessions[k]->data_resent.get();
+        parity += sessions[k]->parity_sent.get();
+        acked += sessions[k]->bytes_acked.get();
+        fast += sessions[k]->fast_retransmits.get();
+        timeouts += sessions[k]->timeouts.get();
+        list += (k ? "," : "") + sessions[k]->json();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+    string totals = JsonObject()
+                        .count("sessions", sessions.size())
+                        .count("data_sent", sent)
+                        .count("data_resent", resent)
+                        .count("parity_sent", parity)
+                        .count("bytes_acked", acked)
+                        .count("fast_retransmits", fast)
+                        .count("timeouts", timeouts)
+                        .number("retransmit_rate", sent ? resent / (double)sent : 0)
+                        .number("goodput_mbit", acked * 8 / 1e6 / std::max(seconds, 1e-3))
+                        .str();
+    return JsonObject()
+        .text("role", "sender")
+        .count("uptime_ms", seconds * 1000)
+        .raw("totals", totals)
+        .raw("sessions", "[" + list + "]")
+        .str();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 6)
+    {
+        std::cout << "Invalid Input.\nUsage: ./wSender "
+                  << "<receiver-IP> <receiver-port> <window-size> <input-file> <log>"
+                  << " [--rto-min=MS] [--rto-max=MS] [--batch=N] [--no-mmsg]"
+                  << " [--streams=N] [--cc=reno|delay|fixed] [--pace=auto|MBIT]"
+                  << " [--no-sack] [--fec=N] [--fec-parity=K] [--mtu=BYTES|auto]"
+                  << " [--no-gso] [--no-gro] [--compress] [--resume] [--delta=BASIS]"
+                  << " [--hash-threads=N] [--stats=SOCKET] [--stats-every=MS]"
+                  << " [--files] [--binary-log]" << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 6);
+
+    // Live metrics: a JSON snapshot for every client of the --stats socket,
+    // and one line per --stats-every=MS appended to <log>.stats
+    std::unique_ptr<StatsServer> stats_server;
+    if (options.has("stats") || options.has("stats-every"))
+    {
+        Clock::time_point started = Clock::now();
+        stats_server.reset(new StatsServer(options.get("stats", ""),
+                                           string(argv[5]) + ".stats",
+                                           options.get_long("stats-every", 0),
+                                           [started]() { return stats_snapshot(started); }));
+    }
+
+    // A directory, or with --files a list of paths, is sent as one batch
+    struct stat st;
+    if (options.has("files") || (stat(argv[4], &st) == 0 && S_ISDIR(st.st_mode)))
+    {
+        send_batch(argv, options, batch_inputs(argv[4], options));
+        return 0;
+    }
+
+    long streams = options.get_long("streams", 1);
+    if (options.has("resume") || options.has("delta"))
+    {
+        send_resumable(argv, options, std::max<long>(1, streams));
+        return 0;
+    }
+    if (streams > 1)
+    {
+        send_parallel(argv, options, streams);
+        return 0;
+    }
+
+    EventLoop loop;
+    wSender sender(argv, options, argv[5], loop);
+    sender.start(NULL);
+    sender.transfer(string(argv[4]), 0, UINT64_MAX);
+    loop.run([&]() { return sender.finished(); });
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "PacketHeader.h"
+#include "PacketCodec.h"
+#include "crc32.h"
+#include "ChunkSource.h"
+#include "RttEstimator.h"
+#include "CongestionControl.h"
+#include "Pacer.h"
+#include "CliOptions.h"
+#include "BatchIO.h"
+#include "PacketLog.h"
+#include "EventLoop.h"
+#include "FecCodec.h"
+#include "DeltaSync.h"
+#include "Telemetry.h"
+
+#include <cmath>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <random>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+
+// UDP Header 8B; IP Protocol Header 20B
+// 1500 - (8 + 20) = 1472 for total send data
+#define MAX_SEND_DATA 1472
+// UDP Header 8B; IP Protocol Header 20B; PacketHeader 16B
+// 1500 - (8 + 20 + 16) = 1456 for file data chunks
+#define FILE_CHUNK_SIZE 1456
+// Larger packets need --mtu (negotiated with START_MTU); jumbo frames at most
+#define UDP_IP_HEADERS 28
+#define DEFAULT_MTU 1500
+#define MAX_MTU 9000
+// A padded START probing a larger MTU is tried this often before falling
+// back to DEFAULT_MTU
+#define MTU_PROBE_TRIES 3
+// With START_FEC a PARITY payload (FecInfo + 2-byte length + chunk) must fit
+// where a chunk did, so DATA chunks shrink by 6 bytes
+#define FEC_CHUNK_SIZE(chunk) ((chunk) - sizeof(FecInfo) - sizeof(uint16_t))
+#define FEC_SYMBOL_SIZE(chunk) (FEC_CHUNK_SIZE(chunk) + sizeof(uint16_t))
+// Adaptive FEC sends FEC_REDUNDANCY times the expected losses per block as
+// parity; the loss estimate decays by half every FEC_LOSS_HISTORY packets
+#define FEC_REDUNDANCY 2.0
+#define FEC_LOSS_HISTORY 1024
+// Retransmission timeout before the first RTT sample, and its default
+// clamps (override with --rto-min=MS / --rto-max=MS)
+#define INITIAL_RTO_MS 500
+#define DEFAULT_RTO_MIN_MS 5
+#define DEFAULT_RTO_MAX_MS 2000
+// Duplicate ACKs that trigger a fast retransmit of the oldest packet; with
+// SACK, a hole is presumed lost once this many later packets have arrived
+#define DUP_ACK_THRESHOLD 3
+// START / END are retried this many times before giving up
+#define MAX_HANDSHAKE_TRIES 20
+// Datagrams per sendmmsg / recvmmsg call (override with --batch=N)
+#define DEFAULT_BATCH_SIZE 32
+
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+void check_error(int input)
+{
+    if (input < 0)
+        throw std::runtime_error("ERROR on result");
+}
+
+// State for one DATA packet in flight; lives in a ring indexed by
+// seqNum % window so lookup on ACK / timeout is O(1)
+struct PacketData
+{
+    PacketHeader header;
+    char wire[sizeof(PacketHeader)]; // header as sent, encoded once
+    Chunk chunk;
+    Clock::time_point send_time;
+    Clock::time_point first_sent; // For the ACK latency histogram
+    bool acked;
+    bool retransmitted; // Karn: never take an RTT sample from a resent packet
+    bool loss_seen;     // Already counted towards the FEC loss estimate
+    uint32_t fec_after; // First seqNum sent after this block's parity; 0 = none yet
+};
+
+// One pending retransmission deadline, kept in a min-heap on deadline since
+// the RTO changes between sends. Entries whose send_time no longer matches
+// the packet (resent / acked) are stale and skipped
+struct TimerEntry
+{
+    uint32_t seqNum;
+    Clock::time_point send_time;
+    Clock::time_point deadline;
+
+    bool operator>(const TimerEntry &other) const
+    {
+        return deadline > other.deadline;
+    }
+};
+
+typedef std::priority_queue<TimerEntry, vector<TimerEntry>,
+                            std::greater<TimerEntry> > TimerQueue;
+
+// Live metrics of one session (Telemetry.h), written only by the thread
+// running its EventLoop. Sessions stay listed after they finish, under the
+// log path they were created with
+struct SessionStats
+{
+    explicit SessionStats(const string &name) : name(name), created(Clock::now()) {}
+
+    // EFFECTS: This session as a JSON object
+    string json() const;
+
+    const string name;
+    const Clock::time_point created;
+
+    Counter data_sent;   // DATA packets, first copies and resends
+    Counter data_resent;
+    Counter parity_sent;
+    Counter bytes_sent;  // DATA payload bytes, as sent (compressed or not)
+    Counter bytes_acked; // Payload bytes the cumulative ACK has passed
+    Counter acks;
+    Counter fast_retransmits; // Resends on duplicate ACKs or SACK holes
+    Counter timeouts;         // Resends on an expired timer
+
+    // Gauges, refreshed after every event
+    Counter phase;
+    Counter cwnd;
+    Counter in_flight;
+    Counter srtt_us;
+    Counter rto_us;
+
+    Histogram rtt_us;         // Every RTT sample taken (Karn)
+    Histogram ack_latency_us; // First send of a packet to its cumulative ACK
+};
+
+// One WTP session: its own socket, window, timers and START/END handshake.
+// Sessions never block; an EventLoop (EventLoop.h) calls them back when ACKs
+// arrive, when the socket drains and when a deadline is due. A plain
+// transfer is one session over the whole file; --streams=N runs N sessions
+// over N ranges, all driven by the same loop in one thread
+class wSender : public EventHandler
+{
+public:
+    wSender(char *argv[], const CliOptions &options, const string &log_path,
+            EventLoop &loop);
+    ~wSender();
+
+    // EFFECTS: Begin the START handshake, asking for the features in info
+    //          (if any) plus START_SACK unless --no-sack, START_FEC with
+    //          --fec and START_COMPRESS with --compress; delta goes with
+    //          START_DELTA. Throws from the loop if START is never ACKed
+    void start(const StartInfo *info, const DeltaInfo *delta = NULL);
+
+    // EFFECTS: Send [offset, offset + length) of file_in once START is
+    //          ACKed, then END
+    void transfer(const string &file_in, uint64_t offset, uint64_t length);
+
+    // REQUIRES: data outlives the session
+    // EFFECTS: Send data instead of a file
+    void transfer(const vector<char> &data);
+
+    // REQUIRES: START_BATCH was accepted; files outlives the session
+    // EFFECTS: Send every file, each after its header, then END
+    void transfer(const vector<BatchFile> &files);
+
+    bool started() const { return phase > STARTING; }
+    bool finished() const { return phase == DONE; }
+    // START_* flags the receiver accepted; valid once started()
+    uint32_t accepted() const { return accepted_flags; }
+    // What the receiver already holds, if START_RESUME was accepted
+    const vector<ResumeRun> &resumable() const { return resume_runs; }
+
+    void on_io(int fd, uint32_t events);
+    void on_timer();
+
+private:
+    enum Phase
+    {
+        IDLE,     // Nothing sent yet
+        STARTING, // START out, waiting for its ACK
+        STARTED,  // START ACKed, no range to send yet
+        SENDING,  // Sliding window over the range
+        ENDING,   // END out, waiting for its ACK
+        DONE
+    };
+
+    // 1. Handshake: START / END are resent until ACKed with their seqNum
+    //      START may carry a StartInfo; the receiver echoes what it accepted
+    void send_control();
+    void handle_control_ack(const PacketHeader &ack, const char *payload, size_t len);
+    void begin_data();
+    void begin_end();
+
+    // 2. Send new packets as soon as the window has room
+    //      With START_COMPRESS (--compress) a thread packs compressed
+    //      payloads ahead of the window (CompressedChunks, ChunkSource.h)
+    //      With START_BATCH the payloads are file headers and contents of
+    //      many files (BatchChunks, ChunkSource.h)
+    bool next_chunk(uint32_t index, Chunk &chunk);
+    void fill_window();
+    void transmit(uint32_t seqNum);
+
+    // 2b. With START_FEC (--fec=N), every N new DATA packets are followed by
+    //      PARITY packets the receiver rebuilds lost chunks from; how many
+    //      follows the loss rate seen so far unless --fec-parity=K pins it
+    void fec_add(const PacketData &packet);
+    void fec_emit();
+    void count_loss(PacketData &packet);
+
+    // 3. Cumulative ACKs slide the window; only timed-out packets are resent
+    //      DATA goes out and ACKs come in through BatchIO (sendmmsg/recvmmsg)
+    //      The CongestionControl window (capped by window-size) limits what
+    //      is in flight; DUP_ACK_THRESHOLD duplicates fast-retransmit the hole
+    //      With --pace, new packets leave through a token bucket (Pacer.h)
+    //      With START_SACK, ACK bitmaps mark packets that need no resend and
+    //      expose every hole, not just the first
+    void drain_acks();
+    void process_ack(const PacketHeader &ack, const uint64_t *sack_words, size_t count);
+    void apply_sack(const uint64_t *sack_words, size_t count);
+    bool timer_stale(const TimerEntry &timer) const;
+    void check_timeouts();
+
+    // After every event: push queued packets out and re-arm the loop
+    void advance();
+    void flush();
+    void rearm();
+
+    // 4. LOGGING
+    void log_packet(const PacketHeader &header);
+
+    // 5. TELEMETRY (--stats=PATH / --stats-every=MS)
+    std::shared_ptr<SessionStats> stats;
+
+    EventLoop &loop;
+    int sockfd;
+    sockaddr_in recv_addr;
+    BatchIO *io;
+    bool want_write; // Watching for EPOLLOUT while io is blocked
+    vector<PacketHeader> ack_headers; // Decoded from each batch io received
+    vector<uint8_t> ack_ok;           // Whether each passed its PacketRule
+    PacketLog sender_log;
+    std::unique_ptr<ChunkSource> chunks;
+    std::unique_ptr<CompressedChunks> packed; // Instead of chunks with START_COMPRESS
+    std::unique_ptr<BatchChunks> batch;       // Instead of chunks with START_BATCH
+    Phase phase;
+
+    // Handshake state
+    PacketHeader control; // START / END header (shared random seqNum)
+    StartInfo start_info;
+    DeltaInfo delta_info; // Follows start_info with START_DELTA
+    bool has_start_info;
+    bool sack_requested; // Ask for START_SACK (off with --no-sack)
+    bool compress_requested; // Ask for START_COMPRESS (--compress)
+    uint32_t accepted_flags;
+    vector<ResumeRun> resume_runs; // From the START ACK of a resume query
+    size_t probe_bytes; // START padded to this datagram size; 0 = no MTU probe
+    int control_tries;
+    Clock::time_point control_sent;
+    Clock::time_point control_deadline;
+
+    // The byte range (or buffer, or batch of files) to send once started
+    const vector<char> *buffer_in;
+    const vector<BatchFile> *batch_in;
+    string file_in;
+    uint64_t range_offset;
+    uint64_t range_length;
+    bool has_range;
+
+    uint32_t window;
+    size_t chunk_size; // DATA payload bytes; START_MTU may raise it
+    vector<PacketData> ring;
+    TimerQueue timers;
+    RttEstimator rtt;
+    Clock::time_point timer_set; // Deadline last handed to the loop
+    std::unique_ptr<CongestionControl> cc;
+    uint32_t dup_acks;    // Repeats of the ACK for base_seq
+    uint32_t recover_seq; // Losses below this belong to the last reaction
+    bool sack;            // Receiver accepted START_SACK
+    Pacer pacer;
+    bool pace_auto;                  // Rate follows cwnd / SRTT
+    Clock::time_point pace_deadline; // When the pacer has room again
+
+    uint32_t base_seq; // Lowest unacked seqNum
+    uint32_t next_seq; // Next never-sent seqNum
+    bool input_done;   // ChunkSource has no chunk for next_seq
+
+    // Forward error correction; fec_block == 0 means off
+    uint32_t fec_block;  // DATA packets per block (--fec=N)
+    uint32_t fec_fixed;  // --fec-parity=K; 0 = follow the loss rate
+    uint32_t fec_start;  // First seqNum of the open block
+    uint32_t fec_parity; // PARITY packets the open block will get
+    vector<vector<uint8_t> > fec_rows;    // Symbols being accumulated
+    std::deque<vector<uint8_t> > fec_out; // Queued PARITY, kept until flushed
+    double fec_sent; // Decaying count of new DATA packets
+    double fec_lost; // Decaying count of packets seen lost
+};
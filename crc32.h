@@ -40,7 +40,18 @@
  * CRC32 code derived from work by Gary S. Brown.
  */
 
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
 #include <sys/param.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL 1
+#endif
 
 static uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -88,17 +99,193 @@ static uint32_t crc32_tab[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t
-crc32(const void *buf, size_t size)
-{
-	uint32_t crc = 0;
-	const uint8_t *p;
-
-	p = (const uint8_t*) buf;
-	crc = crc ^ ~0U;
+/*
+ * Every kernel below works on the running CRC register (already inverted
+ * by ~0U); crc32() applies the initial and final inversions.
+ */
 
+/* Reference kernel: one byte per iteration through crc32_tab */
+inline uint32_t
+crc32_bytewise_update(uint32_t crc, const uint8_t *p, size_t size)
+{
 	while (size--)
 		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+/*
+ * Slicing-by-8: eight derived tables let eight input bytes be folded in per
+ * iteration with independent lookups.  crc32_slice_tab[0] is crc32_tab;
+ * table k holds the CRC of a byte followed by k zero bytes.
+ */
+struct crc32_slice_tables {
+	uint32_t t[8][256];
+
+	crc32_slice_tables()
+	{
+		for (int i = 0; i < 256; i++)
+			t[0][i] = crc32_tab[i];
+		for (int k = 1; k < 8; k++)
+			for (int i = 0; i < 256; i++)
+				t[k][i] = (t[k - 1][i] >> 8) ^
+				    crc32_tab[t[k - 1][i] & 0xFF];
+	}
+};
 
-	return crc ^ ~0U;
+inline const crc32_slice_tables &
+crc32_slice_tab()
+{
+	static const crc32_slice_tables tables;
+	return tables;
+}
+
+inline uint32_t
+crc32_slice8_update(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const uint32_t (*t)[256] = crc32_slice_tab().t;
+
+	while (size >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+		    t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+		    t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+		    t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	return crc32_bytewise_update(crc, p, size);
 }
+
+#ifdef CRC32_HAVE_PCLMUL
+/*
+ * Carry-less multiplication folding (Intel, "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ").  Four 128-bit lanes are folded 64
+ * bytes at a time, reduced to one lane, then Barrett-reduced to 32 bits.
+ * Constants are x^n mod P for the bit-reflected 0xEDB88320 polynomial.
+ * Requires size >= 64; the tail below a multiple of 16 goes to slicing-by-8.
+ */
+__attribute__((target("pclmul,sse4.1"))) inline uint32_t
+crc32_pclmul_update(uint32_t crc, const uint8_t *p, size_t size)
+{
+	if (size < 64)
+		return crc32_slice8_update(crc, p, size);
+
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	size_t tail = size & 15;
+	size -= tail;
+
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64;
+	size -= 64;
+
+	/* Fold 4 x 128 bits per iteration */
+	while (size >= 64) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+		    _mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+		    _mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+		    _mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+		    _mm_loadu_si128((const __m128i *)(p + 0x30)));
+		p += 64;
+		size -= 64;
+	}
+
+	/* Fold the four lanes into one */
+	__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold any remaining 16-byte blocks */
+	while (size >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)p);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		size -= 16;
+	}
+
+	/* 128 -> 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	/* 64 -> 32 bits */
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction */
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_extract_epi32(x1, 1);
+
+	return crc32_slice8_update(crc, p, tail);
+}
+#endif
+
+typedef uint32_t (*crc32_kernel)(uint32_t, const uint8_t *, size_t);
+
+/* Pick the fastest kernel this CPU supports, once */
+inline crc32_kernel
+crc32_best_kernel()
+{
+#ifdef CRC32_HAVE_PCLMUL
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+		return crc32_pclmul_update;
+#endif
+	return crc32_slice8_update;
+}
+
+/*
+ * Incremental form: crc32_update(crc32(a), b) == crc32(a followed by b), and
+ * crc32_update(0, buf, size) == crc32(buf, size).  Lets data be checksummed
+ * piecewise as it arrives.
+ */
+inline uint32_t
+crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+	static const crc32_kernel kernel = crc32_best_kernel();
+
+	return kernel(crc ^ ~0U, (const uint8_t *)buf, size) ^ ~0U;
+}
+
+inline uint32_t
+crc32(const void *buf, size_t size)
+{
+	return crc32_update(0, buf, size);
+}
+
+#endif
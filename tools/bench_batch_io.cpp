@@ -0,0 +1,123 @@
+// Loopback benchmark for BatchIO: blasts DATA-sized datagrams from one socket
+// to another and reports packets/sec and syscalls per packet on both sides,
+// first with one sendmsg/recvmsg per packet, then with sendmmsg/recvmmsg at
+// each requested batch size, then with UDP GSO / GRO on top of the largest.
+//
+// Usage: ./bench_batch_io [packets] [batch-size ...]
+
+#include "BatchIO.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#define PACKET_SIZE 1472
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result
+{
+    double seconds;
+    uint64_t sent, send_calls;
+    uint64_t received, recv_calls;
+};
+
+static int udp_socket(sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int buf = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (sockaddr *)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    return fd;
+}
+
+static Result run(uint64_t packets, size_t batch, bool mmsg, bool offload = false)
+{
+    sockaddr_in recv_addr, send_addr;
+    int recv_fd = udp_socket(recv_addr);
+    int send_fd = udp_socket(send_addr);
+
+    std::atomic<bool> sending(true);
+    Result result = {0, 0, 0, 0, 0};
+
+    std::thread receiver([&]() {
+        BatchIO io(recv_fd, batch, PACKET_SIZE, mmsg);
+        if (offload)
+            io.enable_gro();
+        while (true)
+        {
+            pollfd pfd = {recv_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 50) <= 0 && !sending)
+                break;
+            while (io.receive() > 0)
+                ;
+        }
+        result.received = io.packets();
+        result.recv_calls = io.syscalls();
+    });
+
+    char payload[PACKET_SIZE] = {0};
+    BatchIO io(send_fd, batch, PACKET_SIZE, mmsg);
+    if (offload && !io.enable_gso())
+        std::cerr << "UDP_SEGMENT not supported; sending without GSO" << std::endl;
+    Clock::time_point start = Clock::now();
+    for (uint64_t i = 0; i < packets; ++i)
+        io.queue(payload, 16, payload + 16, PACKET_SIZE - 16, recv_addr);
+    io.flush();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.sent = io.packets();
+    result.send_calls = io.syscalls();
+
+    sending = false;
+    receiver.join();
+    close(send_fd);
+    close(recv_fd);
+    return result;
+}
+
+static void report(const std::string &mode, const Result &r)
+{
+    std::cout << std::left << std::setw(14) << mode << std::right << std::fixed
+              << std::setw(12) << std::setprecision(0) << r.sent / r.seconds
+              << std::setw(12) << std::setprecision(3) << (double)r.send_calls / r.sent
+              << std::setw(12) << r.received
+              << std::setw(12) << std::setprecision(3)
+              << (r.received ? (double)r.recv_calls / r.received : 0.0) << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t packets = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 500000;
+    std::vector<size_t> batches;
+    for (int i = 2; i < argc; ++i)
+        batches.push_back(std::strtoul(argv[i], NULL, 10));
+    if (batches.empty())
+        batches = {8, 32, 64};
+
+    std::cout << std::left << std::setw(14) << "mode" << std::right
+              << std::setw(12) << "send pps" << std::setw(12) << "calls/pkt"
+              << std::setw(12) << "recvd" << std::setw(12) << "calls/pkt" << std::endl;
+
+    report("single", run(packets, 64, false));
+    for (size_t i = 0; i < batches.size(); ++i)
+        report("mmsg x" + std::to_string(batches[i]), run(packets, batches[i], true));
+    size_t largest = *std::max_element(batches.begin(), batches.end());
+    report("gso+gro x" + std::to_string(largest), run(packets, largest, true, true));
+    return 0;
+}
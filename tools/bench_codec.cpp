@@ -0,0 +1,270 @@
+// Microbenchmark for the packet header codec in PacketCodec.h. Before timing
+// anything it checks the wire format byte for byte, then cross-checks
+// decode_headers() against the parse the programs used before the codec on
+// random and damaged datagrams (short ones, unknown types, lengths one off
+// or far out), and exits non-zero on the first mismatch.
+//
+// Timing decodes and validates recvmmsg-sized batches of datagrams, ns per
+// packet, for two traffic mixes: a DATA stream (what the receiver sees) and
+// an even mix of every type plus damaged packets. "memcpy" is that old
+// parse: the header copied in host order, then a branch per type. "scalar"
+// is decode_headers_scalar(), the codec one datagram at a time, and "codec"
+// is decode_headers() (AVX2 where the CPU has it), both on the same
+// datagrams encoded big-endian. Each is timed RUNS times and the fastest
+// run reported.
+//
+// Usage: ./bench_codec [batch-size] [iterations]
+
+#include "PacketCodec.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <algorithm>
+
+typedef std::chrono::steady_clock Clock;
+
+#define DATAGRAM_BYTES 1472
+#define MAX_DATA (DATAGRAM_BYTES - sizeof(PacketHeader))
+// Bytes kept per datagram: only headers are read, so payloads are not stored
+#define SLOT_BYTES 64
+// Distinct batches cycled through, so branches cannot learn one batch
+#define BATCHES 64
+// Timed runs per kernel; the fastest is reported
+#define RUNS 5
+
+// A batch of datagrams, each in its own buffer like BatchIO's
+struct Batch
+{
+    std::vector<char> buf;
+    std::vector<const char *> data;
+    std::vector<size_t> len;
+
+    const char *packet(size_t i) const { return data[i]; }
+    size_t length(size_t i) const { return len[i]; }
+};
+
+// EFFECTS: The parse this codec replaced: the header as it sits in memory,
+//          then the receiver's per-type length checks
+static void decode_memcpy(const Batch &in, size_t n, const HeaderLimits &limits,
+                          PacketHeader *out, uint8_t *ok)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        ok[i] = false;
+        if (in.len[i] < sizeof(PacketHeader))
+            continue;
+        memcpy(&out[i], in.data[i], sizeof(PacketHeader));
+        size_t payload = in.len[i] - sizeof(PacketHeader);
+        if (out[i].type == 0)
+            ok[i] = out[i].length <= payload;
+        else if (out[i].type == 1)
+            ok[i] = out[i].length == 0 && payload == 0;
+        else if (out[i].type == 2 || out[i].type == 4)
+            ok[i] = out[i].length <= limits.max_data && out[i].length == payload;
+        else if (out[i].type == 3)
+            ok[i] = out[i].length <= limits.max_ack && out[i].length == payload;
+    }
+}
+
+// MODIFIES: batch
+// EFFECTS: Fill batch with n datagrams, headers encoded (or copied in host
+//          order if host_order). mixed draws every type and damaged packets;
+//          otherwise almost everything is valid DATA
+static void make_batch(Batch &batch, size_t n, bool mixed, bool host_order, std::mt19937 &rng)
+{
+    batch.buf.assign(n * SLOT_BYTES, 0);
+    batch.data.resize(n);
+    batch.len.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        char *p = &batch.buf[i * SLOT_BYTES];
+        unsigned kind = mixed ? rng() % 8 : (rng() % 100 == 0 ? 7 : PACKET_DATA);
+        PacketHeader h{kind, (uint32_t)rng(), 0, (uint32_t)rng()};
+        size_t payload = 0;
+        switch (kind)
+        {
+        case PACKET_START:
+            payload = sizeof(StartInfo);
+            h.length = rng() % 2 ? payload : 0;
+            break;
+        case PACKET_END:
+            break;
+        case PACKET_DATA:
+        case PACKET_PARITY:
+            payload = h.length = rng() % 4 ? MAX_DATA : rng() % (MAX_DATA + 1);
+            break;
+        case PACKET_ACK:
+            payload = h.length = rng() % 2 ? 0 : 8 * (1 + rng() % SACK_MAX_WORDS);
+            break;
+        case 5: // Unknown type
+            h.type = rng() % 2 ? 5 + rng() % 100 : 0x02000000; // DATA in the other byte order
+            payload = h.length = rng() % (MAX_DATA + 1);
+            break;
+        case 6: // Truncated: shorter than a header
+            batch.len[i] = rng() % sizeof(PacketHeader);
+            for (size_t b = 0; b < batch.len[i]; ++b)
+                p[b] = rng();
+            batch.data[i] = p;
+            continue;
+        default: // Known type, wrong length
+        {
+            h.type = rng() % 5;
+            payload = rng() % (MAX_DATA + 1);
+            uint32_t wrong[] = {(uint32_t)payload + 1, (uint32_t)payload - 1, 0xFFFFFFFFU,
+                                (uint32_t)MAX_DATA + 1, (uint32_t)ACK_MAX_PAYLOAD + 1};
+            h.length = wrong[rng() % 5];
+            break;
+        }
+        }
+        if (host_order)
+            memcpy(p, &h, sizeof(h));
+        else
+            encode_header(h, p);
+        batch.data[i] = p;
+        batch.len[i] = sizeof(PacketHeader) + payload;
+    }
+}
+
+// EFFECTS: true if encode_header() lays a header out big-endian in field
+//          order and decode_header() reads it back, and a payload struct
+//          (StartInfo, with 64-bit fields) does the same
+static bool check_wire_format()
+{
+    PacketHeader h{PACKET_DATA, 0x01020304, 0x0506, 0xA0B0C0D0};
+    const unsigned char want[sizeof(PacketHeader)] = {0, 0, 0, 2, 1, 2, 3, 4,
+                                                      0, 0, 5, 6, 0xA0, 0xB0, 0xC0, 0xD0};
+    unsigned char wire[sizeof(PacketHeader)];
+    encode_header(h, wire);
+    if (memcmp(wire, want, sizeof(want)) != 0)
+    {
+        std::cerr << "encode_header: wrong wire bytes" << std::endl;
+        return false;
+    }
+    PacketHeader back = decode_header(wire);
+    if (back.type != h.type || back.seqNum != h.seqNum || back.length != h.length ||
+        back.checksum != h.checksum)
+    {
+        std::cerr << "decode_header: round trip failed" << std::endl;
+        return false;
+    }
+
+    StartInfo info{0x11, 0x01020304, 2, 3, 0x0102030405060708ULL, 0xA0, 1472, 0};
+    unsigned char payload[sizeof(StartInfo)];
+    encode_wire(info, payload);
+    const unsigned char offset[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    StartInfo info_back = decode_wire<StartInfo>(payload);
+    if (payload[3] != 0x11 || memcmp(payload + 16, offset, sizeof(offset)) != 0 ||
+        payload[31] != 0xA0 || memcmp(&info_back, &info, sizeof(info)) != 0)
+    {
+        std::cerr << "encode_wire: wrong StartInfo bytes" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// EFFECTS: true if decode_headers() and decode_headers_scalar() on encoded
+//          datagrams agree with the old parse of the same datagrams in host
+//          order (this host is little-endian, as the old parse assumed)
+static bool cross_check(const HeaderLimits &limits)
+{
+    std::mt19937 rng(489);
+    Batch host, wire;
+    std::vector<PacketHeader> want(64), got(64);
+    std::vector<uint8_t> want_ok(64), got_ok(64);
+    for (int trial = 0; trial < 40000; ++trial)
+    {
+        size_t n = 1 + rng() % 40;
+        bool mixed = trial % 4 != 0;
+        uint32_t seed = rng();
+        std::mt19937 gen(seed);
+        make_batch(host, n, mixed, true, gen);
+        gen.seed(seed);
+        make_batch(wire, n, mixed, false, gen);
+        decode_memcpy(host, n, limits, &want[0], &want_ok[0]);
+        if (trial % 2)
+            decode_headers(wire, n, limits, &got[0], &got_ok[0]);
+        else
+            decode_headers_scalar(wire, 0, n, limits, &got[0], &got_ok[0]);
+        for (size_t i = 0; i < n; ++i)
+        {
+            bool whole = wire.len[i] >= sizeof(PacketHeader);
+            if (want_ok[i] != got_ok[i] ||
+                (whole && memcmp(&want[i], &got[i], sizeof(PacketHeader)) != 0))
+            {
+                std::cerr << (trial % 2 ? "codec" : "scalar") << " mismatch: datagram " << i
+                          << " of " << n << ", len " << wire.len[i] << ", type "
+                          << got[i].type << ", length " << got[i].length << ", ok "
+                          << (int)want_ok[i] << " vs " << (int)got_ok[i] << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 32;
+    size_t iters = argc > 2 ? std::strtoul(argv[2], NULL, 10) : (1 << 24) / (n ? n : 1);
+    if (n == 0)
+        return 1;
+    HeaderLimits limits = {(uint32_t)MAX_DATA, (uint32_t)ACK_MAX_PAYLOAD};
+
+    if (!check_wire_format() || !cross_check(limits))
+        return 1;
+    std::cout << "cross-check OK" << std::endl;
+
+    std::vector<PacketHeader> out(n);
+    std::vector<uint8_t> ok(n);
+    const char *mixes[] = {"data", "mixed"};
+    for (int mix = 0; mix < 2; ++mix)
+    {
+        // The same datagrams, in host order for memcpy and encoded for the rest
+        std::vector<Batch> host(BATCHES), wire(BATCHES);
+        for (size_t b = 0; b < BATCHES; ++b)
+        {
+            std::mt19937 rng(b);
+            make_batch(host[b], n, mix == 1, true, rng);
+            rng.seed(b);
+            make_batch(wire[b], n, mix == 1, false, rng);
+        }
+
+        std::cout << mixes[mix] << " (" << n << " datagrams per batch)" << std::endl;
+        const char *names[] = {"memcpy", "scalar", "codec"};
+        for (int k = 0; k < 3; ++k)
+        {
+            const char *name = names[k];
+            uint64_t sink = 0;
+            double best = 0;
+            for (int run = 0; run < RUNS; ++run)
+            {
+                Clock::time_point start = Clock::now();
+                for (size_t i = 0; i < iters; ++i)
+                {
+                    size_t b = i % BATCHES;
+                    if (k == 0)
+                        decode_memcpy(host[b], n, limits, &out[0], &ok[0]);
+                    else if (k == 1)
+                        decode_headers_scalar(wire[b], 0, n, limits, &out[0], &ok[0]);
+                    else
+                        decode_headers(wire[b], n, limits, &out[0], &ok[0]);
+                    for (size_t j = 0; j < n; ++j)
+                        sink += ok[j] ? out[j].seqNum : 1;
+                }
+                double secs = std::chrono::duration<double>(Clock::now() - start).count();
+                best = run == 0 ? secs : std::min(best, secs);
+            }
+
+            std::cout << "  " << std::left << std::setw(10) << name << std::right
+                      << std::fixed << std::setprecision(2) << std::setw(8)
+                      << best * 1e9 / (iters * n) << " ns/packet"
+                      << "  (" << std::hex << sink << std::dec << ")" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+// Benchmark for compressed DATA payloads (LzCodec.h, START_COMPRESS). Before
+// timing anything it round-trips random, repetitive and mixed inputs through
+// compress_payload / decompress_payload at random payload sizes, and feeds
+// the decoder corrupted payloads, which it must reject or decode within
+// bounds; it exits non-zero on the first mismatch.
+//
+// Usage: ./bench_compress [payload-bytes] [link-Mbit] [file...]
+//   For synthetic logs, CSV and random bytes (plus any files given), packs
+//   the input into payloads the way the sender does and reports:
+//     ratio     input bytes per payload byte
+//     enc/dec   MB/s of input through the encoder / decoder on one core
+//     goodput   file Mbit/s a link-Mbit link carries with compression,
+//               counting packet and UDP/IP headers (plain WTP: link * 0.97)
+//     cpu       share of one core the sender / receiver spend at that rate
+
+#include "LzCodec.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+
+#define CORPUS_BYTES (16 << 20)
+#define WIRE_OVERHEAD 44 // PacketHeader + UDP + IPv4
+
+typedef std::chrono::steady_clock Clock;
+typedef std::vector<char> Buffer;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static Buffer make_log(std::mt19937 &rng, size_t bytes)
+{
+    static const char *levels[] = {"INFO", "WARN", "DEBUG", "ERROR"};
+    static const int statuses[] = {200, 200, 200, 404, 500};
+    std::string text;
+    double t = 1700000000.0;
+    char line[200];
+    while (text.size() < bytes)
+    {
+        t += (rng() % 10000) / 1e6;
+        snprintf(line, sizeof(line),
+                 "%.3f %s [worker-%u] request id=%08x path=/api/v1/items/%u status=%d "
+                 "latency_ms=%.2f\n",
+                 t, levels[rng() % 4], (unsigned)(rng() % 16), (unsigned)rng(),
+                 (unsigned)(rng() % 100000), statuses[rng() % 5], (rng() % 10000) / 100.0);
+        text += line;
+    }
+    return Buffer(text.begin(), text.begin() + bytes);
+}
+
+static Buffer make_csv(std::mt19937 &rng, size_t bytes)
+{
+    static const char *regions[] = {"us-east", "eu-west", "ap-south"};
+    std::string text = "id,name,price,qty,region\n";
+    char line[100];
+    for (unsigned id = 0; text.size() < bytes; ++id)
+    {
+        snprintf(line, sizeof(line), "%u,item%u,%.2f,%u,%s\n", id,
+                 (unsigned)(rng() % 5000), (rng() % 100000) / 100.0,
+                 (unsigned)(rng() % 100), regions[rng() % 3]);
+        text += line;
+    }
+    return Buffer(text.begin(), text.begin() + bytes);
+}
+
+static Buffer make_random(std::mt19937 &rng, size_t bytes)
+{
+    Buffer data(bytes);
+    for (size_t i = 0; i < bytes; ++i)
+        data[i] = rng();
+    return data;
+}
+
+// EFFECTS: Pack data into payloads of payload_size the way the sender does
+static void pack(const Buffer &data, size_t payload_size, size_t raw_limit,
+                 std::vector<Buffer> &payloads)
+{
+    LzEncoder encoder;
+    payloads.clear();
+    for (size_t used = 0; used < data.size();)
+    {
+        Buffer payload(payload_size);
+        size_t consumed;
+        size_t len = compress_payload(encoder, &data[used],
+                                      std::min(data.size() - used, raw_limit),
+                                      &payload[0], payload_size, consumed);
+        payload.resize(len);
+        payloads.push_back(payload);
+        used += consumed;
+    }
+}
+
+static bool round_trip()
+{
+    std::mt19937 rng(489);
+    Buffer out(1 << 20);
+    for (int trial = 0; trial < 3000; ++trial)
+    {
+        // Alphabets from one symbol to all 256, with runs and repeats
+        size_t len = rng() % 20000;
+        unsigned alphabet = 1 + rng() % 256;
+        Buffer data(len);
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (i > 8 && rng() % 4 == 0)
+            {
+                size_t back = 1 + rng() % std::min<size_t>(i, 70000);
+                size_t run = std::min<size_t>(len - i, rng() % 300);
+                for (size_t k = 0; k < run; ++k, ++i)
+                    data[i] = data[i - back];
+                if (i == len)
+                    break;
+            }
+            data[i] = rng() % alphabet;
+        }
+
+        size_t payload_size = sizeof(CompressInfo) + 1 + rng() % 9000;
+        size_t raw_limit = 1 + rng() % (8 * payload_size);
+        std::vector<Buffer> payloads;
+        pack(data, payload_size, raw_limit, payloads);
+        Buffer got;
+        for (size_t p = 0; p < payloads.size(); ++p)
+        {
+            size_t raw_len;
+            if (payloads[p].size() > payload_size ||
+                !decompress_payload(&payloads[p][0], payloads[p].size(), &out[0], raw_limit,
+                                    raw_len) ||
+                raw_len == 0)
+            {
+                std::cerr << "payload " << p << " of trial " << trial << " is bad"
+                          << std::endl;
+                return false;
+            }
+            got.insert(got.end(), out.begin(), out.begin() + raw_len);
+        }
+        if (got != data)
+        {
+            std::cerr << "round trip failed: trial " << trial << " length " << len
+                      << " payload " << payload_size << std::endl;
+            return false;
+        }
+
+        // Damaged payloads must never decode past the buffer
+        for (size_t p = 0; p < payloads.size() && p < 4; ++p)
+        {
+            Buffer bad(payloads[p]);
+            for (int flips = 1 + rng() % 4; flips > 0; --flips)
+                bad[rng() % bad.size()] = rng();
+            if (rng() % 2)
+                bad.resize(rng() % (bad.size() + 1));
+            size_t raw_len;
+            if (decompress_payload(bad.data(), bad.size(), &out[0], raw_limit, raw_len) &&
+                raw_len > raw_limit)
+            {
+                std::cerr << "corrupt payload decoded out of bounds" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void report(const std::string &name, const Buffer &data, size_t payload_size,
+                   double link_mbit)
+{
+    size_t raw_limit = COMPRESS_MAX_RATIO * payload_size;
+    std::vector<Buffer> payloads;
+    int reps = std::max<int>(1, (64 << 20) / std::max<size_t>(data.size(), 1));
+
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; ++r)
+        pack(data, payload_size, raw_limit, payloads);
+    double enc = data.size() * (double)reps / seconds_since(start) / 1e6;
+
+    size_t wire = 0;
+    for (size_t p = 0; p < payloads.size(); ++p)
+        wire += payloads[p].size();
+    Buffer out(raw_limit);
+    start = Clock::now();
+    for (int r = 0; r < reps; ++r)
+        for (size_t p = 0; p < payloads.size(); ++p)
+        {
+            size_t raw_len;
+            decompress_payload(&payloads[p][0], payloads[p].size(), &out[0], raw_limit,
+                               raw_len);
+        }
+    double dec = data.size() * (double)reps / seconds_since(start) / 1e6;
+
+    double ratio = data.size() / (double)std::max<size_t>(wire, 1);
+    double goodput = link_mbit * data.size() /
+                     (wire + payloads.size() * (double)WIRE_OVERHEAD);
+    std::cout << std::left << std::setw(10) << name.substr(0, 10) << std::right
+              << std::fixed << std::setprecision(2) << std::setw(7) << ratio
+              << std::setprecision(0) << std::setw(9) << enc << std::setw(9) << dec
+              << std::setw(13) << goodput << std::setprecision(1) << std::setw(8)
+              << goodput / 8 / enc * 100 << "%" << std::setw(7)
+              << goodput / 8 / dec * 100 << "%" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t payload_size = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1456;
+    double link_mbit = argc > 2 ? std::strtod(argv[2], NULL) : 1000;
+    if (payload_size <= sizeof(CompressInfo) || link_mbit <= 0)
+    {
+        std::cerr << "payload-bytes must exceed " << sizeof(CompressInfo)
+                  << " and link-Mbit be positive" << std::endl;
+        return 1;
+    }
+
+    if (!round_trip())
+        return 1;
+    std::cout << "round trips OK, corrupt payloads rejected" << std::endl;
+
+    std::mt19937 rng(1);
+    std::cout << "payload " << payload_size << " B, " << link_mbit
+              << " Mbit/s link (plain WTP goodput "
+              << std::setprecision(0) << std::fixed
+              << link_mbit * payload_size / (payload_size + WIRE_OVERHEAD) << ")" << std::endl;
+    std::cout << "input       ratio enc MB/s dec MB/s goodput Mb/s cpu send  recv"
+              << std::endl;
+    report("log", make_log(rng, CORPUS_BYTES), payload_size, link_mbit);
+    report("csv", make_csv(rng, CORPUS_BYTES), payload_size, link_mbit);
+    report("random", make_random(rng, CORPUS_BYTES), payload_size, link_mbit);
+    for (int i = 3; i < argc; ++i)
+    {
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "cannot read " << argv[i] << std::endl;
+            return 1;
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+        std::string bytes = text.str();
+        std::string name = argv[i];
+        report(name.substr(name.find_last_of('/') + 1), Buffer(bytes.begin(), bytes.end()),
+               payload_size, link_mbit);
+    }
+    return 0;
+}
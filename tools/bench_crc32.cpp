@@ -0,0 +1,91 @@
+// Microbenchmark for the CRC32 kernels in crc32.h. Before timing anything it
+// cross-checks slicing-by-8 and PCLMULQDQ against the byte-at-a-time
+// reference on random buffers (random lengths and alignments), and exits
+// non-zero on the first mismatch.
+//
+// Usage: ./bench_crc32 [buffer-bytes] [iterations]
+
+#include "crc32.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Kernel
+{
+    std::string name;
+    crc32_kernel fn;
+};
+
+static bool cross_check(const std::vector<Kernel> &kernels)
+{
+    std::mt19937 rng(489);
+    std::vector<uint8_t> buf(1 << 16);
+    for (size_t i = 0; i < buf.size(); ++i)
+        buf[i] = rng();
+
+    for (int trial = 0; trial < 20000; ++trial)
+    {
+        size_t len = trial < 4096 ? trial : rng() % (buf.size() - 64);
+        size_t off = rng() % 64;
+        uint32_t seed = trial & 1 ? ~0U : rng();
+        uint32_t want = crc32_bytewise_update(seed, &buf[off], len);
+        for (size_t k = 0; k < kernels.size(); ++k)
+        {
+            uint32_t got = kernels[k].fn(seed, &buf[off], len);
+            if (got != want)
+            {
+                std::cerr << kernels[k].name << " mismatch: len " << len
+                          << " offset " << off << std::hex << " want " << want
+                          << " got " << got << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1456;
+    size_t iters = argc > 2 ? std::strtoul(argv[2], NULL, 10) : (1 << 30) / size;
+
+    std::vector<Kernel> kernels;
+    kernels.push_back(Kernel{"bytewise", crc32_bytewise_update});
+    kernels.push_back(Kernel{"slice8", crc32_slice8_update});
+#ifdef CRC32_HAVE_PCLMUL
+    if (crc32_best_kernel() == crc32_pclmul_update)
+        kernels.push_back(Kernel{"pclmul", crc32_pclmul_update});
+#endif
+
+    if (!cross_check(kernels))
+        return 1;
+    std::cout << "cross-check OK (" << kernels.size() << " kernels)" << std::endl;
+
+    std::vector<uint8_t> buf(size);
+    std::mt19937 rng(1);
+    for (size_t i = 0; i < size; ++i)
+        buf[i] = rng();
+
+    for (size_t k = 0; k < kernels.size(); ++k)
+    {
+        uint32_t sink = 0;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < iters; ++i)
+            sink += kernels[k].fn(~0U, &buf[0], size);
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << std::left << std::setw(10) << kernels[k].name << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8)
+                  << size * (double)iters / secs / 1e9 << " GB/s  "
+                  << std::setw(8) << secs * 1e9 / iters << " ns/buffer"
+                  << "  (" << std::hex << sink << std::dec << ")" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+// Microbenchmark for the FEC kernels in FecCodec.h. Before timing anything it
+// cross-checks every multiply-add and XOR kernel against the scalar ones on
+// random buffers, and round-trips random blocks through encode, random
+// erasures and decode; it exits non-zero on the first mismatch.
+//
+// Usage: ./bench_fec [block-size] [parity-count] [iterations]
+//   Times encoding one block of DATA-sized symbols into parity-count parity
+//   symbols with each kernel (row 0 is the XOR row), then rebuilding
+//   parity-count lost symbols with the best kernel.
+
+#include "FecCodec.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#define SYMBOL_SIZE 1452 // 2-byte length + FEC chunk, as on the wire
+
+typedef std::chrono::steady_clock Clock;
+typedef std::vector<uint8_t> Buffer;
+
+struct Kernel
+{
+    std::string name;
+    fec_mul_add_kernel mul_add;
+    fec_xor_kernel xor_into;
+};
+
+static bool cross_check(const std::vector<Kernel> &kernels)
+{
+    std::mt19937 rng(489);
+    Buffer src(4096), want(4096), got(4096);
+    for (int trial = 0; trial < 5000; ++trial)
+    {
+        size_t len = trial < 512 ? trial : rng() % (src.size() - 64);
+        size_t off = rng() % 64;
+        uint8_t c = trial < 256 ? trial : rng();
+        for (size_t i = 0; i < src.size(); ++i)
+        {
+            src[i] = rng();
+            want[i] = got[i] = rng();
+        }
+        fec_mul_add_scalar(&want[off], &src[off], c, len);
+        for (size_t k = 0; k < kernels.size(); ++k)
+        {
+            Buffer out(got);
+            kernels[k].mul_add(&out[off], &src[off], c, len);
+            Buffer x1(got), x2(got);
+            fec_xor_scalar(&x1[off], &src[off], len);
+            kernels[k].xor_into(&x2[off], &src[off], len);
+            if (out != want || x1 != x2)
+            {
+                std::cerr << kernels[k].name << " mismatch: len " << len
+                          << " offset " << off << " c " << (int)c << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void encode(const std::vector<Buffer> &data, std::vector<Buffer> &parity,
+                   fec_mul_add_kernel mul_add, fec_xor_kernel xor_into)
+{
+    for (size_t j = 0; j < parity.size(); ++j)
+    {
+        std::fill(parity[j].begin(), parity[j].end(), 0);
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            uint8_t c = fec_coefficient(j, i);
+            if (c == 1)
+                xor_into(&parity[j][0], &data[i][0], SYMBOL_SIZE);
+            else
+                mul_add(&parity[j][0], &data[i][0], c, SYMBOL_SIZE);
+        }
+    }
+}
+
+// EFFECTS: Rebuild data[lost[t]] from parity rows rows[0..e) in place
+static bool decode(std::vector<Buffer> &data, const std::vector<Buffer> &parity,
+                   const std::vector<unsigned> &rows, const std::vector<unsigned> &lost)
+{
+    unsigned e = lost.size();
+    std::vector<uint8_t> inverse(e * e);
+    if (!fec_invert(e, &rows[0], &lost[0], &inverse[0]))
+        return false;
+
+    std::vector<Buffer> syndrome(e);
+    for (unsigned r = 0; r < e; ++r)
+    {
+        syndrome[r] = parity[rows[r]];
+        for (unsigned i = 0; i < data.size(); ++i)
+            if (std::find(lost.begin(), lost.end(), i) == lost.end())
+                fec_mul_add(&syndrome[r][0], &data[i][0],
+                            fec_coefficient(rows[r], i), SYMBOL_SIZE);
+    }
+    for (unsigned t = 0; t < e; ++t)
+    {
+        Buffer &out = data[lost[t]];
+        std::fill(out.begin(), out.end(), 0);
+        for (unsigned r = 0; r < e; ++r)
+            fec_mul_add(&out[0], &syndrome[r][0], inverse[t * e + r], SYMBOL_SIZE);
+    }
+    return true;
+}
+
+static bool round_trip()
+{
+    std::mt19937 rng(7);
+    for (int trial = 0; trial < 300; ++trial)
+    {
+        size_t n = 1 + rng() % 64;
+        size_t k = 1 + rng() % 8;
+        std::vector<Buffer> data(n, Buffer(SYMBOL_SIZE)), parity(k, Buffer(SYMBOL_SIZE));
+        for (size_t i = 0; i < n; ++i)
+            for (size_t b = 0; b < SYMBOL_SIZE; ++b)
+                data[i][b] = rng();
+        encode(data, parity, fec_best_mul_add(), fec_best_xor());
+
+        // Lose up to k symbols and rebuild them from a random choice of rows
+        std::vector<Buffer> received(data);
+        std::vector<unsigned> lost, rows;
+        for (unsigned i = 0; i < n && lost.size() < k; ++i)
+            if (rng() % 3 == 0)
+                lost.push_back(i);
+        for (unsigned j = 0; j < k; ++j)
+            rows.push_back(j);
+        std::shuffle(rows.begin(), rows.end(), rng);
+        rows.resize(lost.size());
+        for (size_t t = 0; t < lost.size(); ++t)
+            std::fill(received[lost[t]].begin(), received[lost[t]].end(), 0xAA);
+
+        if (!lost.empty() && (!decode(received, parity, rows, lost) || received != data))
+        {
+            std::cerr << "round trip failed: block " << n << " parity " << k
+                      << " lost " << lost.size() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 16;
+    size_t k = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 4;
+    size_t iters = argc > 3 ? std::strtoul(argv[3], NULL, 10) : 20000;
+    if (n < 1 || n > FEC_MAX_DATA || k < 1 || k > FEC_MAX_PARITY || k > n)
+    {
+        std::cerr << "block-size must be 1-" << FEC_MAX_DATA << ", parity-count 1-"
+                  << FEC_MAX_PARITY << " and at most block-size" << std::endl;
+        return 1;
+    }
+
+    std::vector<Kernel> kernels;
+    kernels.push_back(Kernel{"scalar", fec_mul_add_scalar, fec_xor_scalar});
+#ifdef FEC_HAVE_X86
+    if (__builtin_cpu_supports("ssse3"))
+        kernels.push_back(Kernel{"ssse3", fec_mul_add_ssse3, fec_xor_scalar});
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(Kernel{"avx2", fec_mul_add_avx2, fec_xor_avx2});
+    if (__builtin_cpu_supports("gfni") && __builtin_cpu_supports("avx2"))
+        kernels.push_back(Kernel{"gfni", fec_mul_add_gfni, fec_xor_avx2});
+#endif
+
+    if (!cross_check(kernels) || !round_trip())
+        return 1;
+    std::cout << "cross-check OK (" << kernels.size() << " kernels), round trips OK"
+              << std::endl;
+
+    std::mt19937 rng(1);
+    std::vector<Buffer> data(n, Buffer(SYMBOL_SIZE));
+    for (size_t i = 0; i < n; ++i)
+        for (size_t b = 0; b < SYMBOL_SIZE; ++b)
+            data[i][b] = rng();
+    double block_bytes = n * (double)SYMBOL_SIZE;
+
+    std::cout << "block " << n << " x " << SYMBOL_SIZE << " B; encode MB/s of data"
+              << std::endl;
+    for (size_t kern = 0; kern < kernels.size(); ++kern)
+    {
+        std::cout << std::left << std::setw(8) << kernels[kern].name << std::right;
+        // One parity row is the XOR-only code; k rows is Reed-Solomon
+        size_t counts[2] = {1, k};
+        for (int c = 0; c < (k > 1 ? 2 : 1); ++c)
+        {
+            std::vector<Buffer> parity(counts[c], Buffer(SYMBOL_SIZE));
+            Clock::time_point start = Clock::now();
+            for (size_t it = 0; it < iters; ++it)
+                encode(data, parity, kernels[kern].mul_add, kernels[kern].xor_into);
+            double secs = seconds_since(start);
+            std::cout << "  " << (counts[c] == 1 ? "xor" : "rs") << "(k=" << counts[c]
+                      << ") " << std::fixed << std::setprecision(0) << std::setw(7)
+                      << block_bytes * iters / secs / 1e6;
+        }
+        std::cout << std::endl;
+    }
+
+    // Rebuild the first k symbols from every parity row
+    std::vector<Buffer> parity(k, Buffer(SYMBOL_SIZE));
+    encode(data, parity, fec_best_mul_add(), fec_best_xor());
+    std::vector<unsigned> rows, lost;
+    for (unsigned j = 0; j < k; ++j)
+    {
+        rows.push_back(j);
+        lost.push_back(j);
+    }
+    std::vector<Buffer> work(data);
+    size_t decode_iters = std::max<size_t>(1, iters / 4);
+    Clock::time_point start = Clock::now();
+    for (size_t it = 0; it < decode_iters; ++it)
+        decode(work, parity, rows, lost);
+    double secs = seconds_since(start);
+    if (work != data)
+    {
+        std::cerr << "decode produced wrong data" << std::endl;
+        return 1;
+    }
+    std::cout << "decode " << k << " lost: " << std::fixed << std::setprecision(1)
+              << secs * 1e6 / decode_iters << " us/block" << std::endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Load test for the stats socket of a running wSender / wReceiver
+// (--stats=SOCKET). It first connects N times and closes each connection
+// without reading, as an impatient client would, and exits non-zero if the
+// process stops answering after that. Then it times back-to-back snapshots.
+//
+// Usage: ./bench_stats <socket> [--hangups=N] [--fetches=N]
+
+#include "CliOptions.h"
+
+#include <chrono>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// EFFECTS: A connection to the socket at path, or -1
+static int connect_to(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (const sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// EFFECTS: Bytes of one snapshot from the socket at path; 0 if nobody answers
+static size_t fetch(const std::string &path)
+{
+    int fd = connect_to(path);
+    if (fd < 0)
+        return 0;
+    size_t total = 0;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        total += n;
+    close(fd);
+    return total;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: ./bench_stats <socket> [--hangups=N] [--fetches=N]"
+                  << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 2);
+    long hangups = options.get_long("hangups", 1000);
+    long fetches = options.get_long("fetches", 1000);
+
+    long hung = 0;
+    for (; hung < hangups; ++hung)
+    {
+        int fd = connect_to(argv[1]);
+        if (fd < 0)
+            break; // Reported below: nobody answers
+        close(fd);
+    }
+    if (fetch(argv[1]) == 0)
+    {
+        std::cerr << "ERROR no snapshot from " << argv[1] << " after " << hung
+                  << " hang-ups" << std::endl;
+        exit(1);
+    }
+    std::cout << "hang-ups OK (" << hangups << ")" << std::endl;
+
+    size_t bytes = 0;
+    long done = 0;
+    Clock::time_point start = Clock::now();
+    for (; done < fetches; ++done)
+    {
+        size_t n = fetch(argv[1]);
+        if (n == 0)
+            break;
+        bytes += n;
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    if (done == 0)
+        return 1;
+    std::cout << std::fixed << std::setprecision(1) << done << " snapshots, "
+              << secs * 1e6 / done << " us each, " << bytes / done << " bytes"
+              << std::endl;
+    return done == fetches ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#!/usr/bin/env bash
+# Reproducible throughput benchmark for WTP-base and WTP-opt.
+#
+# Every run sends the same file through wtp_relay (seeded loss, delay, ...) to
+# a fresh receiver, checks the output byte-for-byte and reports:
+#   time     completion time of the sender in seconds
+#   goodput  file bytes / time, in Mbit/s
+#   retx     DATA packets sent / chunks in the file - 1 (0 = no retransmits;
+#            negative when --compress packs more than a chunk per packet)
+#
+# Usage: tools/bench_transfer.sh [size-MB]
+# Sweep and link settings come from the environment:
+#   IMPLS="base opt"  WINDOWS="16 64 256"  LOSSES="0 0.01 0.05"
+#   DELAY=1 JITTER=0 RATE=0 QUEUE=0 SEED=489 PORT=40000 TIMEOUT=300
+#   SENDER_ARGS / RELAY_ARGS append extra flags to every run.
+#   INPUT=FILE sends FILE instead of seeded random bytes (size-MB is ignored),
+#   e.g. a log with SENDER_ARGS=--compress.
+
+set -u
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$HERE")
+
+SIZE_MB=${1:-8}
+IMPLS=${IMPLS:-"base opt"}
+WINDOWS=${WINDOWS:-"16 64 256"}
+LOSSES=${LOSSES:-"0 0.01 0.05"}
+DELAY=${DELAY:-1}
+JITTER=${JITTER:-0}
+RATE=${RATE:-0}
+QUEUE=${QUEUE:-0}
+SEED=${SEED:-489}
+PORT=${PORT:-40000}
+TIMEOUT=${TIMEOUT:-300}
+SENDER_ARGS=${SENDER_ARGS:-}
+RELAY_ARGS=${RELAY_ARGS:-}
+INPUT=${INPUT:-}
+
+CHUNK=1456 # FILE_CHUNK_SIZE
+
+make -s -C "$HERE" wtp_relay >/dev/null || exit 1
+for impl in $IMPLS; do
+    make -s -C "$ROOT/WTP-$impl" >/dev/null || exit 1
+done
+
+WORK=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$WORK"' EXIT
+
+# Seeded input so every run of the suite sends identical bytes
+if [ -z "$INPUT" ]; then
+    INPUT="$WORK/input.bin"
+    head -c $((SIZE_MB * 1024 * 1024)) < <(openssl enc -aes-128-ctr -nosalt \
+        -pass pass:"$SEED" -in /dev/zero 2>/dev/null) > "$INPUT"
+fi
+BYTES=$(stat -c %s "$INPUT")
+CHUNKS=$(((BYTES + CHUNK - 1) / CHUNK))
+
+printf "%-5s %7s %6s %9s %14s %8s %s\n" \
+    impl window loss "time(s)" "goodput(Mb/s)" retx result
+
+for impl in $IMPLS; do
+    for window in $WINDOWS; do
+        for loss in $LOSSES; do
+            out="$WORK/out"
+            rm -rf "$out" && mkdir -p "$out"
+            recv_port=$PORT
+            relay_port=$((PORT + 1))
+            PORT=$((PORT + 2)) # Fresh ports so stale packets never leak in
+
+            "$ROOT/WTP-$impl/wReceiver" $recv_port "$window" "$out" \
+                "$WORK/receiver.log" >/dev/null 2>&1 &
+            receiver=$!
+            "$HERE/wtp_relay" $relay_port 127.0.0.1 $recv_port \
+                --loss="$loss" --delay="$DELAY" --jitter="$JITTER" \
+                --rate="$RATE" --queue="$QUEUE" --seed="$SEED" \
+                --spare-handshake $RELAY_ARGS >/dev/null 2>&1 &
+            relay=$!
+            sleep 0.2
+
+            start=$(date +%s.%N)
+            timeout "$TIMEOUT" "$ROOT/WTP-$impl/wSender" 127.0.0.1 $relay_port \
+                "$window" "$INPUT" "$WORK/sender.log" $SENDER_ARGS >/dev/null 2>&1
+            status=$?
+            end=$(date +%s.%N)
+            sleep 0.2 # Let the receiver flush after END
+
+            kill $receiver $relay 2>/dev/null
+            wait $receiver $relay 2>/dev/null
+
+            if [ $status -ne 0 ]; then
+                result="FAIL($status)"
+            elif cmp -s "$INPUT" "$out/FILE-0.out"; then
+                result=ok
+            else
+                result=CORRUPT
+            fi
+
+            sent=$(cat "$WORK"/sender.log* 2>/dev/null | grep -c '^2')
+            awk -v impl="$impl" -v w="$window" -v loss="$loss" -v s="$start" \
+                -v e="$end" -v bytes="$BYTES" -v sent="$sent" -v chunks="$CHUNKS" \
+                -v result="$result" 'BEGIN {
+                    t = e - s
+                    printf "%-5s %7d %6s %9.3f %14.2f %8.3f %s\n", impl, w, loss,
+                           t, bytes * 8 / t / 1e6, sent / chunks - 1, result
+                }'
+            rm -f "$WORK"/sender.log* "$WORK"/receiver.log*
+        done
+    done
+done
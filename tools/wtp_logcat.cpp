@@ -0,0 +1,56 @@
+// Turn a binary packet log (--binary-log) back into the text log format.
+//
+// Usage: ./wtp_logcat <binary-log> [--timestamps]
+//   Prints one "<type> <seqNum> <length> <checksum>" line per record to
+//   stdout, exactly as the text log would have held it. --timestamps prefixes
+//   each line with the record's send/receive time in microseconds since the
+//   Unix epoch.
+
+#include "PacketLog.h"
+#include "CliOptions.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: ./wtp_logcat <binary-log> [--timestamps]" << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 2);
+    bool timestamps = options.has("timestamps");
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        std::cerr << "ERROR opening " << argv[1] << std::endl;
+        exit(1);
+    }
+
+    char magic[sizeof(LOG_BINARY_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0)
+    {
+        std::cerr << argv[1] << " is not a binary WTP log" << std::endl;
+        exit(1);
+    }
+
+    std::vector<LogRecord> records(4096);
+    std::string text;
+    size_t n;
+    while ((n = fread(&records[0], sizeof(LogRecord), records.size(), in)) > 0)
+    {
+        text.clear();
+        for (size_t i = 0; i < n; ++i)
+            PacketLog::format(records[i], text, timestamps);
+        fwrite(text.data(), 1, text.size(), stdout);
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,275 @@
+// Lossy-link emulator for benchmarking WTP on loopback.
+//
+// Sits between wSender and wReceiver: senders talk to <listen-port>, and every
+// datagram is forwarded to <receiver-IP>:<receiver-port> through a per-sender
+// upstream socket (so the receiver still sees one port per sender). Replies
+// travel back the same way. Both directions pass through the same seeded
+// impairments, so a given --seed replays the same loss pattern.
+//
+// Usage: ./wtp_relay <listen-port> <receiver-IP> <receiver-port>
+//          [--loss=P] [--dup=P] [--reorder=P] [--reorder-ms=MS]
+//          [--delay=MS] [--jitter=MS] [--rate=MBIT] [--queue=PACKETS]
+//          [--seed=N] [--spare-handshake]
+//
+//   --loss        drop probability per datagram
+//   --dup         probability a datagram is delivered twice
+//   --reorder     probability a datagram is held back an extra --reorder-ms
+//   --delay       one-way propagation delay; --jitter adds uniform +-jitter
+//   --rate        bottleneck bandwidth per direction in Mbit/s (0 = unlimited)
+//   --queue       bottleneck queue length; datagrams beyond it are tail-dropped
+//   --spare-handshake  never drop START / END (type 0 / 1) datagrams, so senders
+//                      that do not retry them can still be measured under loss
+
+#include "PacketHeader.h"
+#include "PacketCodec.h"
+#include "CliOptions.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <queue>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_DATAGRAM 65536
+
+typedef std::chrono::steady_clock Clock;
+
+struct Impairments
+{
+    double loss, dup, reorder;
+    Clock::duration reorder_extra, delay, jitter;
+    double rate_bps;
+    size_t queue_limit;
+    bool spare_handshake;
+};
+
+// A datagram waiting for its emulated delivery time
+struct InFlight
+{
+    Clock::time_point due;
+    uint64_t order; // Tie-breaker so equal due times keep arrival order
+    int out_fd;
+    sockaddr_in to;
+    std::string data;
+
+    bool operator>(const InFlight &other) const
+    {
+        return due != other.due ? due > other.due : order > other.order;
+    }
+};
+
+// One direction of the emulated path: its own bottleneck queue
+struct Link
+{
+    Clock::time_point free_at;                // When the bottleneck goes idle
+    std::deque<Clock::time_point> departures; // When each queued datagram has
+                                              // been serialized, in order
+};
+
+class Relay
+{
+public:
+    Relay(int listen_port, const sockaddr_in &receiver, const Impairments &imp,
+          unsigned seed)
+        : receiver(receiver), imp(imp), rng(seed), order(0)
+    {
+        listen_fd = udp_socket(listen_port);
+        forward.free_at = Clock::now();
+        backward.free_at = forward.free_at;
+    }
+
+    void run()
+    {
+        std::vector<char> buf(MAX_DATAGRAM);
+        while (true)
+        {
+            // Wait for traffic or for the next delivery to come due
+            int wait_ms = -1;
+            if (!pending.empty())
+            {
+                Clock::duration left = pending.top().due - Clock::now();
+                wait_ms = std::max<long>(0, std::chrono::duration_cast<
+                                                std::chrono::milliseconds>(left).count());
+            }
+
+            std::vector<pollfd> fds(1, pollfd{listen_fd, POLLIN, 0});
+            for (auto &up : upstream)
+                fds.push_back(pollfd{up.second, POLLIN, 0});
+            poll(&fds[0], fds.size(), wait_ms);
+
+            for (size_t i = 0; i < fds.size(); ++i)
+            {
+                if (!(fds[i].revents & POLLIN))
+                    continue;
+                sockaddr_in from;
+                socklen_t len = sizeof(from);
+                ssize_t n = recvfrom(fds[i].fd, &buf[0], buf.size(), MSG_DONTWAIT,
+                                     (sockaddr *)&from, &len);
+                if (n < 0)
+                    continue;
+
+                if (fds[i].fd == listen_fd)
+                    submit(forward, upstream_for(from), receiver, &buf[0], n);
+                else
+                    submit(backward, listen_fd, client_of[fds[i].fd], &buf[0], n);
+            }
+
+            deliver_due();
+        }
+    }
+
+private:
+    static int udp_socket(int port)
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0)
+            throw std::runtime_error("ERROR creating socket");
+        int buf = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+            throw std::runtime_error("ERROR binding relay socket");
+        return fd;
+    }
+
+    // EFFECTS: The socket that carries this sender's traffic to the receiver
+    int upstream_for(const sockaddr_in &client)
+    {
+        uint64_t key = ((uint64_t)client.sin_addr.s_addr << 16) | client.sin_port;
+        auto it = upstream.find(key);
+        if (it != upstream.end())
+            return it->second;
+
+        int fd = udp_socket(0);
+        upstream[key] = fd;
+        client_of[fd] = client;
+        return fd;
+    }
+
+    // EFFECTS: Apply the impairments to one datagram and schedule survivors
+    void submit(Link &link, int out_fd, const sockaddr_in &to, const char *data, size_t len)
+    {
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        bool handshake = false;
+        if (imp.spare_handshake && len >= sizeof(PacketHeader))
+        {
+            unsigned type = decode_header(data).type;
+            handshake = type == PACKET_START || type == PACKET_END;
+        }
+
+        // Every random draw happens for every datagram, so the sequence of
+        // decisions depends only on the seed and the traffic
+        bool lost = coin(rng) < imp.loss;
+        bool duplicated = coin(rng) < imp.dup;
+        bool reordered = coin(rng) < imp.reorder;
+        double jitter = coin(rng) * 2 - 1;
+        if (lost && !handshake)
+            return;
+
+        // A datagram holds its place in the queue until it is serialized,
+        // whatever delay it meets after the bottleneck
+        Clock::time_point now = Clock::now();
+        while (!link.departures.empty() && link.departures.front() <= now)
+            link.departures.pop_front();
+        link.free_at = std::max(link.free_at, now);
+        if (imp.rate_bps > 0)
+        {
+            if (imp.queue_limit && link.departures.size() >= imp.queue_limit && !handshake)
+                return; // Tail drop at the bottleneck
+            link.free_at += std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(len * 8 / imp.rate_bps));
+            link.departures.push_back(link.free_at);
+        }
+
+        Clock::duration extra = std::chrono::duration_cast<Clock::duration>(
+            imp.jitter * jitter);
+        Clock::time_point due = std::max(now, link.free_at + imp.delay + extra);
+        if (reordered)
+            due += imp.reorder_extra;
+
+        // A duplicate rides along with its original: one place in the queue
+        for (int copies = duplicated ? 2 : 1; copies > 0; --copies)
+            pending.push(InFlight{due, order++, out_fd, to, std::string(data, len)});
+    }
+
+    void deliver_due()
+    {
+        Clock::time_point now = Clock::now();
+        while (!pending.empty() && pending.top().due <= now)
+        {
+            const InFlight &packet = pending.top();
+            sendto(packet.out_fd, packet.data.data(), packet.data.size(), 0,
+                   (const sockaddr *)&packet.to, sizeof(packet.to));
+            pending.pop();
+        }
+    }
+
+    int listen_fd;
+    sockaddr_in receiver;
+    Impairments imp;
+    std::mt19937_64 rng;
+    uint64_t order;
+    Link forward, backward;
+
+    std::map<uint64_t, int> upstream;   // Sender address -> upstream socket
+    std::map<int, sockaddr_in> client_of;
+    std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight> > pending;
+};
+
+static Clock::duration millis(double ms)
+{
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(ms));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        std::cout << "Usage: ./wtp_relay <listen-port> <receiver-IP> <receiver-port>"
+                  << " [--loss=P] [--dup=P] [--reorder=P] [--reorder-ms=MS]"
+                  << " [--delay=MS] [--jitter=MS] [--rate=MBIT] [--queue=PACKETS]"
+                  << " [--seed=N] [--spare-handshake]" << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 4);
+    Impairments imp;
+    imp.loss = options.get_double("loss", 0);
+    imp.dup = options.get_double("dup", 0);
+    imp.reorder = options.get_double("reorder", 0);
+    imp.reorder_extra = millis(options.get_double("reorder-ms", 5));
+    imp.delay = millis(options.get_double("delay", 0));
+    imp.jitter = millis(options.get_double("jitter", 0));
+    imp.rate_bps = options.get_double("rate", 0) * 1e6;
+    imp.queue_limit = options.get_long("queue", 0);
+    imp.spare_handshake = options.has("spare-handshake");
+
+    sockaddr_in receiver;
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.sin_family = AF_INET;
+    receiver.sin_port = htons(std::stoi(argv[3]));
+    receiver.sin_addr.s_addr = inet_addr(argv[2]);
+
+    signal(SIGPIPE, SIG_IGN);
+    Relay relay(std::stoi(argv[1]), receiver, imp, options.get_long("seed", 489));
+    relay.run();
+    return 0;
+}
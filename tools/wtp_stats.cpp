@@ -0,0 +1,80 @@
+// Read live metrics from a running wSender / wReceiver (--stats=SOCKET).
+//
+// Usage: ./wtp_stats <socket> [--watch=MS]
+//   Prints the JSON snapshot the process serves on its stats socket, one
+//   document per line. --watch repeats every MS milliseconds until the
+//   process goes away. (bench_stats load-tests the socket.)
+
+#include "CliOptions.h"
+
+#include <chrono>
+#include <thread>
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// EFFECTS: A connection to the socket at path, or -1
+static int connect_to(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (const sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// EFFECTS: One snapshot from the socket at path; false if nobody answers
+static bool fetch(const std::string &path, std::string &text)
+{
+    int fd = connect_to(path);
+    if (fd < 0)
+        return false;
+    text.clear();
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        text.append(buf, n);
+    close(fd);
+    return !text.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: ./wtp_stats <socket> [--watch=MS]" << std::endl;
+        exit(1);
+    }
+
+    CliOptions options(argc, argv, 2);
+    long watch = options.get_long("watch", 0);
+
+    std::string text;
+    if (!fetch(argv[1], text))
+    {
+        std::cerr << "ERROR reading stats from " << argv[1] << std::endl;
+        exit(1);
+    }
+    std::cout << text << std::flush;
+    while (watch > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(watch));
+        if (!fetch(argv[1], text))
+            break;
+        std::cout << text << std::flush;
+    }
+    return 0;
+}